@@ -1,6 +1,7 @@
 #include "App.h"
 
 #include <Corrade/Containers/StridedArrayView.h>
+#include <Corrade/Utility/Arguments.h>
 
 #include <Magnum/Image.h>
 
@@ -13,9 +14,16 @@
 #include <Magnum/ImageView.h>
 #include <Magnum/PixelFormat.h>
 
+#include "Batch.h"
+#include "Checkpoint.h"
 #include "Integrators.h"
+#include "Perf.h"
+#include "Scene.h"
+#include "TaskPool.h"
 #include "Util.h"
 
+#include <chrono>
+
 namespace clothsim {
 
 using namespace Magnum::Math::Literals;
@@ -78,28 +86,406 @@ App::App(const Arguments &arguments)
       .setProjectionMatrix(Matrix4::perspectiveProjection(
           35.0_degf, aspectRatio, 0.001f, 100.0f))
       .setViewport(vpSize);
+
+  Utility::Arguments args;
+  args.addOption("load")
+      .setHelp("load", "checkpoint to restore on startup", "FILE")
+      .addOption("scene")
+      .setHelp("scene", "scene description to set up on startup", "FILE")
+      .addOption("export")
+      .setHelp("export", "point cache (.pc2 or .mdd) to export frames to",
+               "FILE")
+      .addOption("export-stride", "1")
+      .setHelp("export-stride", "export every n-th simulated frame", "N")
+      .addOption("threads", "0")
+      .setHelp("threads", "threads of the simulation, 0 for one per core",
+               "N")
+      .addBooleanOption("deterministic")
+      .setHelp("deterministic",
+               "bitwise identical results for any thread count")
+      .addSkippedPrefix("magnum", "engine-specific options")
+      .parse(arguments.argc, arguments.argv);
+
+  if (const auto threads{args.value<std::size_t>("threads")}; threads > 0)
+    setThreadCount(threads);
+  setDeterministic(args.isSet("deterministic"));
+
+  // Settings sent while the UI was set up, before reading them back
+  applyCommands();
+  m_ui.syncSettings();
+
+  if (!args.value("scene").empty())
+    loadScene(args.value("scene"));
+
+  if (!args.value("load").empty())
+    loadCheckpoint(args.value("load"));
+
+  if (!args.value("export").empty())
+    startPointCacheExport(args.value("export"),
+                          args.value<UnsignedInt>("export-stride"));
 }
 
-void App::setIntegrator(
-    std::function<void(System &system, const Float dt)> integrator) {
-  m_integrator = integrator;
+void App::setIntegrator(const std::size_t i) {
+  if (i >= m_newtonPolicies.size())
+    return;
+
+  auto integrator{integratorByIndex(i, m_newtonPolicies[i])};
+  if (!integrator)
+    return;
+
+  m_integratorType = i;
+  sendCommand(IntegratorCommand{std::move(integrator)});
+}
+
+std::size_t App::getIntegrator() const { return m_integratorType; }
+
+void App::setNewtonPolicy(const NewtonPolicy &policy) {
+  m_newtonPolicies[m_integratorType] = policy;
+  setIntegrator(m_integratorType);
+}
+
+const NewtonPolicy &App::getNewtonPolicy() const {
+  return m_newtonPolicies[m_integratorType];
+}
+
+void App::setLinearSolver(const std::size_t i) {
+  if (i > std::size_t(LinearSolverType::Multigrid))
+    return;
+
+  m_linearSolver = LinearSolverType(i);
+  sendCommand(LinearSolverCommand{m_linearSolver});
+}
+
+std::size_t App::getLinearSolver() const {
+  return std::size_t(m_linearSolver);
 }
 
 void App::setSystem(const std::size_t i) {
+  stopRecording();
+  stopPointCacheExport();
+  m_playback = nullptr;
+  m_systemType = i;
+  m_simulationTime = 0.0;
+
   switch (i) {
   case 0:
-    m_system = std::make_unique<Oscillator>(m_phongShader, m_vertexShader,
-                                            m_scene, m_drawableGroup);
+    replaceSystem(std::make_unique<Oscillator>());
     break;
   case 1:
-    m_system = std::make_unique<Planet>(m_phongShader, m_vertexShader, m_scene,
-                                        m_drawableGroup);
+    replaceSystem(std::make_unique<Planet>());
     break;
-  case 2:
-    m_system = std::make_unique<Cloth>(m_phongShader, m_vertexShader, m_scene,
-                                       m_drawableGroup);
+  case 2: {
+    auto cloth{std::make_unique<Cloth>()};
+    cloth->setSize(m_clothSize);
+    replaceSystem(std::move(cloth));
     break;
   }
+  case 3:
+    replaceSystem(std::make_unique<NBody>(m_nbody));
+    break;
+  }
+
+  wakeSimulation();
+}
+
+std::size_t App::getSystemType() const { return m_systemType; }
+
+void App::setClothSize(const Vector2ui size) {
+  if (size != m_clothSize) {
+    stopRecording();
+    stopPointCacheExport();
+  }
+
+  m_clothSize = size;
+
+  if (auto cloth = dynamic_cast<Cloth *>(m_system.get()))
+    cloth->setSize(size);
+
+  wakeSimulation();
+}
+
+Vector2ui App::getClothSize() const { return m_clothSize; }
+
+bool App::loadClothMesh(const std::string &filename) {
+  if (m_systemType != 2 || m_playback) {
+    setSystem(2);
+    m_ui.syncSettings();
+  }
+
+  stopRecording();
+  stopPointCacheExport();
+
+  try {
+    static_cast<Cloth &>(*m_system).loadMesh(filename);
+  } catch (const std::exception &e) {
+    Error{} << "Loading mesh failed:" << e.what();
+    return false;
+  }
+
+  m_simulationTime = 0.0;
+  wakeSimulation();
+  return true;
+}
+
+bool App::loadScene(const std::string &filename) {
+  try {
+    const auto scene{clothsim::loadScene(filename)};
+    auto system{createSystem(scene)};
+
+    stopRecording();
+    stopPointCacheExport();
+
+    m_playback = nullptr;
+    m_systemType = scene.systemType;
+    m_clothSize = scene.clothSize;
+    m_selfCollision = scene.selfCollision;
+    m_sleep = scene.sleep;
+    m_nbody = scene.nbody;
+    m_linearSolver = scene.solver;
+    m_simulationTime = 0.0;
+    replaceSystem(std::move(system));
+
+    if (scene.integrator < m_newtonPolicies.size())
+      m_newtonPolicies[scene.integrator] = scene.newton;
+    setIntegrator(scene.integrator);
+    m_stepLength = scene.stepLength;
+    m_stepsPerFrame = scene.stepsPerFrame;
+  } catch (const std::exception &e) {
+    Error{} << "Loading scene failed:" << e.what();
+    return false;
+  }
+
+  m_ui.syncSettings();
+  wakeSimulation();
+
+  Debug{} << "Loaded scene" << filename;
+  return true;
+}
+
+bool App::saveCheckpoint(const std::string &filename) {
+  if (m_playback) {
+    Error{} << "Cannot save a checkpoint during playback";
+    return false;
+  }
+
+  if (auto cloth = dynamic_cast<const Cloth *>(m_system.get());
+      cloth && !cloth->isGrid()) {
+    Error{} << "Checkpoints of mesh cloths are not supported";
+    return false;
+  }
+
+  CheckpointSettings settings;
+  settings.systemType = static_cast<UnsignedInt>(m_systemType);
+  settings.size = m_clothSize;
+  settings.integrator = static_cast<UnsignedInt>(m_integratorType);
+  settings.stepsPerFrame = m_stepsPerFrame;
+  settings.stepLength = m_stepLength;
+  settings.frameBudget = m_frameBudget;
+  settings.realTime = m_realTime;
+  settings.particleMass = m_system->getParticleMass();
+  settings.nbody = m_nbody;
+
+  if (auto cloth = dynamic_cast<const Cloth *>(m_system.get())) {
+    settings.extent = cloth->getExtent();
+    settings.stiffness = cloth->getStiffness();
+    settings.drag = cloth->getDragCoefficient();
+  }
+
+  try {
+    clothsim::saveCheckpoint(filename, settings, *m_system);
+  } catch (const std::exception &e) {
+    Error{} << "Saving checkpoint failed:" << e.what();
+    return false;
+  }
+
+  Debug{} << "Saved checkpoint" << filename;
+  return true;
+}
+
+bool App::startRecording(const std::string &filename) {
+  stopRecording();
+
+  try {
+    m_recorder = std::make_unique<TrajectoryRecorder>(
+        filename, m_system->getMeshIndices(), m_system->getParticleCount());
+    m_recorder->record(m_simulationTime, m_system->getMeshVertices());
+  } catch (const std::exception &e) {
+    Error{} << "Recording failed:" << e.what();
+    m_recorder.reset();
+    return false;
+  }
+
+  Debug{} << "Recording to" << filename;
+  return true;
+}
+
+void App::stopRecording() {
+  if (!m_recorder)
+    return;
+
+  const auto particleCount{m_recorder->getParticleCount()};
+  const auto stats{m_recorder->finish()};
+  m_recorder.reset();
+
+  if (stats.frames == 0 || stats.compressedBytes == 0)
+    return;
+
+  const auto megabytes{Double(stats.rawBytes) / (1024.0 * 1024.0)};
+  Debug{} << "Recorded" << stats.frames << "frames of" << particleCount
+          << "particles, compression ratio"
+          << Double(stats.rawBytes) / Double(stats.compressedBytes);
+  Debug{} << "Encoding" << megabytes / stats.encodeSeconds
+          << "MB/s, writing" << megabytes / stats.writeSeconds
+          << "MB/s, simulation stalled for" << stats.stallSeconds * 1000.0
+          << "ms";
+}
+
+bool App::isRecording() const { return m_recorder != nullptr; }
+
+bool App::startPointCacheExport(const std::string &filename,
+                                const UnsignedInt frameStride) {
+  stopPointCacheExport();
+
+  try {
+    m_pointCache = std::make_unique<PointCacheWriter>(
+        filename, m_system->getMeshIndices(), m_system->getMeshVertices(),
+        frameStride);
+    m_pointCache->record(m_simulationTime, m_system->getMeshVertices());
+  } catch (const std::exception &e) {
+    Error{} << "Point cache export failed:" << e.what();
+    m_pointCache.reset();
+    return false;
+  }
+
+  Debug{} << "Exporting point cache to" << filename;
+  return true;
+}
+
+void App::stopPointCacheExport() {
+  if (!m_pointCache)
+    return;
+
+  const auto frames{m_pointCache->finish()};
+  m_pointCache.reset();
+
+  Debug{} << "Exported" << frames << "point cache frames";
+}
+
+bool App::isExportingPointCache() const { return m_pointCache != nullptr; }
+
+bool App::openPlayback(const std::string &filename) {
+  std::unique_ptr<TrajectoryPlayback> playback;
+
+  try {
+    playback = std::make_unique<TrajectoryPlayback>(filename);
+  } catch (const std::exception &e) {
+    Error{} << "Opening trajectory failed:" << e.what();
+    return false;
+  }
+
+  stopRecording();
+  stopPointCacheExport();
+
+  m_playback = playback.get();
+  replaceSystem(std::move(playback));
+  m_playbackTime = m_playback->getFrameTime(0);
+  m_paused = false;
+  wakeSimulation();
+
+  Debug{} << "Playing back" << m_playback->getFrameCount() << "frames from"
+          << filename;
+  return true;
+}
+
+void App::closePlayback() {
+  if (m_playback)
+    setSystem(m_systemType);
+}
+
+TrajectoryPlayback *App::getPlayback() { return m_playback; }
+
+void App::seekPlayback(const std::size_t frame) {
+  if (!m_playback)
+    return;
+
+  try {
+    m_playback->seek(frame);
+    m_playbackTime = m_playback->getFrameTime(m_playback->getFrame());
+  } catch (const std::exception &e) {
+    stopPlayback(e);
+  }
+
+  redraw();
+}
+
+void App::stopPlayback(const std::exception &error) {
+  Error{} << "Playback failed:" << error.what();
+  closePlayback();
+  m_ui.syncSettings();
+}
+
+bool App::loadCheckpoint(const std::string &filename) {
+  try {
+    const Checkpoint checkpoint{filename};
+    const auto &settings{checkpoint.getSettings()};
+
+    if (settings.integrator >= m_newtonPolicies.size())
+      throw std::runtime_error("Unknown integrator");
+
+    // Set up and checked aside, a bad checkpoint leaves the running
+    // simulation as it is
+    Scene scene;
+    scene.systemType = settings.systemType;
+    scene.clothSize = settings.size;
+    scene.clothExtent = settings.extent;
+    scene.stiffness = settings.stiffness;
+    scene.drag = settings.drag;
+    scene.particleMass = settings.particleMass;
+    scene.selfCollision = m_selfCollision;
+    scene.sleep = m_sleep;
+    scene.nbody = settings.nbody;
+    scene.solver = m_linearSolver;
+    auto system{createSystem(scene)};
+
+    const auto state{checkpoint.getState()};
+    if (static_cast<std::size_t>(system->getState().size()) != state.size())
+      throw std::runtime_error("Checkpoint state does not match the system");
+
+    system->setState(Eigen::Map<const System::Vector>(
+        state.data(), static_cast<Eigen::Index>(state.size())));
+
+    system->clearPinnedParticles();
+    for (const auto id : checkpoint.getPinnedParticleIds()) {
+      if (id >= system->getParticleCount())
+        throw std::runtime_error("Pinned particle " + std::to_string(id) +
+                                 " does not exist");
+
+      system->setPinnedParticle(id, true);
+    }
+
+    stopRecording();
+    stopPointCacheExport();
+
+    m_playback = nullptr;
+    m_systemType = settings.systemType;
+    m_clothSize = settings.size;
+    m_nbody = settings.nbody;
+    m_simulationTime = 0.0;
+    replaceSystem(std::move(system));
+
+    setIntegrator(settings.integrator);
+    m_stepLength = settings.stepLength;
+    m_stepsPerFrame = settings.stepsPerFrame;
+    m_frameBudget = settings.frameBudget;
+    setRealTime(settings.realTime);
+  } catch (const std::exception &e) {
+    Error{} << "Loading checkpoint failed:" << e.what();
+    return false;
+  }
+
+  m_ui.syncSettings();
+  Debug{} << "Loaded checkpoint" << filename;
+  return true;
 }
 
 void App::viewportEvent(ViewportEvent &event) {
@@ -136,11 +522,178 @@ void App::resizeFramebuffers(const Vector2i &size) {
   m_framebuffer.setViewport({{}, size});
 }
 
-void App::drawEvent() {
-  for (UnsignedInt i = 0; i < m_stepsPerFrame; ++i) {
-    m_integrator(*m_system, m_stepLength);
+void App::advanceSimulation() {
+  UnsignedInt steps{0};
+
+  if (!m_system)
+    return;
+
+  applyCommands();
+
+  if (m_playback) {
+    advancePlayback();
+    return;
+  }
+
+  if (m_pendingSteps > 0) {
+    steps = m_pendingSteps;
+    m_pendingSteps = 0;
+
+    for (UnsignedInt i = 0; i < steps; ++i) {
+      m_telemetry.step(m_integrator, *m_system, m_stepLength);
+    }
+  } else if (!m_paused && !m_atRest) {
+    if (m_realTime) {
+      steps = advanceWithinBudget();
+    } else {
+      steps = m_stepsPerFrame;
+
+      for (UnsignedInt i = 0; i < steps; ++i) {
+        m_telemetry.step(m_integrator, *m_system, m_stepLength);
+      }
+    }
+  }
+
+  if (steps > 0) {
+    m_simulationTime += static_cast<Double>(steps) * m_stepLength;
+    updateRestState(static_cast<Float>(steps) * m_stepLength);
+
+    if (m_recorder) {
+      try {
+        m_recorder->record(m_simulationTime, m_system->getMeshVertices());
+      } catch (const std::exception &e) {
+        Error{} << "Recording failed:" << e.what();
+        stopRecording();
+      }
+    }
+
+    if (m_pointCache)
+      m_pointCache->record(m_simulationTime, m_system->getMeshVertices());
+
+    // Statistics of the last simulated frame
+    if (auto cloth = dynamic_cast<Cloth *>(m_system.get())) {
+      m_collisionStatistics = cloth->getCollisionStatistics();
+      cloth->resetCollisionStatistics();
+    }
+
+    auto &pool{TaskPool::shared()};
+    for (std::size_t s = 0; s < TaskStageCount; ++s)
+      m_stageStatistics[s] = pool.getStageStatistics(TaskStage(s));
+    pool.resetStageStatistics();
+  }
+}
+
+void App::advancePlayback() {
+  using namespace std::chrono;
+  const auto now{steady_clock::now()};
+  const Double wallTime{
+      Math::min(duration<Double>(now - m_lastFrameTime).count(), 0.1)};
+  m_lastFrameTime = now;
+
+  const auto lastFrame{m_playback->getFrameCount() - 1};
+
+  try {
+    if (m_pendingSteps > 0) {
+      // Stepping moves by frames rather than by time
+      m_playback->seek(m_playback->getFrame() + m_pendingSteps);
+      m_playbackTime = m_playback->getFrameTime(m_playback->getFrame());
+      m_pendingSteps = 0;
+    } else if (!m_paused) {
+      m_playbackTime += wallTime;
+      m_playback->seekTime(m_playbackTime);
+    }
+  } catch (const std::exception &e) {
+    m_pendingSteps = 0;
+    stopPlayback(e);
+    return;
   }
 
+  if (!m_paused && m_playback->getFrame() == lastFrame)
+    m_paused = true;
+}
+
+UnsignedInt App::advanceWithinBudget() {
+  using namespace std::chrono;
+  const auto frameStart{steady_clock::now()};
+
+  // Idle periods (paused, at rest, window events) must not turn into a
+  // burst of catch-up steps
+  const Float wallTime{Math::min(
+      duration<Float>(frameStart - m_lastFrameTime).count(), 0.1f)};
+  m_lastFrameTime = frameStart;
+
+  if (m_stepLength <= 0.0f)
+    return 0;
+
+  m_simulationDebt += wallTime;
+
+  constexpr Float costSmoothing{0.1f};
+  UnsignedInt steps{0};
+  auto stepStart{frameStart};
+
+  while (m_simulationDebt >= m_stepLength) {
+    // Always take at least one step so that the simulation progresses even
+    // when a single step does not fit into the budget
+    const Float elapsed{duration<Float>(stepStart - frameStart).count()};
+    if (steps > 0 && elapsed + m_stepCostEstimate > m_frameBudget)
+      break;
+
+    m_telemetry.step(m_integrator, *m_system, m_stepLength);
+    m_simulationDebt -= m_stepLength;
+    ++steps;
+
+    const auto stepEnd{steady_clock::now()};
+    const Float cost{duration<Float>(stepEnd - stepStart).count()};
+    m_stepCostEstimate = m_stepCostEstimate > 0.0f
+                             ? Math::lerp(m_stepCostEstimate, cost,
+                                          costSmoothing)
+                             : cost;
+    stepStart = stepEnd;
+  }
+
+  // Fell behind, drop what could not be simulated within the budget
+  m_simulationDebt = Math::min(m_simulationDebt, m_stepLength);
+
+  if (wallTime > 0.0f) {
+    const Float ratio{static_cast<Float>(steps) * m_stepLength / wallTime};
+    m_realTimeRatio = Math::lerp(m_realTimeRatio, ratio, costSmoothing);
+  }
+
+  return steps;
+}
+
+void App::updateRestState(const Float simulatedTime) {
+  const auto energy{m_system->getKineticEnergy(m_system->getState()) /
+                    static_cast<Float>(m_system->getParticleCount())};
+
+  if (energy < m_restThreshold) {
+    m_timeBelowRestThreshold += simulatedTime;
+
+    if (!m_atRest && m_timeBelowRestThreshold >= m_restDuration) {
+      m_atRest = true;
+      Debug{} << "System at rest, stopped stepping";
+    }
+  } else {
+    m_timeBelowRestThreshold = 0.0f;
+  }
+}
+
+bool App::isSimulationRunning() const {
+  return m_pendingSteps > 0 || (!m_paused && !m_atRest);
+}
+
+void App::wakeSimulation() {
+  m_atRest = false;
+  m_timeBelowRestThreshold = 0.0f;
+  m_lastFrameTime = std::chrono::steady_clock::now();
+  redraw();
+}
+
+void App::drawEvent() {
+  advanceSimulation();
+  publishSnapshot();
+  m_snapshots.update();
+
   if (m_ui.wantsTextInput() && !isTextInputActive())
     startTextInput();
   else if (!m_ui.wantsTextInput() && isTextInputActive())
@@ -165,12 +718,128 @@ void App::drawEvent() {
                                 GL::FramebufferBlit::Color);
 
   swapBuffers();
+
+  // Only keep drawing while the state changes, input events request
+  // redraws on their own
+  if (isSimulationRunning())
+    redraw();
+}
+
+void App::resetSimulation() { sendCommand(ResetCommand{}); }
+
+void App::sendCommand(SimulationCommand &&command) {
+  // The stepping loop runs on this thread, so a full queue is drained here
+  // instead of waiting for it. Should it still be full, the command is
+  // applied right away rather than lost.
+  if (!m_commands.push(std::move(command))) {
+    applyCommands();
+
+    if (!m_commands.push(std::move(command))) {
+      std::visit([this](auto &c) { applyCommand(c); }, command);
+      wakeSimulation();
+    }
+  }
+
   redraw();
 }
 
-void App::resetSimulation() {
+void App::applyCommands() {
+  SimulationCommand command;
+  bool applied{false};
+
+  // Also drained without a system, edits of particles are dropped then
+  while (m_commands.pop(command)) {
+    std::visit([this](auto &c) { applyCommand(c); }, command);
+    applied = true;
+  }
+
+  if (applied)
+    wakeSimulation();
+}
+
+void App::applyCommand(const TogglePinCommand &command) {
+  if (m_system && command.particle < m_system->getParticleCount())
+    m_system->togglePinnedParticle(command.particle);
+}
+
+void App::applyCommand(const PinCommand &command) {
+  if (!m_system)
+    return;
+
+  for (const auto particle : command.particles) {
+    if (particle < m_system->getParticleCount())
+      m_system->setPinnedParticle(particle, true);
+  }
+}
+
+void App::applyCommand(const ResetCommand &) {
+  if (!m_system)
+    return;
+
+  // Frame times of a recording must not go back
+  stopRecording();
+  stopPointCacheExport();
+
+  m_system->reset();
+  m_simulationTime = 0.0;
+}
+
+void App::applyCommand(const StepLengthCommand &command) {
+  m_stepLength = command.stepLength;
+}
+
+void App::applyCommand(const RestThresholdCommand &command) {
+  m_restThreshold = command.threshold;
+}
+
+void App::applyCommand(const SelfCollisionCommand &command) {
+  if (auto cloth = dynamic_cast<Cloth *>(m_system.get()))
+    cloth->setSelfCollisionSettings(command.settings);
+}
+
+void App::applyCommand(const SleepCommand &command) {
+  if (auto cloth = dynamic_cast<Cloth *>(m_system.get()))
+    cloth->setSleepSettings(command.settings);
+}
+
+void App::applyCommand(IntegratorCommand &command) {
+  m_integrator = std::move(command.integrator);
+}
+
+void App::applyCommand(const LinearSolverCommand &command) {
   if (m_system)
-    m_system->reset();
+    m_system->getSolver().setType(command.type);
+}
+
+void App::applyCommand(const NBodyCommand &command) {
+  auto nbody = dynamic_cast<NBody *>(m_system.get());
+  if (!nbody)
+    return;
+
+  if (command.settings.bodies != nbody->getSettings().bodies) {
+    stopRecording();
+    stopPointCacheExport();
+    m_simulationTime = 0.0;
+  }
+
+  try {
+    nbody->setSettings(command.settings);
+  } catch (const std::exception &e) {
+    Error{} << "Changing the n-body settings failed:" << e.what();
+    m_nbody = nbody->getSettings();
+    m_ui.syncSettings();
+  }
+}
+
+void App::publishSnapshot() {
+  if (!m_system)
+    return;
+
+  // Reuses the memory of an earlier snapshot
+  takeSnapshot(*m_system, m_playback ? m_playbackTime : m_simulationTime,
+               m_snapshots.writeBuffer());
+
+  m_snapshots.publish();
 }
 
 void App::mouseScrollEvent(MouseScrollEvent &event) {
@@ -204,41 +873,78 @@ void App::handleViewportClick(const Vector2i position) {
   const Int selectedVertexId = data.pixels<Int>()[0][0];
 
   if (selectedVertexId >= 0) {
-    m_system->togglePinnedParticle(static_cast<UnsignedInt>(selectedVertexId));
+    sendCommand(TogglePinCommand{static_cast<UnsignedInt>(selectedVertexId)});
     Debug{} << "Toggled vertex number " << selectedVertexId;
   }
 }
 
-void App::pinVertices(const UI::Lasso &lasso) {
-  if (lasso.pixels.size() == 0)
+void App::pinVertices(const UI::Lasso &lasso, const bool includeOccluded) {
+  if (lasso.screenCoord.size() < 3)
     return;
 
-  const auto [min, max] = computeAABB(lasso.pixels);
+  const Polygon polygon{lasso.screenCoord};
+  const Matrix4 viewProjection{m_camera->projectionMatrix() *
+                               m_camera->cameraMatrix()};
+  // Selects what is drawn, which may lag behind the system
+  const auto &positions{m_snapshots.read().vertices};
+  const auto n{positions.size()};
 
-  m_framebuffer.mapForRead(
-      GL::Framebuffer::ColorAttachment{m_phongShader.ObjectIdOutput});
-  const Image2D data = m_framebuffer.read(
-      Range2Di({min.x(), m_framebuffer.viewport().sizeY() - max.y() - 1},
-               {max.x(), m_framebuffer.viewport().sizeY() - min.y() - 1}),
-      PixelFormat::R32I);
+  // Project every particle to normalized device coordinates and test it
+  // against the lasso polygon
+  std::vector<Vector2> projected(n);
+  std::vector<char> selected(n, 0);
 
-  const auto pixels = data.pixels<Int>();
-  std::set<UnsignedInt> seenIndices;
+  parallelFor(TaskStage::Other, n, 0, [&](const std::size_t i) {
+    const Vector4 clip{viewProjection * Vector4{positions[i], 1.0f}};
 
-  const Vector2ui size{max - min};
-  for (std::size_t y = 0; y < size.y(); ++y) {
-    for (std::size_t x = 0; x < size.x(); ++x) {
-      const Int index = pixels[y][x];
+    // Behind the camera
+    if (clip.w() <= 0.0f)
+      return;
 
-      // -1 means no vertex
-      if (index > -1) {
-        seenIndices.insert(static_cast<UnsignedInt>(index));
-      }
-    }
+    projected[i] = clip.xy() / clip.w();
+    selected[i] = polygon.contains(projected[i]);
+  });
+
+  if (!includeOccluded) {
+    // A particle is visible if its marker owns the pixel the particle
+    // projects to
+    const Vector2i fbSize{m_framebuffer.viewport().size()};
+    const auto toFramebuffer = [fbSize](const Vector2 ndc) {
+      return Vector2i{(ndc * 0.5f + Vector2{0.5f}) * Vector2{fbSize}};
+    };
+
+    const Vector2i min{Math::clamp(toFramebuffer(polygon.bounds().min),
+                                   Vector2i{0}, fbSize - Vector2i{1})};
+    const Vector2i max{Math::clamp(toFramebuffer(polygon.bounds().max),
+                                   Vector2i{0}, fbSize - Vector2i{1}) +
+                       Vector2i{1}};
+
+    m_framebuffer.mapForRead(
+        GL::Framebuffer::ColorAttachment{m_phongShader.ObjectIdOutput});
+    const Image2D data =
+        m_framebuffer.read(Range2Di{min, max}, PixelFormat::R32I);
+    const auto ids = data.pixels<Int>();
+
+    parallelFor(TaskStage::Other, n, 0, [&](const std::size_t i) {
+      if (!selected[i])
+        return;
+
+      const Vector2i p{toFramebuffer(projected[i]) - min};
+      selected[i] = p.x() >= 0 && p.y() >= 0 && p.x() < max.x() - min.x() &&
+                    p.y() < max.y() - min.y() &&
+                    ids[std::size_t(p.y())][std::size_t(p.x())] ==
+                        static_cast<Int>(i);
+    });
   }
 
-  for (const auto index : seenIndices)
-    m_system->setPinnedParticle(index, true);
+  PinCommand command;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (selected[i])
+      command.particles.push_back(static_cast<UnsignedInt>(i));
+  }
+
+  if (!command.particles.empty())
+    sendCommand(std::move(command));
 }
 
 void App::mouseMoveEvent(MouseMoveEvent &event) {
@@ -288,14 +994,147 @@ void App::keyReleaseEvent(KeyEvent &event) {
 }
 
 void App::setVertexMarkersVisibility(bool show) {
-  m_system->drawVertexMarkers(show);
+  m_vertexMarkersVisible = show;
+  m_drawable->drawVertexMarkers(show);
+}
+
+void App::replaceSystem(std::unique_ptr<System> system) {
+  // Pending edits refer to the particles of the old system
+  applyCommands();
+
+  m_system = std::move(system);
+  m_system->getSolver().setType(m_linearSolver);
+
+  if (!m_drawable) {
+    m_drawable = std::make_unique<SnapshotDrawable>(
+        m_snapshots, m_phongShader, m_vertexShader, m_scene, m_drawableGroup);
+    m_drawable->drawVertexMarkers(m_vertexMarkersVisible);
+  }
+
+  if (auto cloth = dynamic_cast<Cloth *>(m_system.get())) {
+    cloth->setSelfCollisionSettings(m_selfCollision);
+    cloth->setSleepSettings(m_sleep);
+  }
+
+  m_collisionStatistics = {};
+  m_telemetry.clear();
+}
+
+void App::setSelfCollisionSettings(const SelfCollisionSettings &settings) {
+  m_selfCollision = settings;
+  sendCommand(SelfCollisionCommand{settings});
+}
+
+const SelfCollisionSettings &App::getSelfCollisionSettings() const {
+  return m_selfCollision;
+}
+
+const CollisionStatistics &App::getCollisionStatistics() const {
+  return m_collisionStatistics;
+}
+
+void App::setSleepSettings(const SleepSettings &settings) {
+  m_sleep = settings;
+  sendCommand(SleepCommand{settings});
+}
+
+const SleepSettings &App::getSleepSettings() const { return m_sleep; }
+
+void App::setThreadCount(const std::size_t threads) {
+  TaskPool::shared().setThreadCount(threads);
+  m_stageStatistics = {};
+}
+
+std::size_t App::getThreadCount() const {
+  return TaskPool::shared().getThreadCount();
 }
 
+void App::setDeterministic(const bool deterministic) {
+  TaskPool::shared().setDeterministic(deterministic);
+}
+
+bool App::isDeterministic() const {
+  return TaskPool::shared().isDeterministic();
+}
+
+const TaskStageStatistics &
+App::getStageStatistics(const TaskStage stage) const {
+  return m_stageStatistics[std::size_t(stage)];
+}
+
+const StepTelemetry &App::getTelemetry() const { return m_telemetry; }
+
+void App::setNBodySettings(const NBodySettings &settings) {
+  m_nbody = settings;
+  sendCommand(NBodyCommand{settings});
+}
+
+const NBodySettings &App::getNBodySettings() const { return m_nbody; }
+
 const std::unique_ptr<System> &App::getSystem() { return m_system; }
 
-void App::setStepLength(const Float stepLength) { m_stepLength = stepLength; }
+void App::setStepLength(const Float stepLength) {
+  sendCommand(StepLengthCommand{stepLength});
+}
+
+void App::setStepsPerFrame(const UnsignedInt steps) {
+  m_stepsPerFrame = steps;
+  redraw();
+}
+
+void App::setPaused(const bool paused) {
+  m_paused = paused;
+  wakeSimulation();
+}
+
+bool App::isPaused() const { return m_paused; }
+
+bool App::isAtRest() const { return m_atRest; }
 
-void App::setStepsPerFrame(const UnsignedInt steps) { m_stepsPerFrame = steps; }
+void App::stepSimulation(const UnsignedInt steps) {
+  m_pendingSteps += steps;
+  redraw();
+}
+
+void App::setRestThreshold(const Float threshold) {
+  sendCommand(RestThresholdCommand{threshold});
+}
+
+void App::setRealTime(const bool realTime) {
+  m_realTime = realTime;
+  m_simulationDebt = 0.0f;
+  m_realTimeRatio = 0.0f;
+  wakeSimulation();
+}
+
+void App::setFrameBudget(const Float milliseconds) {
+  m_frameBudget = milliseconds * 0.001f;
+  redraw();
+}
+
+Float App::getRealTimeRatio() const { return m_realTimeRatio; }
+
+Float App::getStepLength() const { return m_stepLength; }
+
+UnsignedInt App::getStepsPerFrame() const { return m_stepsPerFrame; }
+
+bool App::isRealTime() const { return m_realTime; }
+
+Float App::getFrameBudget() const { return m_frameBudget * 1000.0f; }
+
+Float App::getStepCostEstimate() const { return m_stepCostEstimate; }
 } // namespace clothsim
 
-MAGNUM_APPLICATION_MAIN(clothsim::App)
\ No newline at end of file
+#ifdef CORRADE_TARGET_EMSCRIPTEN
+MAGNUM_APPLICATION_MAIN(clothsim::App)
+#else
+int main(int argc, char **argv) {
+  if (clothsim::isBatchInvocation(argc, argv))
+    return clothsim::batchMain(argc, argv);
+  if (clothsim::isPerfInvocation(argc, argv))
+    return clothsim::perfMain(argc, argv);
+
+  clothsim::App app{{argc, argv}};
+  return app.exec();
+}
+#endif
\ No newline at end of file
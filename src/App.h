@@ -17,19 +17,78 @@
 #include <Magnum/GL/Framebuffer.h>
 #include <Magnum/GL/Renderbuffer.h>
 
+#include <array>
+#include <chrono>
+#include <exception>
 #include <memory>
+#include <string>
+#include <variant>
+#include <vector>
 
+#include "Channel.h"
 #include "Cloth.h"
+#include "Drawable.h"
 #include "Integrators.h"
+#include "NBody.h"
 #include "Oscillator.h"
 #include "Planet.h"
+#include "PointCache.h"
 #include "Shaders.h"
+#include "Solver.h"
+#include "TaskPool.h"
+#include "Telemetry.h"
+#include "TrajectoryPlayback.h"
+#include "TrajectoryRecorder.h"
 #include "UI.h"
 
 namespace clothsim {
 using Scene3D =
     Magnum::SceneGraph::Scene<Magnum::SceneGraph::MatrixTransformation3D>;
-using Integrator = std::function<void(System &, const float)>;
+
+// Edits made by the event handlers, applied by the stepping loop before its
+// next step
+struct TogglePinCommand {
+  UnsignedInt particle;
+};
+
+struct PinCommand {
+  std::vector<UnsignedInt> particles;
+};
+
+struct ResetCommand {};
+
+struct StepLengthCommand {
+  Float stepLength;
+};
+
+struct RestThresholdCommand {
+  Float threshold;
+};
+
+struct SelfCollisionCommand {
+  SelfCollisionSettings settings;
+};
+
+struct SleepCommand {
+  SleepSettings settings;
+};
+
+struct IntegratorCommand {
+  Integrator integrator;
+};
+
+struct LinearSolverCommand {
+  LinearSolverType type;
+};
+
+struct NBodyCommand {
+  NBodySettings settings;
+};
+
+using SimulationCommand =
+    std::variant<TogglePinCommand, PinCommand, ResetCommand, StepLengthCommand,
+                 RestThresholdCommand, SelfCollisionCommand, SleepCommand,
+                 IntegratorCommand, LinearSolverCommand, NBodyCommand>;
 
 class App : public Platform::Application {
 public:
@@ -37,7 +96,7 @@ public:
   virtual ~App(){};
 
   void setVertexMarkersVisibility(bool show);
-  void pinVertices(const UI::Lasso &lasso);
+  void pinVertices(const UI::Lasso &lasso, const bool includeOccluded);
 
   void zoomCamera(const Float offset);
   void handleViewportClick(const Vector2i position);
@@ -48,10 +107,79 @@ public:
   void setStepsPerFrame(const UnsignedInt steps);
   const std::unique_ptr<System> &getSystem();
 
-  void
-  setIntegrator(std::function<void(System &system, const Float dt)> integrator);
+  void setPaused(const bool paused);
+  bool isPaused() const;
+  bool isAtRest() const;
+  void stepSimulation(const UnsignedInt steps);
+  void setRestThreshold(const Float threshold);
+
+  void setRealTime(const bool realTime);
+  void setFrameBudget(const Float milliseconds);
+  Float getRealTimeRatio() const;
+  Float getStepCostEstimate() const;
+
+  void setIntegrator(const std::size_t i);
+  std::size_t getIntegrator() const;
+
+  // Of the current integrator, each implicit integrator keeps its own
+  void setNewtonPolicy(const NewtonPolicy &policy);
+  const NewtonPolicy &getNewtonPolicy() const;
+
+  void setLinearSolver(const std::size_t i);
+  std::size_t getLinearSolver() const;
 
   void setSystem(const std::size_t i);
+  std::size_t getSystemType() const;
+
+  void setClothSize(const Vector2ui size);
+  Vector2ui getClothSize() const;
+  bool loadClothMesh(const std::string &filename);
+
+  void setSelfCollisionSettings(const SelfCollisionSettings &settings);
+  const SelfCollisionSettings &getSelfCollisionSettings() const;
+  const CollisionStatistics &getCollisionStatistics() const;
+
+  void setSleepSettings(const SleepSettings &settings);
+  const SleepSettings &getSleepSettings() const;
+
+  void setNBodySettings(const NBodySettings &settings);
+  const NBodySettings &getNBodySettings() const;
+
+  // Threads of the shared task pool, zero for one per core
+  void setThreadCount(const std::size_t threads);
+  std::size_t getThreadCount() const;
+  // Parallel sums in a fixed order, see TaskPool::setDeterministic
+  void setDeterministic(const bool deterministic);
+  bool isDeterministic() const;
+  // Parallel work of the last simulated frame
+  const TaskStageStatistics &getStageStatistics(const TaskStage stage) const;
+  // Work of the last simulated steps, cleared when the system is replaced
+  const StepTelemetry &getTelemetry() const;
+
+  Float getStepLength() const;
+  UnsignedInt getStepsPerFrame() const;
+  bool isRealTime() const;
+  Float getFrameBudget() const;
+
+  // Batch outputs of the scene are ignored
+  bool loadScene(const std::string &filename);
+
+  bool saveCheckpoint(const std::string &filename);
+  bool loadCheckpoint(const std::string &filename);
+
+  bool startRecording(const std::string &filename);
+  void stopRecording();
+  bool isRecording() const;
+
+  bool startPointCacheExport(const std::string &filename,
+                             const UnsignedInt frameStride);
+  void stopPointCacheExport();
+  bool isExportingPointCache() const;
+
+  bool openPlayback(const std::string &filename);
+  void closePlayback();
+  TrajectoryPlayback *getPlayback();
+  void seekPlayback(const std::size_t frame);
 
 private:
   void viewportEvent(ViewportEvent &event) override;
@@ -69,6 +197,34 @@ private:
   void resizeTextures(const Vector2i &size);
   void resizeCamera(const Vector2i &size);
 
+  void replaceSystem(std::unique_ptr<System> system);
+
+  // The event handlers only talk to the stepping loop through the command
+  // queue and the snapshot channel, so that neither side waits for the
+  // other. Both run on this thread for now.
+  void sendCommand(SimulationCommand &&command);
+  void applyCommands();
+  void applyCommand(const TogglePinCommand &command);
+  void applyCommand(const PinCommand &command);
+  void applyCommand(const ResetCommand &command);
+  void applyCommand(const StepLengthCommand &command);
+  void applyCommand(const RestThresholdCommand &command);
+  void applyCommand(const SelfCollisionCommand &command);
+  void applyCommand(const SleepCommand &command);
+  void applyCommand(IntegratorCommand &command);
+  void applyCommand(const LinearSolverCommand &command);
+  void applyCommand(const NBodyCommand &command);
+  void publishSnapshot();
+
+  void advanceSimulation();
+  void advancePlayback();
+  // Corrupted frames are only found while seeking, the playback is closed
+  void stopPlayback(const std::exception &error);
+  UnsignedInt advanceWithinBudget();
+  void updateRestState(const Float simulatedTime);
+  bool isSimulationRunning() const;
+  void wakeSimulation();
+
   Scene3D m_scene{};
   std::unique_ptr<Object3D> m_cameraObject{};
   std::unique_ptr<Magnum::SceneGraph::Camera3D> m_camera{};
@@ -77,7 +233,20 @@ private:
   PhongIdShader m_phongShader{};
   VertexMarkerShader m_vertexShader{};
 
+  CommandQueue<SimulationCommand, 256> m_commands{};
+  SnapshotChannel<SimulationSnapshot> m_snapshots{};
+
   std::unique_ptr<System> m_system{};
+  std::unique_ptr<SnapshotDrawable> m_drawable{};
+  bool m_vertexMarkersVisible{true};
+  std::size_t m_systemType{0};
+  Vector2ui m_clothSize{2, 2};
+  SelfCollisionSettings m_selfCollision{};
+  CollisionStatistics m_collisionStatistics{};
+  std::array<TaskStageStatistics, TaskStageCount> m_stageStatistics{};
+  StepTelemetry m_telemetry{};
+  SleepSettings m_sleep{};
+  NBodySettings m_nbody{};
 
   Magnum::GL::Framebuffer m_framebuffer;
   Magnum::GL::Renderbuffer m_particleId{}, m_depth{};
@@ -88,6 +257,39 @@ private:
   Float m_stepLength{0.0f};
   UnsignedInt m_stepsPerFrame{0};
   Integrator m_integrator{forwardEulerStep};
+  std::size_t m_integratorType{0};
+  std::array<NewtonPolicy, IntegratorCount> m_newtonPolicies{};
+  LinearSolverType m_linearSolver{LinearSolverType::SparseLU};
+
+  bool m_paused{false};
+  UnsignedInt m_pendingSteps{0};
+
+  // The system is considered at rest once its mean kinetic energy per
+  // particle has stayed below the threshold for m_restDuration of simulated
+  // time
+  bool m_atRest{false};
+  Float m_restThreshold{1e-6f};
+  Float m_restDuration{0.5f};
+  Float m_timeBelowRestThreshold{0.0f};
+
+  // In real-time mode steps are taken to keep up with the wall clock for as
+  // long as the estimated cost of the next step fits into the frame budget.
+  // Time the simulation could not catch up with is dropped instead of
+  // carried over to following frames.
+  bool m_realTime{false};
+  Float m_frameBudget{0.016f};
+  Float m_stepCostEstimate{0.0f};
+  Float m_realTimeRatio{0.0f};
+  Float m_simulationDebt{0.0f};
+  std::chrono::steady_clock::time_point m_lastFrameTime{};
+
+  Double m_simulationTime{0.0};
+  std::unique_ptr<TrajectoryRecorder> m_recorder{};
+  std::unique_ptr<PointCacheWriter> m_pointCache{};
+
+  // Non-owning, points to m_system while a trajectory is played back
+  TrajectoryPlayback *m_playback{nullptr};
+  Double m_playbackTime{0.0};
 
   UI m_ui;
 };
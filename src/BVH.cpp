@@ -0,0 +1,204 @@
+#include "BVH.h"
+
+#include <Magnum/Math/Functions.h>
+
+#include "Collision.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace clothsim {
+namespace {
+constexpr UnsignedInt MaxLeafSize{4};
+
+Float boxDistanceSquared(const Vector3 &p, const Vector3 &min,
+                         const Vector3 &max) {
+  const Vector3 d{Math::max(Math::max(min - p, p - max), Vector3{0.0f})};
+  return d.dot();
+}
+} // namespace
+
+void TriangleBVH::build(Corrade::Containers::ArrayView<const Vector3> vertices,
+                        Corrade::Containers::ArrayView<const UnsignedInt> indices) {
+  m_indices.assign(indices.begin(), indices.end());
+
+  const auto triangleCount{UnsignedInt(m_indices.size() / 3)};
+  m_triangles.resize(triangleCount);
+  std::vector<Vector3> centroids(triangleCount);
+
+  for (UnsignedInt t = 0; t < triangleCount; ++t) {
+    m_triangles[t] = t;
+    centroids[t] = (vertices[m_indices[3 * t]] +
+                    vertices[m_indices[3 * t + 1]] +
+                    vertices[m_indices[3 * t + 2]]) /
+                   3.0f;
+  }
+
+  m_nodes.clear();
+  m_nodes.reserve(2 * triangleCount / MaxLeafSize + 1);
+  m_nodes.push_back(Node{Vector3{}, 0, Vector3{}, triangleCount});
+
+  if (triangleCount > 0)
+    split(0, centroids);
+
+  refit(vertices);
+}
+
+void TriangleBVH::split(const UnsignedInt node,
+                        std::vector<Vector3> &centroids) {
+  const auto first{m_nodes[node].first};
+  const auto count{m_nodes[node].count};
+
+  if (count <= MaxLeafSize)
+    return;
+
+  Vector3 min{std::numeric_limits<Float>::max()};
+  Vector3 max{std::numeric_limits<Float>::lowest()};
+  for (auto i = first; i < first + count; ++i) {
+    min = Math::min(min, centroids[m_triangles[i]]);
+    max = Math::max(max, centroids[m_triangles[i]]);
+  }
+
+  const Vector3 extent{max - min};
+  std::size_t axis{0};
+  if (extent[1] > extent[axis])
+    axis = 1;
+  if (extent[2] > extent[axis])
+    axis = 2;
+
+  // Median split keeps the depth logarithmic for any distribution
+  const auto begin{m_triangles.begin() + first};
+  const auto middle{begin + count / 2};
+  std::nth_element(begin, middle, begin + count,
+                   [&](const UnsignedInt a, const UnsignedInt b) {
+                     return centroids[a][axis] < centroids[b][axis];
+                   });
+
+  const auto left{UnsignedInt(m_nodes.size())};
+  m_nodes.push_back(Node{Vector3{}, first, Vector3{}, count / 2});
+  m_nodes.push_back(
+      Node{Vector3{}, first + count / 2, Vector3{}, count - count / 2});
+
+  m_nodes[node].first = left;
+  m_nodes[node].count = 0;
+
+  split(left, centroids);
+  split(left + 1, centroids);
+}
+
+void TriangleBVH::fitLeaf(Node &node) const {
+  node.min = Vector3{std::numeric_limits<Float>::max()};
+  node.max = Vector3{std::numeric_limits<Float>::lowest()};
+
+  for (auto i = node.first; i < node.first + node.count; ++i) {
+    for (std::size_t k = 0; k < 3; ++k) {
+      const auto &v{m_vertices[m_indices[3 * m_triangles[i] + k]]};
+      node.min = Math::min(node.min, v);
+      node.max = Math::max(node.max, v);
+    }
+  }
+
+  if (m_previousVertices.empty())
+    return;
+
+  for (auto i = node.first; i < node.first + node.count; ++i) {
+    for (std::size_t k = 0; k < 3; ++k) {
+      const auto &v{m_previousVertices[m_indices[3 * m_triangles[i] + k]]};
+      node.min = Math::min(node.min, v);
+      node.max = Math::max(node.max, v);
+    }
+  }
+}
+
+void TriangleBVH::refit(Corrade::Containers::ArrayView<const Vector3> vertices) {
+  m_vertices = vertices;
+  m_previousVertices = nullptr;
+  fitNodes();
+}
+
+void TriangleBVH::refit(
+    Corrade::Containers::ArrayView<const Vector3> previous,
+    Corrade::Containers::ArrayView<const Vector3> vertices) {
+  m_vertices = vertices;
+  m_previousVertices = previous;
+  fitNodes();
+}
+
+void TriangleBVH::fitNodes() {
+  parallelFor(
+      TaskStage::Collision, m_nodes.size(), 0, [&](const std::size_t i) {
+        if (m_nodes[i].count > 0)
+          fitLeaf(m_nodes[i]);
+      });
+
+  // Children come after their parents, so a reverse sweep is bottom-up
+  for (std::size_t i = m_nodes.size(); i-- > 0;) {
+    auto &node{m_nodes[i]};
+    if (node.count > 0)
+      continue;
+
+    const auto &left{m_nodes[node.first]};
+    const auto &right{m_nodes[node.first + 1]};
+    node.min = Math::min(left.min, right.min);
+    node.max = Math::max(left.max, right.max);
+  }
+}
+
+bool TriangleBVH::closestPoint(const Vector3 &p, const Float maxDistance,
+                               Hit &hit) const {
+  if (m_triangles.empty())
+    return false;
+
+  Float best{maxDistance * maxDistance};
+  bool found{false};
+
+  UnsignedInt stack[64];
+  std::size_t top{0};
+  stack[top++] = 0;
+
+  while (top > 0) {
+    const auto &node{m_nodes[stack[--top]]};
+
+    if (boxDistanceSquared(p, node.min, node.max) >= best)
+      continue;
+
+    if (node.count > 0) {
+      for (auto i = node.first; i < node.first + node.count; ++i) {
+        const auto t{m_triangles[i]};
+        const auto &a{m_vertices[m_indices[3 * t]]};
+        const auto &b{m_vertices[m_indices[3 * t + 1]]};
+        const auto &c{m_vertices[m_indices[3 * t + 2]]};
+        const auto w{closestPointWeights(p, a, b, c)};
+        const Vector3 q{w[0] * a + w[1] * b + w[2] * c};
+        const Float d{(p - q).dot()};
+
+        if (d < best) {
+          best = d;
+          found = true;
+          hit.triangle = t;
+          hit.point = q;
+        }
+      }
+
+      continue;
+    }
+
+    // The nearer child is pushed last to be visited first
+    const auto &left{m_nodes[node.first]};
+    const auto &right{m_nodes[node.first + 1]};
+    const bool leftFirst{boxDistanceSquared(p, left.min, left.max) <
+                         boxDistanceSquared(p, right.min, right.max)};
+
+    stack[top++] = leftFirst ? node.first + 1 : node.first;
+    stack[top++] = leftFirst ? node.first : node.first + 1;
+  }
+
+  if (found)
+    hit.distance = Math::sqrt(best);
+
+  return found;
+}
+
+std::size_t TriangleBVH::getNodeCount() const { return m_nodes.size(); }
+} // namespace clothsim
@@ -0,0 +1,93 @@
+#ifndef CLOTHSIM_BVH_H
+#define CLOTHSIM_BVH_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Bounding volume hierarchy of axis-aligned boxes over the triangles of a
+// mesh. The topology is built once, moving the vertices only refits the
+// boxes.
+class TriangleBVH {
+public:
+  struct Hit {
+    UnsignedInt triangle;
+    Vector3 point;
+    Float distance;
+  };
+
+  void build(Corrade::Containers::ArrayView<const Vector3> vertices,
+             Corrade::Containers::ArrayView<const UnsignedInt> indices);
+  void refit(Corrade::Containers::ArrayView<const Vector3> vertices);
+  // Boxes enclose the triangles at both vertex positions, so that they
+  // bound the linear motion of the triangles in between
+  void refit(Corrade::Containers::ArrayView<const Vector3> previous,
+             Corrade::Containers::ArrayView<const Vector3> vertices);
+
+  // Closest triangle to p if it is nearer than maxDistance. The vertices
+  // are the ones of the last build or refit.
+  bool closestPoint(const Vector3 &p, const Float maxDistance,
+                    Hit &hit) const;
+
+  // Calls f(triangle) for every triangle whose box overlaps the given one
+  template <typename F>
+  void overlap(const Vector3 &min, const Vector3 &max, F &&f) const {
+    if (m_triangles.empty())
+      return;
+
+    UnsignedInt stack[64];
+    std::size_t top{0};
+    stack[top++] = 0;
+
+    while (top > 0) {
+      const auto &node{m_nodes[stack[--top]]};
+
+      if (node.min.x() > max.x() || node.max.x() < min.x() ||
+          node.min.y() > max.y() || node.max.y() < min.y() ||
+          node.min.z() > max.z() || node.max.z() < min.z())
+        continue;
+
+      if (node.count > 0) {
+        for (auto i = node.first; i < node.first + node.count; ++i)
+          f(m_triangles[i]);
+
+        continue;
+      }
+
+      stack[top++] = node.first;
+      stack[top++] = node.first + 1;
+    }
+  }
+
+  std::size_t getNodeCount() const;
+
+private:
+  // Leaves have a triangle count, inner nodes have their children at
+  // first and first + 1. Children are always stored after their parent.
+  struct Node {
+    Vector3 min;
+    UnsignedInt first;
+    Vector3 max;
+    UnsignedInt count;
+  };
+
+  void split(const UnsignedInt node, std::vector<Vector3> &centroids);
+  void fitLeaf(Node &node) const;
+  void fitNodes();
+
+  Corrade::Containers::ArrayView<const Vector3> m_vertices;
+  // Empty unless the boxes are swept
+  Corrade::Containers::ArrayView<const Vector3> m_previousVertices;
+  std::vector<UnsignedInt> m_indices;
+  std::vector<UnsignedInt> m_triangles;
+  std::vector<Node> m_nodes;
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_BVH_H
@@ -0,0 +1,343 @@
+#include "Batch.h"
+
+#include <Corrade/Utility/Arguments.h>
+#include <Corrade/Utility/Debug.h>
+#include <Corrade/Utility/Directory.h>
+#include <Corrade/Utility/String.h>
+
+#include "Checkpoint.h"
+#include "Cloth.h"
+#include "Integrators.h"
+#include "NBody.h"
+#include "PointCache.h"
+#include "Scene.h"
+#include "Solver.h"
+#include "TaskPool.h"
+#include "Telemetry.h"
+#include "TrajectoryRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace clothsim {
+namespace {
+using namespace Magnum;
+
+struct JobResult {
+  std::size_t particles{0};
+  UnsignedInt frames{0};
+  Double setupSeconds{0.0};
+  Double simulationSeconds{0.0};
+  Double outputSeconds{0.0};
+  Double slowestStepSeconds{0.0};
+  Float largestResidual{0.0f};
+  CollisionStatistics collisions;
+  SolverStatistics solver;
+  NBodyStatistics nbody;
+};
+
+std::string outputPath(const std::string &path, const BatchOptions &options) {
+  if (path.empty() || options.outputDirectory.empty())
+    return path;
+
+  return Corrade::Utility::Directory::join(
+      options.outputDirectory, Corrade::Utility::Directory::filename(path));
+}
+
+JobResult runJob(const std::string &sceneFile, const BatchOptions &options) {
+  using namespace std::chrono;
+  const auto start{steady_clock::now()};
+
+  auto scene{loadScene(sceneFile)};
+  scene.pointCache = outputPath(scene.pointCache, options);
+  scene.trajectory = outputPath(scene.trajectory, options);
+  scene.checkpoint = outputPath(scene.checkpoint, options);
+  scene.telemetry = outputPath(scene.telemetry, options);
+
+  const auto system{createSystem(scene)};
+  const auto integrator{integratorByIndex(scene.integrator, scene.newton)};
+
+  std::unique_ptr<PointCacheWriter> pointCache;
+  if (!scene.pointCache.empty())
+    pointCache = std::make_unique<PointCacheWriter>(
+        scene.pointCache, system->getMeshIndices(), system->getMeshVertices(),
+        scene.exportStride);
+
+  std::unique_ptr<TrajectoryRecorder> recorder;
+  if (!scene.trajectory.empty())
+    recorder = std::make_unique<TrajectoryRecorder>(
+        scene.trajectory, system->getMeshIndices(),
+        system->getParticleCount());
+
+  // Keeps every step only if they are written out
+  StepTelemetry telemetry{scene.telemetry.empty()
+                              ? 1
+                              : std::size_t(scene.frames) *
+                                    scene.stepsPerFrame};
+
+  JobResult result;
+  result.particles = system->getParticleCount();
+
+  Double time{0.0};
+  Double outputSeconds{0.0};
+
+  const auto recordFrame = [&] {
+    const auto pre{steady_clock::now()};
+
+    if (pointCache)
+      pointCache->record(time, system->getMeshVertices());
+    if (recorder)
+      recorder->record(time, system->getMeshVertices());
+
+    outputSeconds += duration<Double>(steady_clock::now() - pre).count();
+  };
+
+  const auto simulationStart{steady_clock::now()};
+  result.setupSeconds = duration<Double>(simulationStart - start).count();
+
+  recordFrame();
+
+  for (UnsignedInt frame = 0; frame < scene.frames; ++frame) {
+    for (UnsignedInt step = 0; step < scene.stepsPerFrame; ++step) {
+      const auto &record{telemetry.step(integrator, *system, scene.stepLength)};
+      result.slowestStepSeconds =
+          Math::max(result.slowestStepSeconds, record.seconds);
+      result.largestResidual =
+          Math::max(result.largestResidual, record.finalResidual);
+    }
+
+    time += static_cast<Double>(scene.stepsPerFrame) * scene.stepLength;
+    recordFrame();
+  }
+
+  const auto simulationEnd{steady_clock::now()};
+
+  if (const auto cloth = dynamic_cast<const Cloth *>(system.get()))
+    result.collisions = cloth->getCollisionStatistics();
+  if (const auto nbody = dynamic_cast<const NBody *>(system.get()))
+    result.nbody = nbody->getStatistics();
+  result.solver = system->getSolver().getStatistics();
+
+  if (pointCache)
+    pointCache->finish();
+  if (recorder)
+    recorder->finish();
+  if (!scene.telemetry.empty())
+    writeTelemetry(scene.telemetry, telemetry);
+
+  if (!scene.checkpoint.empty()) {
+    const auto cloth{dynamic_cast<const Cloth *>(system.get())};
+    if (cloth && !cloth->isGrid())
+      throw std::runtime_error("Checkpoints of mesh cloths are not supported");
+
+    CheckpointSettings settings;
+    settings.systemType = static_cast<UnsignedInt>(scene.systemType);
+    settings.size = scene.clothSize;
+    settings.integrator = static_cast<UnsignedInt>(scene.integrator);
+    settings.stepsPerFrame = scene.stepsPerFrame;
+    settings.stepLength = scene.stepLength;
+    settings.extent = scene.clothExtent;
+    settings.stiffness = scene.stiffness;
+    settings.drag = scene.drag;
+    settings.particleMass = system->getParticleMass();
+    settings.nbody = scene.nbody;
+    saveCheckpoint(scene.checkpoint, settings, *system);
+  }
+
+  result.frames = scene.frames;
+  result.simulationSeconds =
+      duration<Double>(simulationEnd - simulationStart).count() -
+      outputSeconds;
+  result.outputSeconds =
+      outputSeconds +
+      duration<Double>(steady_clock::now() - simulationEnd).count();
+
+  return result;
+}
+} // namespace
+
+std::size_t runBatch(const std::vector<std::string> &sceneFiles,
+                     const BatchOptions &options) {
+  const std::size_t threads{std::max<std::size_t>(
+      1, std::min<std::size_t>(options.threads
+                                   ? options.threads
+                                   : std::thread::hardware_concurrency(),
+                               sceneFiles.size()))};
+
+  // The jobs share the pool, so that the cores are not oversubscribed
+  auto &pool{TaskPool::shared()};
+  pool.setThreadCount(
+      options.poolThreads
+          ? options.poolThreads
+          : Math::max<std::size_t>(1, std::thread::hardware_concurrency() /
+                                          threads));
+  pool.setDeterministic(options.deterministic);
+  pool.resetStageStatistics();
+
+  std::atomic<std::size_t> next{0};
+  std::atomic<std::size_t> failed{0};
+  std::mutex logMutex;
+
+  const auto worker = [&] {
+    for (auto i = next++; i < sceneFiles.size(); i = next++) {
+      const auto &sceneFile{sceneFiles[i]};
+
+      try {
+        const auto result{runJob(sceneFile, options)};
+
+        std::lock_guard<std::mutex> lock{logMutex};
+        Debug{} << sceneFile << Debug::nospace << ":" << result.particles
+                << "particles," << result.frames << "frames, setup"
+                << result.setupSeconds << "s, simulation"
+                << result.simulationSeconds << "s, output"
+                << result.outputSeconds << "s, slowest step"
+                << result.slowestStepSeconds << "s";
+
+        if (const auto &s{result.solver}; s.solves > 0)
+          Debug{} << sceneFile << Debug::nospace << ":" << s.solves
+                  << "linear solves in" << s.solveSeconds << "s, setup"
+                  << s.setupSeconds << "s," << s.iterations << "iterations,"
+                  << s.fallbacks << "fallbacks taking" << s.fallbackSeconds
+                  << "s," << s.factorizations << "factorizations in"
+                  << s.factorSeconds << "s, each"
+                  << s.factorSeconds /
+                         Double(Math::max<std::size_t>(s.factorizations, 1))
+                  << "s with"
+                  << s.factorNonZeros /
+                         Math::max<std::size_t>(s.factorizations, 1)
+                  << "nonzeros";
+
+        if (const auto &s{result.solver}; s.steps > 0)
+          Debug{} << sceneFile << Debug::nospace << ":"
+                  << Double(s.newtonIterations) / Double(s.steps)
+                  << "Newton iterations," << s.backtracks << "backtracks,"
+                  << Double(s.jacobianUpdates) / Double(s.steps)
+                  << "Jacobians per step, largest final residual"
+                  << result.largestResidual;
+
+        if (const auto &b{result.nbody}; b.evaluations > 0)
+          Debug{} << sceneFile << Debug::nospace << ":" << b.evaluations
+                  << "gravity evaluations, tree" << b.buildSeconds
+                  << "s, forces" << b.forceSeconds << "s," << b.nodes
+                  << "nodes";
+
+        if (const auto &c{result.collisions}; c.steps > 0)
+          Debug{} << sceneFile << Debug::nospace
+                  << ": self collision broad phase" << c.broadPhaseSeconds
+                  << "s, narrow phase" << c.narrowPhaseSeconds
+                  << "s, response" << c.responseSeconds << "s,"
+                  << c.contacts << "contacts, continuous"
+                  << c.continuousSeconds << "s," << c.impacts << "impacts";
+      } catch (const std::exception &e) {
+        ++failed;
+
+        std::lock_guard<std::mutex> lock{logMutex};
+        Error{} << sceneFile << Debug::nospace << ":" << e.what();
+      }
+    }
+  };
+
+  const auto start{std::chrono::steady_clock::now()};
+
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < threads; ++i)
+    workers.emplace_back(worker);
+
+  worker();
+
+  for (auto &thread : workers)
+    thread.join();
+
+  Debug{} << "Ran" << sceneFiles.size() << "jobs on" << threads
+          << "threads in"
+          << std::chrono::duration<Double>(std::chrono::steady_clock::now() -
+                                           start)
+                 .count()
+          << "s," << failed.load() << "failed";
+
+  for (std::size_t s = 0; s < TaskStageCount; ++s) {
+    const auto stats{pool.getStageStatistics(TaskStage(s))};
+    if (stats.calls == 0)
+      continue;
+
+    Debug{} << taskStageName(TaskStage(s)) << Debug::nospace << ":"
+            << stats.calls << "parallel calls," << stats.tasks
+            << "tasks in" << stats.wallSeconds << "s, busy"
+            << stats.busySeconds << "s, efficiency" << stats.efficiency()
+            << "on" << pool.getThreadCount() << "threads";
+  }
+
+  return failed;
+}
+
+std::vector<std::string> readJobList(const std::string &filename) {
+  std::ifstream file{filename};
+  if (!file)
+    throw std::runtime_error("Cannot read job list " + filename);
+
+  const auto directory{Corrade::Utility::Directory::path(filename)};
+  std::vector<std::string> sceneFiles;
+
+  for (std::string line; std::getline(file, line);) {
+    line = Corrade::Utility::String::trim(line);
+
+    if (line.empty() || line.front() == '#')
+      continue;
+
+    sceneFiles.push_back(Corrade::Utility::Directory::join(directory, line));
+  }
+
+  return sceneFiles;
+}
+
+bool isBatchInvocation(const int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--batch") == 0)
+      return true;
+  }
+
+  return false;
+}
+
+int batchMain(const int argc, char **argv) {
+  Corrade::Utility::Arguments args;
+  args.addOption("batch")
+      .setHelp("batch", "list of scene files to simulate without the UI",
+               "FILE")
+      .addOption("jobs", "0")
+      .setHelp("jobs", "number of scenes simulated at a time, 0 for one per "
+                       "core",
+               "N")
+      .addOption("threads", "0")
+      .setHelp("threads",
+               "threads of the simulation shared by the jobs, 0 to divide "
+               "the cores among them",
+               "N")
+      .addBooleanOption("deterministic")
+      .setHelp("deterministic",
+               "bitwise identical results for any thread count")
+      .addOption("output-dir")
+      .setHelp("output-dir", "directory for all outputs of the batch", "DIR")
+      .parse(argc, argv);
+
+  BatchOptions options;
+  options.threads = args.value<std::size_t>("jobs");
+  options.poolThreads = args.value<std::size_t>("threads");
+  options.deterministic = args.isSet("deterministic");
+  options.outputDirectory = args.value("output-dir");
+
+  try {
+    const auto failed{runBatch(readJobList(args.value("batch")), options)};
+    return failed == 0 ? 0 : 1;
+  } catch (const std::exception &e) {
+    Error{} << e.what();
+    return 1;
+  }
+}
+} // namespace clothsim
@@ -0,0 +1,34 @@
+#ifndef CLOTHSIM_BATCH_H
+#define CLOTHSIM_BATCH_H
+
+#include <string>
+#include <vector>
+
+namespace clothsim {
+struct BatchOptions {
+  // Worker threads, 0 for one per core
+  std::size_t threads{0};
+  // Threads of the task pool shared by the jobs, 0 to divide the cores
+  // among them
+  std::size_t poolThreads{0};
+  // Parallel sums in a fixed order, see TaskPool::setDeterministic
+  bool deterministic{false};
+  // Replaces the directory of relative output paths if not empty
+  std::string outputDirectory;
+};
+
+// Simulates every scene without the UI, several at a time, writing the
+// outputs configured in the scene. Returns the number of failed jobs.
+std::size_t runBatch(const std::vector<std::string> &sceneFiles,
+                     const BatchOptions &options);
+
+// Reads scene file names, one per line, relative to the list. Empty lines
+// and lines starting with # are skipped.
+std::vector<std::string> readJobList(const std::string &filename);
+
+// Entry point for --batch on the command line
+bool isBatchInvocation(const int argc, char **argv);
+int batchMain(const int argc, char **argv);
+} // namespace clothsim
+
+#endif // CLOTHSIM_BATCH_H
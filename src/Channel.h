@@ -0,0 +1,91 @@
+#ifndef CLOTHSIM_CHANNEL_H
+#define CLOTHSIM_CHANNEL_H
+
+#include <Magnum/Magnum.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Lock-free ring buffer from one producer thread to one consumer thread.
+// Each side only writes its own index, so pushing and popping never wait
+// for the other side.
+template <typename T, std::size_t Capacity> class CommandQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+public:
+  // Producer only. Fails instead of waiting when the queue is full and
+  // leaves the value untouched then.
+  bool push(T &&value) {
+    const auto tail{m_tail.load(std::memory_order_relaxed)};
+    if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+      return false;
+
+    m_slots[tail & (Capacity - 1)] = std::move(value);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only
+  bool pop(T &value) {
+    const auto head{m_head.load(std::memory_order_relaxed)};
+    if (head == m_tail.load(std::memory_order_acquire))
+      return false;
+
+    value = std::move(m_slots[head & (Capacity - 1)]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::array<T, Capacity> m_slots{};
+  // Apart, so that the two sides do not share a cache line
+  alignas(64) std::atomic<std::size_t> m_head{0};
+  alignas(64) std::atomic<std::size_t> m_tail{0};
+};
+
+// Wait-free triple buffer carrying the latest value from one writer thread
+// to one reader thread. The writer fills its back buffer and swaps it with
+// the middle one, the reader swaps its front buffer with the middle one if
+// that holds a newer value. Values the reader missed are skipped.
+template <typename T> class SnapshotChannel {
+public:
+  // Writer only. The buffer still holds an older value, which the writer
+  // overwrites.
+  T &writeBuffer() { return m_buffers[m_back]; }
+
+  void publish() {
+    m_back = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel) &
+             IndexMask;
+  }
+
+  // Reader only. Switches to the latest published value, returns false if
+  // there is none since the last update.
+  bool update() {
+    if (!(m_middle.load(std::memory_order_relaxed) & Fresh))
+      return false;
+
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+    return true;
+  }
+
+  // Reader only, valid until the next update
+  const T &read() const { return m_buffers[m_front]; }
+
+private:
+  static constexpr UnsignedInt IndexMask{3};
+  static constexpr UnsignedInt Fresh{4};
+
+  std::array<T, 3> m_buffers{};
+  alignas(64) UnsignedInt m_front{0};
+  alignas(64) UnsignedInt m_back{1};
+  alignas(64) std::atomic<UnsignedInt> m_middle{2};
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_CHANNEL_H
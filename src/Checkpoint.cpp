@@ -0,0 +1,207 @@
+#include "Checkpoint.h"
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace clothsim {
+namespace {
+constexpr char CheckpointMagic[8]{'C', 'L', 'O', 'T', 'H', 'C', 'K', 'P'};
+constexpr UnsignedInt CheckpointVersion{2};
+
+// Payload offsets are multiples of the alignment so that the mapped data can
+// be viewed without copying
+constexpr std::size_t PayloadAlignment{16};
+
+struct CheckpointHeader {
+  char magic[8];
+  UnsignedInt version;
+  UnsignedInt scalarSize;
+
+  UnsignedInt systemType;
+  UnsignedInt size[2];
+  UnsignedInt integrator;
+  UnsignedInt stepsPerFrame;
+  Float stepLength;
+  Float frameBudget;
+  UnsignedInt realTime;
+
+  UnsignedLong stateOffset;
+  UnsignedLong stateSize;
+  UnsignedLong pinnedOffset;
+  UnsignedLong pinnedCount;
+
+  // Added in version 2, the header of version 1 ends here
+  Float extent[2];
+  Float stiffness;
+  Float drag;
+  Float particleMass;
+  UnsignedInt nbodyBodies;
+  Float nbodyTotalMass;
+  Float nbodyRadius;
+  Float nbodyOpeningAngle;
+  Float nbodySoftening;
+  UnsignedInt nbodyMethod;
+};
+
+constexpr std::size_t HeaderSizeVersion1{80};
+
+static_assert(sizeof(CheckpointHeader) == 128,
+              "Unexpected padding in the checkpoint header");
+
+std::size_t alignedOffset(const std::size_t offset) {
+  return (offset + PayloadAlignment - 1) / PayloadAlignment *
+         PayloadAlignment;
+}
+} // namespace
+
+void saveCheckpoint(const std::string &filename,
+                    const CheckpointSettings &settings, const System &system) {
+  const auto &state{system.getState()};
+  const auto &pinnedIds{system.getPinnedParticleIds()};
+  const std::vector<UnsignedInt> pinned(pinnedIds.begin(), pinnedIds.end());
+
+  CheckpointHeader header{};
+  std::memcpy(header.magic, CheckpointMagic, sizeof(CheckpointMagic));
+  header.version = CheckpointVersion;
+  header.scalarSize = sizeof(System::ScalarT);
+  header.systemType = settings.systemType;
+  header.size[0] = settings.size.x();
+  header.size[1] = settings.size.y();
+  header.integrator = settings.integrator;
+  header.stepsPerFrame = settings.stepsPerFrame;
+  header.stepLength = settings.stepLength;
+  header.frameBudget = settings.frameBudget;
+  header.realTime = settings.realTime;
+  header.extent[0] = settings.extent.x();
+  header.extent[1] = settings.extent.y();
+  header.stiffness = settings.stiffness;
+  header.drag = settings.drag;
+  header.particleMass = settings.particleMass;
+  header.nbodyBodies = settings.nbody.bodies;
+  header.nbodyTotalMass = settings.nbody.totalMass;
+  header.nbodyRadius = settings.nbody.radius;
+  header.nbodyOpeningAngle = settings.nbody.openingAngle;
+  header.nbodySoftening = settings.nbody.softening;
+  header.nbodyMethod = static_cast<UnsignedInt>(settings.nbody.method);
+  header.stateOffset = alignedOffset(sizeof(CheckpointHeader));
+  header.stateSize = static_cast<UnsignedLong>(state.size());
+  header.pinnedOffset = alignedOffset(
+      header.stateOffset + header.stateSize * sizeof(System::ScalarT));
+  header.pinnedCount = pinned.size();
+
+  std::ofstream file{filename, std::ios::binary | std::ios::trunc};
+  if (!file)
+    throw std::runtime_error("Cannot open " + filename + " for writing");
+
+  const char padding[PayloadAlignment]{};
+  const auto pad = [&](const std::size_t offset) {
+    file.write(padding, static_cast<std::streamsize>(
+                            offset - static_cast<std::size_t>(file.tellp())));
+  };
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  pad(header.stateOffset);
+  file.write(reinterpret_cast<const char *>(state.data()),
+             static_cast<std::streamsize>(header.stateSize *
+                                          sizeof(System::ScalarT)));
+  pad(header.pinnedOffset);
+  file.write(reinterpret_cast<const char *>(pinned.data()),
+             static_cast<std::streamsize>(pinned.size() *
+                                          sizeof(UnsignedInt)));
+
+  if (!file)
+    throw std::runtime_error("Writing " + filename + " failed");
+}
+
+Checkpoint::Checkpoint(const std::string &filename)
+    : m_data{Corrade::Utility::Directory::mapRead(filename)} {
+  if (!m_data)
+    throw std::runtime_error("Cannot map " + filename);
+
+  if (m_data.size() < HeaderSizeVersion1)
+    throw std::runtime_error(filename + " is not a checkpoint");
+
+  CheckpointHeader header{};
+  std::memcpy(&header, m_data.data(), HeaderSizeVersion1);
+
+  if (std::memcmp(header.magic, CheckpointMagic, sizeof(CheckpointMagic)) !=
+      0)
+    throw std::runtime_error(filename + " is not a checkpoint");
+
+  if (header.version == 0 || header.version > CheckpointVersion)
+    throw std::runtime_error("Unsupported checkpoint version " +
+                             std::to_string(header.version));
+
+  if (header.version >= 2) {
+    if (m_data.size() < sizeof(CheckpointHeader))
+      throw std::runtime_error(filename + " is truncated");
+
+    std::memcpy(&header, m_data.data(), sizeof(header));
+  }
+
+  if (header.scalarSize != sizeof(System::ScalarT))
+    throw std::runtime_error("Checkpoint scalar type does not match");
+
+  // Compared without overflowing for any header
+  const auto size{m_data.size()};
+  if (header.stateOffset % PayloadAlignment != 0 ||
+      header.pinnedOffset % PayloadAlignment != 0 ||
+      header.stateOffset > size ||
+      header.stateSize >
+          (size - header.stateOffset) / sizeof(System::ScalarT) ||
+      header.pinnedOffset > size ||
+      header.pinnedCount > (size - header.pinnedOffset) / sizeof(UnsignedInt))
+    throw std::runtime_error(filename + " is truncated");
+
+  m_settings.systemType = header.systemType;
+  m_settings.size = Vector2ui{header.size[0], header.size[1]};
+  m_settings.integrator = header.integrator;
+  m_settings.stepsPerFrame = header.stepsPerFrame;
+  m_settings.stepLength = header.stepLength;
+  m_settings.frameBudget = header.frameBudget;
+  m_settings.realTime = header.realTime != 0;
+
+  if (header.version >= 2) {
+    m_settings.extent = Vector2{header.extent[0], header.extent[1]};
+    m_settings.stiffness = header.stiffness;
+    m_settings.drag = header.drag;
+    m_settings.particleMass = header.particleMass;
+
+    if (header.nbodyMethod > UnsignedInt(GravityMethod::Direct))
+      throw std::runtime_error("Unknown gravity method in " + filename);
+
+    m_settings.nbody.bodies = header.nbodyBodies;
+    m_settings.nbody.totalMass = header.nbodyTotalMass;
+    m_settings.nbody.radius = header.nbodyRadius;
+    m_settings.nbody.openingAngle = header.nbodyOpeningAngle;
+    m_settings.nbody.softening = header.nbodySoftening;
+    m_settings.nbody.method = GravityMethod(header.nbodyMethod);
+  }
+
+  m_state = {reinterpret_cast<const System::ScalarT *>(m_data.data() +
+                                                       header.stateOffset),
+             header.stateSize};
+  m_pinnedParticleIds = {
+      reinterpret_cast<const UnsignedInt *>(m_data.data() +
+                                            header.pinnedOffset),
+      header.pinnedCount};
+}
+
+const CheckpointSettings &Checkpoint::getSettings() const {
+  return m_settings;
+}
+
+Corrade::Containers::ArrayView<const System::ScalarT>
+Checkpoint::getState() const {
+  return m_state;
+}
+
+Corrade::Containers::ArrayView<const UnsignedInt>
+Checkpoint::getPinnedParticleIds() const {
+  return m_pinnedParticleIds;
+}
+} // namespace clothsim
@@ -0,0 +1,65 @@
+#ifndef CLOTHSIM_CHECKPOINT_H
+#define CLOTHSIM_CHECKPOINT_H
+
+#include <Corrade/Containers/Array.h>
+#include <Corrade/Containers/ArrayView.h>
+#include <Corrade/Utility/Directory.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector2.h>
+
+#include "NBody.h"
+#include "System.h"
+
+#include <string>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Everything besides the state needed to continue a simulation
+struct CheckpointSettings {
+  UnsignedInt systemType{0};
+  Vector2ui size{};
+  UnsignedInt integrator{0};
+  UnsignedInt stepsPerFrame{1};
+  Float stepLength{0.0f};
+  Float frameBudget{0.0f};
+  bool realTime{false};
+
+  // Physical parameters of the cloth and the n-body system, checkpoints of
+  // version 1 have the defaults
+  Vector2 extent{1.5f, 1.5f};
+  Float stiffness{300.0f};
+  Float drag{0.08f};
+  Float particleMass{0.025f};
+  NBodySettings nbody;
+};
+
+// Writes the settings, the state and the pinned particles of the system
+// into a versioned binary snapshot. The state is written as is, so the file
+// is only portable between machines of the same endianness.
+void saveCheckpoint(const std::string &filename,
+                    const CheckpointSettings &settings, const System &system);
+
+// Memory-mapped checkpoint. The state and the pinned particle views point
+// directly into the mapping and are valid for the lifetime of the object.
+class Checkpoint {
+public:
+  explicit Checkpoint(const std::string &filename);
+
+  const CheckpointSettings &getSettings() const;
+  Corrade::Containers::ArrayView<const System::ScalarT> getState() const;
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getPinnedParticleIds() const;
+
+private:
+  Corrade::Containers::Array<const char,
+                             Corrade::Utility::Directory::MapDeleter>
+      m_data;
+  CheckpointSettings m_settings;
+  Corrade::Containers::ArrayView<const System::ScalarT> m_state;
+  Corrade::Containers::ArrayView<const UnsignedInt> m_pinnedParticleIds;
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_CHECKPOINT_H
@@ -1,14 +1,20 @@
 #include "Cloth.h"
+#include "TaskPool.h"
+#include "TriangleMesh.h"
 
 #include <Corrade/Containers/Array.h>
 
 #include <Corrade/Containers/Tags.h>
 #include <Magnum/EigenIntegration/Integration.h>
 
+#include <Corrade/Utility/Debug.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-#include <cstring>
 #include <iostream>
 #include <numeric>
+#include <stdexcept>
 
 namespace clothsim {
 System::Vector3 Spring::force(const System::Vector3 pos1,
@@ -28,21 +34,236 @@ static inline System::Vector3 fDrag(const System::Vector3 v,
   return System::Vector3{-k * v};
 }
 
-Cloth::Cloth(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-             Object3D &parent,
-             Magnum::SceneGraph::DrawableGroup3D &drawableGroup)
-    : System(phongShader, vertexShader, parent, drawableGroup), m_size{{2, 2}} {
+// Marks the springs a particle is the left end of in m_particleSprings
+static constexpr UnsignedInt LeftEnd{1u << 31};
+
+// Grid tiles are SleepTileSize particles wide, mesh tiles hold the square of
+// it in the order of the vertices
+static constexpr UnsignedInt SleepTileSize{8};
+
+Cloth::Cloth() : m_size{{2, 2}} {
   reset();
 }
 
 Cloth::~Cloth() {}
 
 void Cloth::reset() {
+  Vector state;
+
+  if (isGrid())
+    resetGrid(state);
+  else
+    resetMesh(state);
+
+  setState(std::move(state));
+  clearPinnedParticles();
+
+  std::vector<std::pair<UnsignedInt, UnsignedInt>> connected;
+  connected.reserve(m_springs.size());
+  for (const auto &spring : m_springs)
+    connected.emplace_back(spring.leftIdx, spring.rightIdx);
+
+  m_selfCollision.setTopology(m_triangleIndices, connected, m_particleCount);
+  m_colliders.setTime(0.0);
+
+  setupParticleSprings();
+
+  if (isGrid()) {
+    setPinnedParticle(0, true);
+    setPinnedParticle(m_size.x() - 1, true);
+  }
+
+  setupSleepTiles();
+}
+
+void Cloth::setupParticleSprings() {
+  m_springOffsets.assign(m_particleCount + 1, 0);
+  for (const auto &spring : m_springs) {
+    ++m_springOffsets[spring.leftIdx + 1];
+    ++m_springOffsets[spring.rightIdx + 1];
+  }
+  std::partial_sum(m_springOffsets.begin(), m_springOffsets.end(),
+                   m_springOffsets.begin());
+
+  m_particleSprings.resize(m_springOffsets.back());
+  std::vector<UnsignedInt> cursor(m_springOffsets.begin(),
+                                  m_springOffsets.end() - 1);
+  for (UnsignedInt i = 0; i < m_springs.size(); ++i) {
+    const auto &spring{m_springs[i]};
+    m_particleSprings[cursor[spring.leftIdx]++] = i | LeftEnd;
+    m_particleSprings[cursor[spring.rightIdx]++] = i;
+  }
+
+  m_springForces.resize(m_springs.size());
+}
+
+void Cloth::setupSleepTiles() {
+  const auto n{m_particleCount};
+  UnsignedInt tileCount;
+  m_particleTiles.resize(n);
+
+  if (isGrid()) {
+    const auto tilesX{(m_size.x() + SleepTileSize - 1) / SleepTileSize};
+    const auto tilesY{(m_size.y() + SleepTileSize - 1) / SleepTileSize};
+    tileCount = tilesX * tilesY;
+
+    for (UnsignedInt y = 0; y < m_size.y(); ++y) {
+      for (UnsignedInt x = 0; x < m_size.x(); ++x) {
+        m_particleTiles[toCoord(x, y)] =
+            (y / SleepTileSize) * tilesX + x / SleepTileSize;
+      }
+    }
+  } else {
+    const auto tileParticles{SleepTileSize * SleepTileSize};
+    tileCount = (n + tileParticles - 1) / tileParticles;
+
+    for (UnsignedInt i = 0; i < n; ++i)
+      m_particleTiles[i] = i / tileParticles;
+  }
+
+  m_tileOffsets.assign(tileCount + 1, 0);
+  for (const auto tile : m_particleTiles)
+    ++m_tileOffsets[tile + 1];
+  std::partial_sum(m_tileOffsets.begin(), m_tileOffsets.end(),
+                   m_tileOffsets.begin());
+
+  m_tileParticles.resize(n);
+  std::vector<UnsignedInt> cursor(m_tileOffsets.begin(),
+                                  m_tileOffsets.end() - 1);
+  for (UnsignedInt i = 0; i < n; ++i)
+    m_tileParticles[cursor[m_particleTiles[i]]++] = i;
+
+  m_tileSprings.clear();
+  for (UnsignedInt i = 0; i < m_springs.size(); ++i) {
+    const auto &spring{m_springs[i]};
+    if (m_particleTiles[spring.leftIdx] != m_particleTiles[spring.rightIdx])
+      m_tileSprings.push_back(i);
+  }
+
+  m_tiles.assign(tileCount, SleepTile{});
+  m_sleepPinned = getPinnedParticleIds();
+  updateAwakeParticles();
+}
+
+void Cloth::updateAwakeParticles() {
+  const auto n{m_particleCount};
+
+  m_asleep.assign(n, 0);
+  for (std::size_t tile = 0; tile < m_tiles.size(); ++tile) {
+    if (!m_tiles[tile].asleep)
+      continue;
+
+    for (auto i = m_tileOffsets[tile]; i < m_tileOffsets[tile + 1]; ++i)
+      m_asleep[m_tileParticles[i]] = 1;
+  }
+
+  m_sleepingParticles.clear();
+  m_awakeParticles.clear();
+  for (UnsignedInt i = 0; i < n; ++i)
+    (m_asleep[i] ? m_sleepingParticles : m_awakeParticles).push_back(i);
+
+  m_awakeSprings.clear();
+  for (UnsignedInt i = 0; i < m_springs.size(); ++i) {
+    const auto &spring{m_springs[i]};
+    if (!m_asleep[spring.leftIdx] || !m_asleep[spring.rightIdx])
+      m_awakeSprings.push_back(i);
+  }
+
+  // Sleeping particles have zero derivatives
+  invalidateDerivativeCache();
+}
+
+void Cloth::updateSleeping(const Vector &previous, Vector &next,
+                           const ScalarT dt) {
+  const auto tileCount{m_tiles.size()};
+  bool changed{false};
+
+  const auto wake{[&](const UnsignedInt tile) {
+    if (m_tiles[tile].asleep) {
+      m_tiles[tile] = SleepTile{};
+      changed = true;
+    }
+  }};
+
+  if (m_sleepPinned != getPinnedParticleIds()) {
+    m_sleepPinned = getPinnedParticleIds();
+    for (std::size_t tile = 0; tile < tileCount; ++tile)
+      wake(UnsignedInt(tile));
+  }
+
+  // Sleeping particles only move when a contact pushes them. A collider
+  // moving away pushes nothing, so tiles in its path wake up as well.
+  const auto &swept{m_colliders.getSweptBounds()};
+  const auto positions{getParticlePositions(next)};
+  const auto inPath{[&](const UnsignedInt i) {
+    return std::any_of(swept.begin(), swept.end(), [&](const auto &box) {
+      return (positions[i] >= box.min).all() &&
+             (positions[i] <= box.max).all();
+    });
+  }};
+
+  for (const auto i : m_sleepingParticles) {
+    if (xFromCoord(next, i) != xFromCoord(previous, i) ||
+        !dxFromCoord(next, i).isZero() || inPath(i))
+      wake(m_particleTiles[i]);
+  }
+
+  const ScalarT maxVelocity2{m_sleep.velocity * m_sleep.velocity};
+  const ScalarT maxDv{m_sleep.acceleration * dt};
+  const ScalarT maxDv2{maxDv * maxDv};
+
+  for (const auto i : m_tileSprings) {
+    const auto &spring{m_springs[i]};
+    const auto left{spring.leftIdx};
+    const auto right{spring.rightIdx};
+
+    if (m_asleep[left] == m_asleep[right])
+      continue;
+
+    const auto awake{m_asleep[left] ? right : left};
+    const auto asleep{m_asleep[left] ? left : right};
+    if (dxFromCoord(next, awake).squaredNorm() > maxVelocity2)
+      wake(m_particleTiles[asleep]);
+  }
+
+  std::atomic<bool> fellAsleep{false};
+
+  parallelFor(TaskStage::Other, tileCount, 0, [&](const std::size_t t) {
+    auto &tile{m_tiles[t]};
+    if (tile.asleep)
+      return;
+
+    bool calm{true};
+    for (auto i = m_tileOffsets[t]; calm && i < m_tileOffsets[t + 1]; ++i) {
+      const auto particle{m_tileParticles[i]};
+      const Vector3 v{dxFromCoord(next, particle)};
+      const Vector3 dv{v - dxFromCoord(previous, particle)};
+      calm = v.squaredNorm() <= maxVelocity2 && dv.squaredNorm() <= maxDv2;
+    }
+
+    tile.calmSteps = calm ? tile.calmSteps + 1 : 0;
+
+    if (tile.calmSteps >= m_sleep.steps) {
+      tile.asleep = true;
+      fellAsleep = true;
+
+      for (auto i = m_tileOffsets[t]; i < m_tileOffsets[t + 1]; ++i)
+        dxFromCoord(next, m_tileParticles[i]) = Vector3::Zero();
+    }
+  });
+
+  if (changed || fellAsleep)
+    updateAwakeParticles();
+}
+
+void Cloth::resetGrid(Vector &state) {
   if (m_size.x() == 0 || m_size.y() == 0)
     throw std::runtime_error("Invalid cloth size");
 
-  constexpr ScalarT width{1.5f};
-  constexpr ScalarT height{1.5f};
+  m_particleCount = m_size.x() * m_size.y();
+
+  const ScalarT width{m_extent.x()};
+  const ScalarT height{m_extent.y()};
   const Vector3 yStep{0.0, -height / m_size.y(), 0.0};
   const Vector3 xStep{width / m_size.x(), 0.0, 0.0};
   const ScalarT restLengthX{xStep.norm()};
@@ -53,8 +274,7 @@ void Cloth::reset() {
   const ScalarT restLength2Y{2.0f * yStep.norm()};
   const Vector3 offset{-width * 0.5f, 0.0f, 1.0f};
 
-  Vector state{2 * m_size.x() * m_size.y() * 3};
-  state.setZero();
+  state = Vector::Zero(2 * m_particleCount * 3);
 
   m_springs.clear();
 
@@ -128,60 +348,228 @@ void Cloth::reset() {
           triRow * m_size.x() + triCol + m_size.x();
     }
   }
+}
 
-  setState(std::move(state));
-  clearPinnedParticles();
+void Cloth::resetMesh(Vector &state) {
+  m_particleCount = static_cast<UnsignedInt>(m_meshPositions.size() / 3);
 
-  setPinnedParticle(0, true);
-  setPinnedParticle(m_size.x() - 1, true);
+  state = Vector::Zero(2 * m_particleCount * 3);
+  state.head(m_particleCount * 3) = m_meshPositions;
+
+  m_springs = m_meshSprings;
 }
 
-System::SparseMatrix Cloth::evalJacobian(const Vector &state) const {
-  const auto n{m_size.x() * m_size.y()};
+void Cloth::loadMesh(const std::string &filename) {
+  const auto mesh{loadTriangleMesh(filename)};
+  const auto edges{findMeshEdges(
+      Corrade::Containers::arrayView(mesh.indices.data(), mesh.indices.size()),
+      mesh.positions.size())};
 
-  SparseMatrixRM j(n * 3 * 2, n * 3 * 2);
+  Vector positions(static_cast<Eigen::Index>(mesh.positions.size() * 3));
+  for (std::size_t i = 0; i < mesh.positions.size(); ++i) {
+    const auto &p{mesh.positions[i]};
+    positions.segment(i * 3, 3) = Vector3{p.x(), p.y(), p.z()};
+  }
 
-  using T = Eigen::Triplet<ScalarT>;
-  std::vector<T> triplets;
-  triplets.reserve(n * 3 * 2 + 6 * m_size.x() * m_size.y());
+  const auto structural{edges.edges.size()};
+  std::vector<Spring> springs(structural + edges.bendPairs.size());
+
+  parallelFor(TaskStage::Other, springs.size(), 0, [&](const std::size_t i) {
+    const auto &pair{i < structural ? edges.edges[i]
+                                    : edges.bendPairs[i - structural]};
+    const ScalarT restLength{(positions.segment(pair.first * 3, 3) -
+                              positions.segment(pair.second * 3, 3))
+                                 .norm()};
+    springs[i] = Spring{pair.first, pair.second, m_k, restLength};
+  });
+
+  // Coincident vertices have no spring direction
+  springs.erase(std::remove_if(springs.begin(), springs.end(),
+                               [](const Spring &s) {
+                                 return !(s.restLength > 0.0f);
+                               }),
+                springs.end());
+
+  Corrade::Containers::Array<UnsignedInt> indices{
+      Corrade::Containers::NoInit, mesh.indices.size()};
+  std::copy(mesh.indices.begin(), mesh.indices.end(), indices.begin());
+
+  m_triangleIndices = std::move(indices);
+  m_meshPositions = std::move(positions);
+  m_meshSprings = std::move(springs);
+
+  Debug{} << "Loaded" << filename << "with" << m_meshPositions.size() / 3
+          << "vertices and" << m_meshSprings.size() << "springs";
+
+  reset();
+}
 
-  for (auto i = 0u; i < n; ++i) {
-    triplets.push_back(T(3 * i, 3 * i + n * 3, 1.0));
-    triplets.push_back(T(3 * i + 1, 3 * i + n * 3 + 1, 1.0));
-    triplets.push_back(T(3 * i + 2, 3 * i + n * 3 + 2, 1.0));
+void Cloth::resolveCollisions(const Vector &previous, Vector &next,
+                              const ScalarT dt) {
+  const auto n{m_particleCount * 3};
+  const auto positions{
+      Corrade::Containers::arrayCast<Magnum::Vector3>(
+          Corrade::Containers::arrayView(next.data(), n))};
+  const auto velocities{
+      Corrade::Containers::arrayCast<Magnum::Vector3>(
+          Corrade::Containers::arrayView(next.data() + n, n))};
+
+  m_selfCollision.resolve(getParticlePositions(previous), positions,
+                          velocities, getPinnedParticleIds());
+
+  if (!m_colliders.empty()) {
+    m_colliders.setTime(m_colliders.getTime() + dt);
+    m_colliders.resolve(positions, velocities, getPinnedParticleIds());
   }
 
-  for (auto i = 0u; i < n; ++i) {
-    triplets.push_back(T(3 * i + n * 3, 3 * i + 3 * n, m_dragCoeff));
-    triplets.push_back(T(3 * i + n * 3 + 1, 3 * i + 3 * n + 1, m_dragCoeff));
-    triplets.push_back(T(3 * i + n * 3 + 2, 3 * i + 3 * n + 2, m_dragCoeff));
+  if (m_sleep.enabled)
+    updateSleeping(previous, next, dt);
+}
+
+Corrade::Containers::ArrayView<const UnsignedInt>
+Cloth::getSleepingParticleIds() const {
+  return Corrade::Containers::arrayView(m_sleepingParticles.data(),
+                                        m_sleepingParticles.size());
+}
+
+void Cloth::setSleepSettings(const SleepSettings &settings) {
+  m_sleep = settings;
+
+  if (!m_sleep.enabled) {
+    m_tiles.assign(m_tiles.size(), SleepTile{});
+    updateAwakeParticles();
   }
+}
 
-  for (const auto s : m_springs) {
-    const auto li{xFromCoord(s.leftIdx)};
-    const auto ri{xFromCoord(s.rightIdx)};
-    const Vector3 xl{state.segment(li, 3)};
-    const Vector3 xr{state.segment(ri, 3)};
-
-    const Vector3 dx{xl - xr};
-    const Vector3 dxn{dx.normalized()};
-    const auto I{Matrix3::Identity(3, 3)};
-    const auto dxdxt{dxn * dxn.transpose()};
-
-    const Matrix3 jPart{
-        -s.k * ((1.0f - s.restLength / dx.norm()) * (I - dxdxt) + dxdxt) /
-        getParticleMass()};
-
-    for (UnsignedInt yi = 0; yi < 3; ++yi) {
-      for (UnsignedInt xi = 0; xi < 3; ++xi) {
-        triplets.push_back(T(li + yi + 3 * n, li + xi, jPart(yi, xi)));
-        triplets.push_back(T(li + yi + 3 * n, ri + xi, -jPart(yi, xi)));
-        triplets.push_back(T(ri + yi + 3 * n, li + xi, -jPart(yi, xi)));
-        triplets.push_back(T(ri + yi + 3 * n, ri + xi, jPart(yi, xi)));
-      }
-    }
+const SleepSettings &Cloth::getSleepSettings() const { return m_sleep; }
+
+std::size_t Cloth::getAwakeParticleCount() const {
+  return m_awakeParticles.size();
+}
+
+void Cloth::setSelfCollisionSettings(const SelfCollisionSettings &settings) {
+  m_selfCollision.setSettings(settings);
+}
+
+const SelfCollisionSettings &Cloth::getSelfCollisionSettings() const {
+  return m_selfCollision.getSettings();
+}
+
+const CollisionStatistics &Cloth::getCollisionStatistics() const {
+  return m_selfCollision.getStatistics();
+}
+
+void Cloth::resetCollisionStatistics() { m_selfCollision.resetStatistics(); }
+
+void Cloth::addCollider(std::unique_ptr<Collider> collider) {
+  m_colliders.add(std::move(collider));
+}
+
+void Cloth::clearColliders() { m_colliders = {}; }
+
+const ColliderSet &Cloth::getColliders() const { return m_colliders; }
+
+void Cloth::setStiffness(const ScalarT k) {
+  m_k = k;
+
+  for (auto &spring : m_springs)
+    spring.k = k;
+
+  for (auto &spring : m_meshSprings)
+    spring.k = k;
+
+  invalidateDerivativeCache();
+}
+
+System::ScalarT Cloth::getStiffness() const { return m_k; }
+
+void Cloth::setDragCoefficient(const ScalarT drag) {
+  m_dragCoeff = drag;
+  invalidateDerivativeCache();
+}
+
+System::ScalarT Cloth::getDragCoefficient() const { return m_dragCoeff; }
+
+void Cloth::setExtent(const Vector2 extent) {
+  if (!(extent.x() > 0.0f && extent.y() > 0.0f))
+    throw std::runtime_error("Invalid cloth extent");
+
+  m_extent = extent;
+}
+
+Vector2 Cloth::getExtent() const { return m_extent; }
+
+bool Cloth::isGrid() const { return m_meshPositions.size() == 0; }
+
+System::SparseMatrix Cloth::evalJacobian(const Vector &state) const {
+  const auto n{m_particleCount};
+
+  SparseMatrixRM j(n * 3 * 2, n * 3 * 2);
+
+  using T = Eigen::Triplet<ScalarT>;
+
+  // Every awake particle and every awake end of a spring has a fixed block
+  // of triplets, so that they can be filled in parallel
+  const std::size_t particleTriplets{6 * m_awakeParticles.size()};
+  std::vector<std::size_t> springTriplets(m_awakeSprings.size() + 1);
+  springTriplets[0] = particleTriplets;
+  for (std::size_t k = 0; k < m_awakeSprings.size(); ++k) {
+    const auto &s{m_springs[m_awakeSprings[k]]};
+    const std::size_t ends(!m_asleep[s.leftIdx] + !m_asleep[s.rightIdx]);
+    springTriplets[k + 1] = springTriplets[k] + 18 * ends;
   }
 
+  std::vector<T> triplets(springTriplets.back());
+
+  // Sleeping particles have zero rows
+  parallelFor(
+      TaskStage::Jacobian, m_awakeParticles.size(), 0,
+      [&](const std::size_t k) {
+        const auto i{m_awakeParticles[k]};
+        T *t{&triplets[6 * k]};
+
+        for (UnsignedInt c = 0; c < 3; ++c) {
+          *t++ = T(3 * i + c, 3 * i + n * 3 + c, 1.0);
+          *t++ = T(3 * i + n * 3 + c, 3 * i + 3 * n + c, m_dragCoeff);
+        }
+      });
+
+  parallelFor(
+      TaskStage::Jacobian, m_awakeSprings.size(), 0,
+      [&](const std::size_t k) {
+        const auto &s{m_springs[m_awakeSprings[k]]};
+        const bool leftAwake{!m_asleep[s.leftIdx]};
+        const bool rightAwake{!m_asleep[s.rightIdx]};
+        const auto li{xFromCoord(s.leftIdx)};
+        const auto ri{xFromCoord(s.rightIdx)};
+        const Vector3 xl{state.segment(li, 3)};
+        const Vector3 xr{state.segment(ri, 3)};
+
+        const Vector3 dx{xl - xr};
+        const Vector3 dxn{dx.normalized()};
+        const auto I{Matrix3::Identity(3, 3)};
+        const auto dxdxt{dxn * dxn.transpose()};
+
+        const Matrix3 jPart{
+            -s.k * ((1.0f - s.restLength / dx.norm()) * (I - dxdxt) + dxdxt) /
+            getParticleMass()};
+
+        T *t{&triplets[springTriplets[k]]};
+        for (UnsignedInt yi = 0; yi < 3; ++yi) {
+          for (UnsignedInt xi = 0; xi < 3; ++xi) {
+            if (leftAwake) {
+              *t++ = T(li + yi + 3 * n, li + xi, jPart(yi, xi));
+              *t++ = T(li + yi + 3 * n, ri + xi, -jPart(yi, xi));
+            }
+
+            if (rightAwake) {
+              *t++ = T(ri + yi + 3 * n, li + xi, -jPart(yi, xi));
+              *t++ = T(ri + yi + 3 * n, ri + xi, jPart(yi, xi));
+            }
+          }
+        }
+      });
+
   j.setFromTriplets(triplets.begin(), triplets.end());
 
   const auto &pinnedParticles{getPinnedParticleIds()};
@@ -193,26 +581,43 @@ System::SparseMatrix Cloth::evalJacobian(const Vector &state) const {
 }
 
 System::Vector Cloth::evalDerivative(const Vector &state) const {
-  const auto n{m_size.x() * m_size.y()};
+  const auto n{m_particleCount};
   Vector dxdt{Vector::Zero(n * 3 * 2)};
   const ScalarT massInv{1.0f / getParticleMass()};
 
-  for (UnsignedInt i = 0; i < n; ++i) {
-    xFromCoord(dxdt, i) = dxFromCoord(state, i);
-  }
-
-  for (const auto spring : m_springs) {
-    const Vector3 fS{spring.force(xFromCoord(state, spring.leftIdx),
-                                  xFromCoord(state, spring.rightIdx))};
-    dxFromCoord(dxdt, spring.rightIdx) += fS * massInv;
-    dxFromCoord(dxdt, spring.leftIdx) -= fS * massInv;
-  }
-
-  for (UnsignedInt i = 0; i < n; ++i) {
-    const Vector3 v{dxFromCoord(state, i)};
-    dxFromCoord(dxdt, i) +=
-        (fDrag(v, m_dragCoeff) + fGravity(getParticleMass())) * massInv;
-  }
+  parallelFor(
+      TaskStage::Forces, m_awakeSprings.size(), 0,
+      [&](const std::size_t k) {
+        const auto springIdx{m_awakeSprings[k]};
+        const auto &spring{m_springs[springIdx]};
+        m_springForces[springIdx] =
+            spring.force(xFromCoord(state, spring.leftIdx),
+                         xFromCoord(state, spring.rightIdx));
+      });
+
+  // Every particle gathers the forces of its springs instead of the springs
+  // scattering them, which would race. Sleeping particles stay where they
+  // are, all springs of awake ones are awake.
+  parallelFor(
+      TaskStage::Forces, m_awakeParticles.size(), 0,
+      [&](const std::size_t k) {
+        const auto i{m_awakeParticles[k]};
+        xFromCoord(dxdt, i) = dxFromCoord(state, i);
+
+        Vector3 f{Vector3::Zero()};
+        for (auto s = m_springOffsets[i]; s < m_springOffsets[i + 1]; ++s) {
+          const auto entry{m_particleSprings[s]};
+          const Vector3 &fS{m_springForces[entry & ~LeftEnd]};
+          if (entry & LeftEnd)
+            f -= fS;
+          else
+            f += fS;
+        }
+
+        const Vector3 v{dxFromCoord(state, i)};
+        f += fDrag(v, m_dragCoeff) + fGravity(getParticleMass());
+        dxFromCoord(dxdt, i) = f * massInv;
+      });
 
   const auto &pinnedParticles{getPinnedParticleIds()};
   for (const auto pinnedIdx : pinnedParticles) {
@@ -223,38 +628,47 @@ System::Vector Cloth::evalDerivative(const Vector &state) const {
   return dxdt;
 }
 
+System::ScalarT Cloth::getKineticEnergy(const Vector &state) const {
+  const auto n{m_particleCount};
+
+  return 0.5f * getParticleMass() * state.segment(n * 3, n * 3).squaredNorm();
+}
+
+System::ScalarT Cloth::getSpringEnergy(const Vector &state) const {
+  ScalarT energy{0.0f};
+
+  for (const auto &spring : m_springs) {
+    const ScalarT stretch{(state.segment(spring.rightIdx * 3, 3) -
+                           state.segment(spring.leftIdx * 3, 3))
+                              .norm() -
+                          spring.restLength};
+    energy += 0.5f * spring.k * stretch * stretch;
+  }
+
+  return energy;
+}
+
 Vector2ui Cloth::getSize() const { return m_size; }
 
 void Cloth::setSize(const Vector2ui size) {
   m_size = size;
+  m_meshPositions.resize(0);
+  m_meshSprings.clear();
 
   reset();
 }
 
-Corrade::Containers::Array<Magnum::Vector3>
-Cloth::getParticlePositions(const Vector &state) const {
-  const auto n{m_size.x() * m_size.y()};
-  Corrade::Containers::Array<Magnum::Vector3> positions{n};
+std::size_t Cloth::getParticleCount() const { return m_particleCount; }
 
-  for (auto i = 0u; i < n; ++i) {
-    const auto si{i * 3};
+bool Cloth::isSecondOrder() const { return true; }
 
-    positions[i].x() = static_cast<Float>(state(si));
-    positions[i].y() = static_cast<Float>(state(si + 1));
-    positions[i].z() = static_cast<Float>(state(si + 2));
-  }
-
-  return positions;
+Vector2ui Cloth::getGridSize() const {
+  return isGrid() ? m_size : Vector2ui{0};
 }
 
-Corrade::Containers::Array<UnsignedInt> Cloth::getMeshIndices() const {
-  Corrade::Containers::Array<UnsignedInt> meshIndices{
-      Corrade::Containers::NoInit, m_triangleIndices.size()};
-
-  std::memcpy(meshIndices.data(), m_triangleIndices.data(),
-              m_triangleIndices.size() * sizeof(UnsignedInt));
-
-  return meshIndices;
+Corrade::Containers::ArrayView<const UnsignedInt>
+Cloth::getMeshIndices() const {
+  return m_triangleIndices;
 }
 
 } // namespace clothsim
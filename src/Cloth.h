@@ -4,11 +4,17 @@
 #include <Corrade/Containers/Array.h>
 
 #include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector2.h>
 
 #include <Eigen/Sparse>
 
+#include "Colliders.h"
+#include "Collision.h"
 #include "System.h"
 
+#include <memory>
+#include <set>
+#include <string>
 #include <vector>
 
 namespace clothsim {
@@ -25,27 +31,83 @@ struct Spring {
   System::ScalarT restLength;
 };
 
+// Tiles of particles that stay calm for a number of steps are put to sleep:
+// they keep their positions, lose their velocities and are left out of the
+// force and Jacobian evaluation until a contact or a moving neighbour wakes
+// them up
+struct SleepSettings {
+  bool enabled{false};
+  // A particle is calm below both
+  Float velocity{0.01f};
+  Float acceleration{0.1f};
+  UnsignedInt steps{50};
+};
+
 class Cloth : public System {
 public:
-  Cloth(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-        Object3D &parent, Magnum::SceneGraph::DrawableGroup3D &drawableGroup);
+  Cloth();
   ~Cloth() override;
 
-  Corrade::Containers::Array<Magnum::Vector3>
-  getParticlePositions(const Vector &state) const override;
+  std::size_t getParticleCount() const override;
+  bool isSecondOrder() const override;
+  Vector2ui getGridSize() const override;
 
-  Corrade::Containers::Array<UnsignedInt> getMeshIndices() const override;
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const override;
 
   Vector evalDerivative(const Vector &state) const override;
   SparseMatrix evalJacobian(const Vector &state) const override;
+  ScalarT getKineticEnergy(const Vector &state) const override;
+  // Elastic energy stored in the springs, zero at their rest lengths
+  ScalarT getSpringEnergy(const Vector &state) const;
 
   void reset() override;
+  void resolveCollisions(const Vector &previous, Vector &next,
+                         const ScalarT dt) override;
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getSleepingParticleIds() const override;
+
+  void setSelfCollisionSettings(const SelfCollisionSettings &settings);
+  const SelfCollisionSettings &getSelfCollisionSettings() const;
+  const CollisionStatistics &getCollisionStatistics() const;
+  void resetCollisionStatistics();
+
+  // Colliders move with the simulation time and restart on reset
+  void addCollider(std::unique_ptr<Collider> collider);
+  void clearColliders();
+  const ColliderSet &getColliders() const;
+
+  void setSleepSettings(const SleepSettings &settings);
+  const SleepSettings &getSleepSettings() const;
+  std::size_t getAwakeParticleCount() const;
+
   void setSize(const Vector2ui size);
   Vector2ui getSize() const;
 
+  // Replaces the grid with the triangles of an OBJ or PLY file. Springs are
+  // placed on the mesh edges and across the edges shared by two triangles.
+  void loadMesh(const std::string &filename);
+  bool isGrid() const;
+
   Float getMass() const;
 
+  void setStiffness(const ScalarT k);
+  ScalarT getStiffness() const;
+  void setDragCoefficient(const ScalarT drag);
+  ScalarT getDragCoefficient() const;
+  // Width and height of the grid, applied on the next reset
+  void setExtent(const Vector2 extent);
+  Vector2 getExtent() const;
+
 private:
+  void resetGrid(Vector &state);
+  void resetMesh(Vector &state);
+
+  void setupParticleSprings();
+  void setupSleepTiles();
+  void updateSleeping(const Vector &previous, Vector &next, const ScalarT dt);
+  void updateAwakeParticles();
+
   inline decltype(auto) xFromCoord(const UnsignedInt x,
                                    const UnsignedInt y) const {
     assert(x < m_size.x() && y < m_size.y());
@@ -75,7 +137,7 @@ private:
                                     const UnsignedInt y) const {
     assert(x < m_size.x() && y < m_size.y());
 
-    const auto n{m_size.x() * m_size.y() * 3};
+    const auto n{m_particleCount * 3};
 
     return n + toIdx(x, y);
   }
@@ -86,7 +148,7 @@ private:
                                     const UnsignedInt y) const {
     assert(x < m_size.x() && y < m_size.y());
 
-    const auto n{m_size.x() * m_size.y() * 3};
+    const auto n{m_particleCount * 3};
 
     return Eigen::VectorBlock<Derived>(v.derived(), n + toIdx(x, y), 3);
   }
@@ -97,13 +159,13 @@ private:
                                     const UnsignedInt y) const {
     assert(x < m_size.x() && y < m_size.y());
 
-    const auto n{m_size.x() * m_size.y() * 3};
+    const auto n{m_particleCount * 3};
 
     return Eigen::VectorBlock<const Derived>(v.derived(), n + toIdx(x, y), 3);
   }
 
   inline decltype(auto) xFromCoord(const UnsignedInt idx) const {
-    assert(idx < m_size.x() * m_size.y());
+    assert(idx < m_particleCount);
 
     return idx * 3;
   }
@@ -111,7 +173,7 @@ private:
   template <typename Derived>
   inline decltype(auto) xFromCoord(Eigen::MatrixBase<Derived> &v,
                                    const UnsignedInt idx) const {
-    assert(idx < m_size.x() * m_size.y());
+    assert(idx < m_particleCount);
 
     return Eigen::VectorBlock<Derived>(v.derived(), idx * 3, 3);
   }
@@ -119,15 +181,15 @@ private:
   template <typename Derived>
   inline decltype(auto) xFromCoord(const Eigen::MatrixBase<Derived> &v,
                                    const UnsignedInt idx) const {
-    assert(idx < m_size.x() * m_size.y());
+    assert(idx < m_particleCount);
 
     return Eigen::VectorBlock<const Derived>(v.derived(), idx * 3, 3);
   }
 
   inline decltype(auto) dxFromCoord(const UnsignedInt idx) const {
-    assert(idx < m_size.x() * m_size.y());
+    assert(idx < m_particleCount);
 
-    const auto n{m_size.x() * m_size.y() * 3};
+    const auto n{m_particleCount * 3};
 
     return n + idx * 3;
   }
@@ -135,9 +197,9 @@ private:
   template <typename Derived>
   inline decltype(auto) dxFromCoord(Eigen::MatrixBase<Derived> &v,
                                     const UnsignedInt idx) const {
-    assert(idx < m_size.x() * m_size.y());
+    assert(idx < m_particleCount);
 
-    const auto n{m_size.x() * m_size.y() * 3};
+    const auto n{m_particleCount * 3};
 
     return Eigen::VectorBlock<Derived>(v.derived(), n + idx * 3, 3);
   }
@@ -145,9 +207,9 @@ private:
   template <typename Derived>
   inline decltype(auto) dxFromCoord(const Eigen::MatrixBase<Derived> &v,
                                     const UnsignedInt idx) const {
-    assert(idx < m_size.x() * m_size.y());
+    assert(idx < m_particleCount);
 
-    const auto n{m_size.x() * m_size.y() * 3};
+    const auto n{m_particleCount * 3};
 
     return Eigen::VectorBlock<const Derived>(v.derived(), n + idx * 3, 3);
   }
@@ -164,13 +226,50 @@ private:
     return y * m_size.x() + x;
   }
 
-  const ScalarT m_k{300.0f};
-  const ScalarT m_dragCoeff{0.08f};
+  ScalarT m_k{300.0f};
+  ScalarT m_dragCoeff{0.08f};
+  Vector2 m_extent{1.5f, 1.5f};
 
   Vector2ui m_size;
+  UnsignedInt m_particleCount{0};
   std::vector<Spring> m_springs;
+  // Springs of particle i are m_particleSprings[m_springOffsets[i]] up to
+  // m_particleSprings[m_springOffsets[i + 1]]
+  std::vector<UnsignedInt> m_springOffsets;
+  std::vector<UnsignedInt> m_particleSprings;
+  // Of the last evaluation, indexed like m_springs
+  mutable std::vector<Vector3> m_springForces;
 
   Corrade::Containers::Array<UnsignedInt> m_triangleIndices;
+
+  // Empty in grid mode
+  Vector m_meshPositions;
+  std::vector<Spring> m_meshSprings;
+
+  SelfCollision m_selfCollision;
+  ColliderSet m_colliders;
+
+  struct SleepTile {
+    UnsignedInt calmSteps{0};
+    bool asleep{false};
+  };
+
+  SleepSettings m_sleep;
+  std::vector<SleepTile> m_tiles;
+  std::vector<UnsignedInt> m_particleTiles;
+  // Particles of tile i are m_tileParticles[m_tileOffsets[i]] up to
+  // m_tileParticles[m_tileOffsets[i + 1]]
+  std::vector<UnsignedInt> m_tileOffsets;
+  std::vector<UnsignedInt> m_tileParticles;
+  // Springs between different tiles, they carry motion to sleeping tiles
+  std::vector<UnsignedInt> m_tileSprings;
+  std::vector<char> m_asleep;
+  std::vector<UnsignedInt> m_sleepingParticles;
+  std::vector<UnsignedInt> m_awakeParticles;
+  // Springs with at least one awake particle
+  std::vector<UnsignedInt> m_awakeSprings;
+  // Changes of the pinned particles wake everything up
+  std::set<UnsignedInt> m_sleepPinned;
 };
 } // namespace clothsim
 
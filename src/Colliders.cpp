@@ -0,0 +1,272 @@
+#include "Colliders.h"
+#include "TaskPool.h"
+
+#include <Magnum/Math/Functions.h>
+
+#include <Corrade/Containers/ArrayViewStl.h>
+
+#include <limits>
+#include <stdexcept>
+
+namespace clothsim {
+Matrix4 ColliderMotion::transformation(const Double time) const {
+  const Float t{Float(time)};
+  const Float angle{angularVelocity.length() * t};
+  const Matrix4 rotation{angle > 0.0f
+                             ? Matrix4::rotation(Rad{angle},
+                                                 angularVelocity.normalized())
+                             : Matrix4{}};
+
+  return Matrix4::translation(pivot + velocity * t) * rotation *
+         Matrix4::translation(-pivot);
+}
+
+bool ColliderMotion::isMoving() const {
+  return velocity != Vector3{0.0f} || angularVelocity != Vector3{0.0f};
+}
+
+Vector3 ColliderMotion::pointVelocity(const Matrix4 &transformation,
+                                      const Vector3 &point) const {
+  const Vector3 center{transformation.transformPoint(pivot)};
+  return velocity + Math::cross(angularVelocity, point - center);
+}
+
+void Collider::setTime(const Double time) {
+  m_transformation = motion.transformation(time);
+  transform(m_transformation);
+}
+
+SphereCollider::SphereCollider(const Vector3 &center, const Float radius)
+    : m_restCenter{center}, m_center{center}, m_radius{radius} {
+  if (!(radius > 0.0f))
+    throw std::runtime_error("Sphere collider radius must be positive");
+}
+
+bool SphereCollider::contact(const Vector3 &p, const Float maxDistance,
+                             ColliderContact &contact) const {
+  const Vector3 d{p - m_center};
+  const Float length{d.length()};
+
+  if (length - m_radius >= maxDistance || length == 0.0f)
+    return false;
+
+  contact.normal = d / length;
+  contact.point = m_center + contact.normal * m_radius;
+  contact.distance = length - m_radius;
+  contact.velocity = motion.pointVelocity(m_transformation, contact.point);
+  return true;
+}
+
+void SphereCollider::bounds(Vector3 &min, Vector3 &max) const {
+  min = m_center - Vector3{m_radius};
+  max = m_center + Vector3{m_radius};
+}
+
+void SphereCollider::transform(const Matrix4 &transformation) {
+  m_center = transformation.transformPoint(m_restCenter);
+}
+
+CapsuleCollider::CapsuleCollider(const Vector3 &a, const Vector3 &b,
+                                 const Float radius)
+    : m_restA{a}, m_restB{b}, m_a{a}, m_b{b}, m_radius{radius} {
+  if (!(radius > 0.0f))
+    throw std::runtime_error("Capsule collider radius must be positive");
+}
+
+bool CapsuleCollider::contact(const Vector3 &p, const Float maxDistance,
+                              ColliderContact &contact) const {
+  const Vector3 axis{m_b - m_a};
+  const Float axisLength{axis.dot()};
+  const Float t{axisLength > 0.0f
+                    ? Math::clamp(Math::dot(p - m_a, axis) / axisLength, 0.0f,
+                                  1.0f)
+                    : 0.0f};
+  const Vector3 center{m_a + t * axis};
+  const Vector3 d{p - center};
+  const Float length{d.length()};
+
+  if (length - m_radius >= maxDistance || length == 0.0f)
+    return false;
+
+  contact.normal = d / length;
+  contact.point = center + contact.normal * m_radius;
+  contact.distance = length - m_radius;
+  contact.velocity = motion.pointVelocity(m_transformation, contact.point);
+  return true;
+}
+
+void CapsuleCollider::bounds(Vector3 &min, Vector3 &max) const {
+  min = Math::min(m_a, m_b) - Vector3{m_radius};
+  max = Math::max(m_a, m_b) + Vector3{m_radius};
+}
+
+void CapsuleCollider::transform(const Matrix4 &transformation) {
+  m_a = transformation.transformPoint(m_restA);
+  m_b = transformation.transformPoint(m_restB);
+}
+
+PlaneCollider::PlaneCollider(const Vector3 &point, const Vector3 &normal)
+    : m_restPoint{point}, m_restNormal{normal.normalized()}, m_point{point},
+      m_normal{m_restNormal} {}
+
+bool PlaneCollider::contact(const Vector3 &p, const Float maxDistance,
+                            ColliderContact &contact) const {
+  const Float distance{Math::dot(p - m_point, m_normal)};
+
+  if (distance >= maxDistance)
+    return false;
+
+  contact.normal = m_normal;
+  contact.point = p - distance * m_normal;
+  contact.distance = distance;
+  contact.velocity = motion.pointVelocity(m_transformation, contact.point);
+  return true;
+}
+
+// The half space is unbounded unless the plane is axis-aligned, a moving
+// plane is taken to reach everywhere
+void PlaneCollider::bounds(Vector3 &min, Vector3 &max) const {
+  min = Vector3{std::numeric_limits<Float>::lowest()};
+  max = Vector3{std::numeric_limits<Float>::max()};
+}
+
+void PlaneCollider::transform(const Matrix4 &transformation) {
+  m_point = transformation.transformPoint(m_restPoint);
+  m_normal = transformation.transformVector(m_restNormal).normalized();
+}
+
+MeshCollider::MeshCollider(std::vector<Vector3> vertices,
+                           std::vector<UnsignedInt> indices)
+    : m_restVertices{std::move(vertices)}, m_vertices{m_restVertices},
+      m_indices{std::move(indices)} {
+  for (const auto index : m_indices) {
+    if (index >= m_vertices.size())
+      throw std::runtime_error("Mesh collider index out of range");
+  }
+
+  m_bvh.build(m_vertices, m_indices);
+}
+
+bool MeshCollider::contact(const Vector3 &p, const Float maxDistance,
+                           ColliderContact &contact) const {
+  TriangleBVH::Hit hit;
+  if (!m_bvh.closestPoint(p, maxDistance, hit))
+    return false;
+
+  const auto *const t{&m_indices[3 * hit.triangle]};
+  const Vector3 normal{Math::cross(m_vertices[t[1]] - m_vertices[t[0]],
+                                   m_vertices[t[2]] - m_vertices[t[0]])
+                           .normalized()};
+
+  contact.point = hit.point;
+  contact.normal = normal;
+  contact.distance = Math::dot(p - hit.point, normal);
+  contact.velocity = motion.pointVelocity(m_transformation, contact.point);
+  return true;
+}
+
+void MeshCollider::setVertices(
+    Corrade::Containers::ArrayView<const Vector3> vertices) {
+  if (vertices.size() != m_restVertices.size())
+    throw std::runtime_error("Mesh collider vertex count changed");
+
+  m_restVertices.assign(vertices.begin(), vertices.end());
+  transform(m_transformation);
+}
+
+const TriangleBVH &MeshCollider::getBVH() const { return m_bvh; }
+
+void MeshCollider::bounds(Vector3 &min, Vector3 &max) const {
+  min = Vector3{std::numeric_limits<Float>::max()};
+  max = Vector3{std::numeric_limits<Float>::lowest()};
+
+  for (const auto &v : m_vertices) {
+    min = Math::min(min, v);
+    max = Math::max(max, v);
+  }
+}
+
+void MeshCollider::transform(const Matrix4 &transformation) {
+  parallelFor(
+      TaskStage::Collision, m_vertices.size(), 0, [&](const std::size_t i) {
+        m_vertices[i] = transformation.transformPoint(m_restVertices[i]);
+      });
+
+  m_bvh.refit(m_vertices);
+}
+
+void ColliderSet::add(std::unique_ptr<Collider> collider) {
+  collider->setTime(m_time);
+  m_colliders.push_back(std::move(collider));
+}
+
+bool ColliderSet::empty() const { return m_colliders.empty(); }
+
+void ColliderSet::setTime(const Double time) {
+  m_sweptBounds.clear();
+
+  for (auto &collider : m_colliders) {
+    if (time == m_time || !collider->motion.isMoving()) {
+      collider->setTime(time);
+      continue;
+    }
+
+    SweptBounds start, end;
+    collider->bounds(start.min, start.max);
+    collider->setTime(time);
+    collider->bounds(end.min, end.max);
+
+    const Vector3 margin{collider->thickness};
+    m_sweptBounds.push_back(
+        SweptBounds{Math::min(start.min, end.min) - margin,
+                    Math::max(start.max, end.max) + margin});
+  }
+
+  m_time = time;
+}
+
+Double ColliderSet::getTime() const { return m_time; }
+
+const std::vector<ColliderSet::SweptBounds> &
+ColliderSet::getSweptBounds() const {
+  return m_sweptBounds;
+}
+
+void ColliderSet::resolve(Corrade::Containers::ArrayView<Vector3> positions,
+                          Corrade::Containers::ArrayView<Vector3> velocities,
+                          const std::set<UnsignedInt> &pinned) const {
+  if (m_colliders.empty())
+    return;
+
+  parallelFor(
+      TaskStage::Collision, positions.size(), 256, [&](const std::size_t i) {
+        if (pinned.count(UnsignedInt(i)))
+          return;
+
+        for (const auto &collider : m_colliders) {
+          ColliderContact c;
+          if (!collider->contact(positions[i], collider->thickness, c) ||
+              c.distance >= collider->thickness)
+            continue;
+
+          positions[i] += c.normal * (collider->thickness - c.distance);
+
+          // Velocity relative to the moving surface
+          const Vector3 relative{velocities[i] - c.velocity};
+          const Float normalSpeed{Math::dot(relative, c.normal)};
+          if (normalSpeed >= 0.0f)
+            continue;
+
+          const Vector3 tangential{relative - normalSpeed * c.normal};
+          const Float tangentialSpeed{tangential.length()};
+          const Float scale{
+              tangentialSpeed > 0.0f
+                  ? Math::max(0.0f, 1.0f - collider->friction * -normalSpeed /
+                                               tangentialSpeed)
+                  : 0.0f};
+
+          velocities[i] = c.velocity + tangential * scale;
+        }
+      });
+}
+} // namespace clothsim
@@ -0,0 +1,168 @@
+#ifndef CLOTHSIM_COLLIDERS_H
+#define CLOTHSIM_COLLIDERS_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Matrix4.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "BVH.h"
+
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Rigid motion with constant linear and angular velocity. The rotation is
+// around the pivot, the angular velocity is the axis scaled by the angle
+// per second.
+struct ColliderMotion {
+  Vector3 velocity{0.0f};
+  Vector3 angularVelocity{0.0f};
+  Vector3 pivot{0.0f};
+
+  Matrix4 transformation(const Double time) const;
+  bool isMoving() const;
+  // Velocity of a point moving with the collider
+  Vector3 pointVelocity(const Matrix4 &transformation,
+                        const Vector3 &point) const;
+};
+
+struct ColliderContact {
+  Vector3 point;
+  Vector3 normal;
+  // Negative inside the collider
+  Float distance;
+  Vector3 velocity;
+};
+
+class Collider {
+public:
+  virtual ~Collider() = default;
+
+  // Reports the nearest surface point if p is closer than maxDistance or
+  // inside the collider
+  virtual bool contact(const Vector3 &p, const Float maxDistance,
+                       ColliderContact &contact) const = 0;
+  // Axis-aligned box around the collider at its current time
+  virtual void bounds(Vector3 &min, Vector3 &max) const = 0;
+
+  void setTime(const Double time);
+
+  ColliderMotion motion;
+  Float thickness{0.005f};
+  Float friction{0.3f};
+
+protected:
+  virtual void transform(const Matrix4 &transformation) = 0;
+
+  Matrix4 m_transformation{};
+};
+
+class SphereCollider : public Collider {
+public:
+  SphereCollider(const Vector3 &center, const Float radius);
+
+  bool contact(const Vector3 &p, const Float maxDistance,
+               ColliderContact &contact) const override;
+  void bounds(Vector3 &min, Vector3 &max) const override;
+
+private:
+  void transform(const Matrix4 &transformation) override;
+
+  Vector3 m_restCenter;
+  Vector3 m_center;
+  Float m_radius;
+};
+
+class CapsuleCollider : public Collider {
+public:
+  CapsuleCollider(const Vector3 &a, const Vector3 &b, const Float radius);
+
+  bool contact(const Vector3 &p, const Float maxDistance,
+               ColliderContact &contact) const override;
+  void bounds(Vector3 &min, Vector3 &max) const override;
+
+private:
+  void transform(const Matrix4 &transformation) override;
+
+  Vector3 m_restA, m_restB;
+  Vector3 m_a, m_b;
+  Float m_radius;
+};
+
+// Half space below the plane
+class PlaneCollider : public Collider {
+public:
+  PlaneCollider(const Vector3 &point, const Vector3 &normal);
+
+  bool contact(const Vector3 &p, const Float maxDistance,
+               ColliderContact &contact) const override;
+  void bounds(Vector3 &min, Vector3 &max) const override;
+
+private:
+  void transform(const Matrix4 &transformation) override;
+
+  Vector3 m_restPoint, m_restNormal;
+  Vector3 m_point, m_normal;
+};
+
+// Triangle mesh, particles are kept on the front side of the triangle
+// closest to them
+class MeshCollider : public Collider {
+public:
+  MeshCollider(std::vector<Vector3> vertices, std::vector<UnsignedInt> indices);
+
+  bool contact(const Vector3 &p, const Float maxDistance,
+               ColliderContact &contact) const override;
+  void bounds(Vector3 &min, Vector3 &max) const override;
+
+  // Deforms the mesh, the rest pose is replaced as well
+  void setVertices(Corrade::Containers::ArrayView<const Vector3> vertices);
+
+  const TriangleBVH &getBVH() const;
+
+private:
+  void transform(const Matrix4 &transformation) override;
+
+  std::vector<Vector3> m_restVertices;
+  std::vector<Vector3> m_vertices;
+  std::vector<UnsignedInt> m_indices;
+  TriangleBVH m_bvh;
+};
+
+class ColliderSet {
+public:
+  void add(std::unique_ptr<Collider> collider);
+  bool empty() const;
+
+  void setTime(const Double time);
+  Double getTime() const;
+
+  // Boxes the moving colliders swept through in the last setTime, widened
+  // by their thickness. The box joins the start and end poses, rotating
+  // colliders are assumed to turn little in between.
+  struct SweptBounds {
+    Vector3 min;
+    Vector3 max;
+  };
+  const std::vector<SweptBounds> &getSweptBounds() const;
+
+  // Moves particles out of the colliders and removes the velocity into
+  // them, tangential velocity is reduced by Coulomb friction. Particles are
+  // processed in parallel.
+  void resolve(Corrade::Containers::ArrayView<Vector3> positions,
+               Corrade::Containers::ArrayView<Vector3> velocities,
+               const std::set<UnsignedInt> &pinned) const;
+
+private:
+  std::vector<std::unique_ptr<Collider>> m_colliders;
+  std::vector<SweptBounds> m_sweptBounds;
+  Double m_time{0.0};
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_COLLIDERS_H
@@ -0,0 +1,859 @@
+#include "Collision.h"
+#include "TaskPool.h"
+
+#include <Corrade/Containers/ArrayViewStl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+namespace clothsim {
+namespace {
+using Corrade::Containers::ArrayView;
+
+std::size_t chunkCount(const std::size_t n) {
+  constexpr std::size_t minChunkSize{256};
+  return std::max<std::size_t>(
+      1, std::min<std::size_t>(4 * TaskPool::shared().getThreadCount(),
+                               n / minChunkSize));
+}
+
+std::size_t chunkBegin(const std::size_t chunk, const std::size_t chunks,
+                       const std::size_t n) {
+  return n * chunk / chunks;
+}
+
+// Whether the box around the particles at the start and the end of the
+// step overlaps the given one
+template <std::size_t N>
+bool sweptBoxOverlaps(ArrayView<const Vector3> previous,
+                      ArrayView<const Vector3> positions,
+                      const UnsignedInt (&particles)[N], const Vector3 &min,
+                      const Vector3 &max) {
+  Vector3 lo{previous[particles[0]]};
+  Vector3 hi{lo};
+  for (const auto i : particles) {
+    lo = Math::min(lo, Math::min(previous[i], positions[i]));
+    hi = Math::max(hi, Math::max(previous[i], positions[i]));
+  }
+
+  return !(lo.x() > max.x() || hi.x() < min.x() || lo.y() > max.y() ||
+           hi.y() < min.y() || lo.z() > max.z() || hi.z() < min.z());
+}
+
+Double evalCubic(const Double c[4], const Double t) {
+  return ((c[3] * t + c[2]) * t + c[1]) * t + c[0];
+}
+
+// Roots of c[0] + c[1] t + c[2] t^2 + c[3] t^3 in [0, 1] in ascending
+// order. The interval is split at the extrema so that the cubic is
+// monotonic on every part, then sign changes are bisected.
+std::size_t cubicRoots(const Double c[4], Float roots[3]) {
+  // The cubic lies in the convex hull of its Bernstein coefficients, if
+  // they share a sign there is no root
+  const Double b1{c[0] + c[1] / 3.0};
+  const Double b2{b1 + (c[1] + c[2]) / 3.0};
+  const Double b3{c[0] + c[1] + c[2] + c[3]};
+  if ((c[0] > 0.0 && b1 > 0.0 && b2 > 0.0 && b3 > 0.0) ||
+      (c[0] < 0.0 && b1 < 0.0 && b2 < 0.0 && b3 < 0.0))
+    return 0;
+
+  Double bounds[4]{0.0};
+  std::size_t boundCount{1};
+
+  // Extrema from the derivative 3 c3 t^2 + 2 c2 t + c1
+  const Double a{3.0 * c[3]};
+  const Double b{2.0 * c[2]};
+  Double extrema[2];
+  std::size_t extremaCount{0};
+  if (std::abs(a) > 1e-12) {
+    const Double discriminant{b * b - 4.0 * a * c[1]};
+    if (discriminant >= 0.0) {
+      const Double root{std::sqrt(discriminant)};
+      extrema[extremaCount++] = (-b - root) / (2.0 * a);
+      extrema[extremaCount++] = (-b + root) / (2.0 * a);
+      if (extrema[0] > extrema[1])
+        std::swap(extrema[0], extrema[1]);
+    }
+  } else if (std::abs(b) > 1e-12) {
+    extrema[extremaCount++] = -c[1] / b;
+  }
+
+  for (std::size_t i = 0; i < extremaCount; ++i) {
+    if (extrema[i] > 0.0 && extrema[i] < 1.0)
+      bounds[boundCount++] = extrema[i];
+  }
+  bounds[boundCount++] = 1.0;
+
+  std::size_t count{0};
+  for (std::size_t i = 0; i + 1 < boundCount; ++i) {
+    Double lo{bounds[i]};
+    Double hi{bounds[i + 1]};
+    Double fLo{evalCubic(c, lo)};
+    const Double fHi{evalCubic(c, hi)};
+
+    if (fLo == 0.0) {
+      if (count == 0 || roots[count - 1] < Float(lo))
+        roots[count++] = Float(lo);
+      continue;
+    }
+
+    if ((fLo < 0.0) == (fHi < 0.0) && fHi != 0.0)
+      continue;
+
+    for (std::size_t iteration = 0; iteration < 40; ++iteration) {
+      const Double middle{0.5 * (lo + hi)};
+      const Double fMiddle{evalCubic(c, middle)};
+
+      if ((fMiddle < 0.0) == (fLo < 0.0)) {
+        lo = middle;
+        fLo = fMiddle;
+      } else {
+        hi = middle;
+      }
+    }
+
+    roots[count++] = Float(hi);
+  }
+
+  return count;
+}
+
+// Times in [0, 1] at which e3 lies in the plane spanned by e1 and e2 while
+// all three move linearly from their start to their end values
+std::size_t coplanarityTimes(const Vector3 &e1Start, const Vector3 &e1End,
+                             const Vector3 &e2Start, const Vector3 &e2End,
+                             const Vector3 &e3Start, const Vector3 &e3End,
+                             Float times[3]) {
+  const Vector3 d1{e1End - e1Start};
+  const Vector3 d2{e2End - e2Start};
+  const Vector3 d3{e3End - e3Start};
+
+  const Vector3 c0{Math::cross(e1Start, e2Start)};
+  const Vector3 c1{Math::cross(e1Start, d2) + Math::cross(d1, e2Start)};
+  const Vector3 c2{Math::cross(d1, d2)};
+
+  const Double coefficients[4]{
+      Double(Math::dot(c0, e3Start)),
+      Double(Math::dot(c1, e3Start)) + Double(Math::dot(c0, d3)),
+      Double(Math::dot(c2, e3Start)) + Double(Math::dot(c1, d3)),
+      Double(Math::dot(c2, d3))};
+
+  return cubicRoots(coefficients, times);
+}
+
+// Parameters of the closest points of the segments p1 q1 and p2 q2, from
+// Ericson's Real-Time Collision Detection
+void closestSegmentParameters(const Vector3 &p1, const Vector3 &q1,
+                              const Vector3 &p2, const Vector3 &q2, Float &s,
+                              Float &t) {
+  const Vector3 d1{q1 - p1};
+  const Vector3 d2{q2 - p2};
+  const Vector3 r{p1 - p2};
+  const Float a{d1.dot()};
+  const Float e{d2.dot()};
+  const Float f{Math::dot(d2, r)};
+
+  if (a <= 1e-12f && e <= 1e-12f) {
+    s = t = 0.0f;
+    return;
+  }
+
+  if (a <= 1e-12f) {
+    s = 0.0f;
+    t = Math::clamp(f / e, 0.0f, 1.0f);
+    return;
+  }
+
+  const Float c{Math::dot(d1, r)};
+  if (e <= 1e-12f) {
+    t = 0.0f;
+    s = Math::clamp(-c / a, 0.0f, 1.0f);
+    return;
+  }
+
+  const Float b{Math::dot(d1, d2)};
+  const Float denominator{a * e - b * b};
+  s = denominator > 0.0f ? Math::clamp((b * f - c * e) / denominator, 0.0f,
+                                       1.0f)
+                         : 0.0f;
+  t = (b * s + f) / e;
+
+  if (t < 0.0f) {
+    t = 0.0f;
+    s = Math::clamp(-c / a, 0.0f, 1.0f);
+  } else if (t > 1.0f) {
+    t = 1.0f;
+    s = Math::clamp((b - c) / a, 0.0f, 1.0f);
+  }
+}
+
+} // namespace
+
+// From Ericson's Real-Time Collision Detection
+Vector3 closestPointWeights(const Vector3 &p, const Vector3 &a,
+                            const Vector3 &b, const Vector3 &c) {
+  const Vector3 ab{b - a};
+  const Vector3 ac{c - a};
+  const Vector3 ap{p - a};
+  const Float d1{Math::dot(ab, ap)};
+  const Float d2{Math::dot(ac, ap)};
+  if (d1 <= 0.0f && d2 <= 0.0f)
+    return {1.0f, 0.0f, 0.0f};
+
+  const Vector3 bp{p - b};
+  const Float d3{Math::dot(ab, bp)};
+  const Float d4{Math::dot(ac, bp)};
+  if (d3 >= 0.0f && d4 <= d3)
+    return {0.0f, 1.0f, 0.0f};
+
+  const Float vc{d1 * d4 - d3 * d2};
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    const Float v{d1 / (d1 - d3)};
+    return {1.0f - v, v, 0.0f};
+  }
+
+  const Vector3 cp{p - c};
+  const Float d5{Math::dot(ab, cp)};
+  const Float d6{Math::dot(ac, cp)};
+  if (d6 >= 0.0f && d5 <= d6)
+    return {0.0f, 0.0f, 1.0f};
+
+  const Float vb{d5 * d2 - d1 * d6};
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    const Float w{d2 / (d2 - d6)};
+    return {1.0f - w, 0.0f, w};
+  }
+
+  const Float va{d3 * d6 - d5 * d4};
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+    const Float w{(d4 - d3) / ((d4 - d3) + (d5 - d6))};
+    return {0.0f, 1.0f - w, w};
+  }
+
+  const Float denominator{1.0f / (va + vb + vc)};
+  const Float v{vb * denominator};
+  const Float w{vc * denominator};
+  return {1.0f - v - w, v, w};
+}
+
+void SpatialHash::build(ArrayView<const Vector3> boxMin,
+                        ArrayView<const Vector3> boxMax, const Float cellSize) {
+  m_cellSize = cellSize;
+  const auto n{boxMin.size()};
+
+  std::size_t tableSize{1};
+  while (tableSize < 2 * n)
+    tableSize *= 2;
+
+  // Sized first, bucket() masks with the table size
+  m_bucketStart.resize(tableSize + 1);
+
+  // Cells overlapped by every item, then the bucket of each of them
+  m_itemCells.resize(n + 1);
+  m_itemCells[0] = 0;
+
+  parallelFor(TaskStage::Collision, n, 0, [&](const std::size_t i) {
+    const auto extent{cell(boxMax[i]) - cell(boxMin[i]) + Vector3i{1}};
+    m_itemCells[i + 1] = UnsignedInt(extent.product());
+  });
+
+  std::partial_sum(m_itemCells.begin(), m_itemCells.end(),
+                   m_itemCells.begin());
+  m_entries.resize(m_itemCells.back());
+
+  std::vector<std::atomic<UnsignedInt>> counts(tableSize);
+
+  parallelFor(TaskStage::Collision, n, 0, [&](const std::size_t i) {
+    const auto lo{cell(boxMin[i])};
+    const auto hi{cell(boxMax[i])};
+    auto entry{m_itemCells[i]};
+
+    for (Int z = lo.z(); z <= hi.z(); ++z) {
+      for (Int y = lo.y(); y <= hi.y(); ++y) {
+        for (Int x = lo.x(); x <= hi.x(); ++x) {
+          const auto b{bucket(Vector3i{x, y, z})};
+          m_entries[entry++] = UnsignedInt(b);
+          counts[b].fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+  });
+
+  m_bucketStart[0] = 0;
+  for (std::size_t b = 0; b < tableSize; ++b) {
+    m_bucketStart[b + 1] =
+        m_bucketStart[b] + counts[b].load(std::memory_order_relaxed);
+    counts[b].store(m_bucketStart[b], std::memory_order_relaxed);
+  }
+
+  m_items.resize(m_entries.size());
+
+  parallelFor(TaskStage::Collision, n, 0, [&](const std::size_t i) {
+    for (auto entry = m_itemCells[i]; entry < m_itemCells[i + 1]; ++entry) {
+      const auto slot{
+          counts[m_entries[entry]].fetch_add(1, std::memory_order_relaxed)};
+      m_items[slot] = UnsignedInt(i);
+    }
+  });
+}
+
+void SelfCollision::setSettings(const SelfCollisionSettings &settings) {
+  m_settings = settings;
+}
+
+const SelfCollisionSettings &SelfCollision::getSettings() const {
+  return m_settings;
+}
+
+void SelfCollision::setTopology(
+    ArrayView<const UnsignedInt> triangles,
+    const std::vector<std::pair<UnsignedInt, UnsignedInt>> &connected,
+    const std::size_t particleCount) {
+  m_triangles.assign(triangles.begin(), triangles.end());
+
+  m_neighbourStart.assign(particleCount + 1, 0);
+  for (const auto &pair : connected) {
+    ++m_neighbourStart[pair.first + 1];
+    ++m_neighbourStart[pair.second + 1];
+  }
+
+  std::partial_sum(m_neighbourStart.begin(), m_neighbourStart.end(),
+                   m_neighbourStart.begin());
+  m_neighbours.resize(m_neighbourStart.back());
+
+  std::vector<UnsignedInt> cursor(m_neighbourStart.begin(),
+                                  m_neighbourStart.end() - 1);
+  for (const auto &pair : connected) {
+    m_neighbours[cursor[pair.first]++] = pair.second;
+    m_neighbours[cursor[pair.second]++] = pair.first;
+  }
+
+  for (std::size_t i = 0; i < particleCount; ++i)
+    std::sort(m_neighbours.begin() + m_neighbourStart[i],
+              m_neighbours.begin() + m_neighbourStart[i + 1]);
+
+  m_inverseMass.assign(particleCount, 1.0f);
+  m_meanEdgeLength = 0.0f;
+
+  m_continuous.setTopology(triangles, particleCount);
+}
+
+bool SelfCollision::isConnected(const UnsignedInt a,
+                                const UnsignedInt b) const {
+  return std::binary_search(m_neighbours.begin() + m_neighbourStart[a],
+                            m_neighbours.begin() + m_neighbourStart[a + 1], b);
+}
+
+void SelfCollision::resolve(ArrayView<const Vector3> previous,
+                            ArrayView<Vector3> positions,
+                            ArrayView<Vector3> velocities,
+                            const std::set<UnsignedInt> &pinned) {
+  if (!m_settings.enabled || positions.size() + 1 != m_neighbourStart.size())
+    return;
+
+  using namespace std::chrono;
+  const auto start{steady_clock::now()};
+
+  findCandidates(positions);
+  const auto broadPhaseEnd{steady_clock::now()};
+
+  findContacts(previous, positions);
+  const auto narrowPhaseEnd{steady_clock::now()};
+
+  applyContacts(positions, velocities, pinned);
+  const auto responseEnd{steady_clock::now()};
+
+  if (m_settings.continuous) {
+    m_statistics.impacts +=
+        m_continuous.resolve(previous, positions, velocities, m_inverseMass,
+                             m_settings.thickness);
+    m_statistics.continuousSeconds +=
+        duration<Double>(steady_clock::now() - responseEnd).count();
+  }
+
+  m_statistics.steps += 1;
+  m_statistics.broadPhaseSeconds +=
+      duration<Double>(broadPhaseEnd - start).count();
+  m_statistics.narrowPhaseSeconds +=
+      duration<Double>(narrowPhaseEnd - broadPhaseEnd).count();
+  m_statistics.responseSeconds +=
+      duration<Double>(responseEnd - narrowPhaseEnd).count();
+}
+
+void SelfCollision::findCandidates(ArrayView<const Vector3> positions) {
+  const auto n{positions.size()};
+  const auto triangleCount{m_triangles.size() / 3};
+  const Float h{m_settings.thickness};
+
+  if (m_meanEdgeLength == 0.0f && triangleCount > 0) {
+    Double sum{0.0};
+    for (std::size_t t = 0; t < triangleCount; ++t)
+      sum += Double((positions[m_triangles[3 * t + 1]] -
+                     positions[m_triangles[3 * t]])
+                        .length());
+    m_meanEdgeLength = Float(sum / Double(triangleCount));
+  }
+
+  const Float cellSize{m_settings.cellSize > 0.0f
+                           ? m_settings.cellSize
+                           : Math::max(2.0f * h, m_meanEdgeLength)};
+
+  m_particleHash.build(positions, positions, cellSize);
+
+  m_boxMin.resize(triangleCount);
+  m_boxMax.resize(triangleCount);
+
+  parallelFor(TaskStage::Collision, triangleCount, 0, [&](const std::size_t t) {
+    const auto &a{positions[m_triangles[3 * t]]};
+    const auto &b{positions[m_triangles[3 * t + 1]]};
+    const auto &c{positions[m_triangles[3 * t + 2]]};
+    m_boxMin[t] = Math::min(Math::min(a, b), c);
+    m_boxMax[t] = Math::max(Math::max(a, b), c);
+  });
+
+  m_triangleHash.build(m_boxMin, m_boxMax, cellSize);
+
+  const auto chunks{chunkCount(n)};
+  m_candidates.resize(chunks);
+
+  parallelFor(TaskStage::Collision, chunks, 1, [&](const std::size_t chunk) {
+    auto &candidates{m_candidates[chunk]};
+    candidates.clear();
+
+    std::vector<UnsignedInt> found;
+    for (auto i = chunkBegin(chunk, chunks, n);
+         i < chunkBegin(chunk + 1, chunks, n); ++i) {
+      const Vector3 min{positions[i] - Vector3{h}};
+      const Vector3 max{positions[i] + Vector3{h}};
+
+      // Particle pairs are reported by the lower index
+      found.clear();
+      m_particleHash.query(min, max, [&](const UnsignedInt j) {
+        if (j > i)
+          found.push_back(j);
+      });
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+
+      for (const auto j : found)
+        candidates.emplace_back(UnsignedInt(i), j);
+
+      found.clear();
+      m_triangleHash.query(min, max, [&](const UnsignedInt t) {
+        const auto *const triangle{&m_triangles[3 * t]};
+        if (triangle[0] != i && triangle[1] != i && triangle[2] != i)
+          found.push_back(t);
+      });
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+
+      for (const auto t : found)
+        candidates.emplace_back(UnsignedInt(i), UnsignedInt(n) + t);
+    }
+  });
+}
+
+void SelfCollision::findContacts(ArrayView<const Vector3> previous,
+                                 ArrayView<const Vector3> positions) {
+  const auto n{UnsignedInt(positions.size())};
+  const Float h{m_settings.thickness};
+  const auto chunks{m_candidates.size()};
+  m_contacts.resize(chunks);
+
+  parallelFor(TaskStage::Collision, chunks, 1, [&](const std::size_t chunk) {
+    auto &contacts{m_contacts[chunk]};
+    contacts.clear();
+
+    for (const auto &[i, other] : m_candidates[chunk]) {
+      const auto &p{positions[i]};
+
+      if (other < n) {
+        const Vector3 d{p - positions[other]};
+        const Float distance{d.length()};
+
+        if (distance < h && distance > 0.0f && !isConnected(i, other))
+          contacts.push_back(
+              Contact{i, other, d / distance, Vector3{}, h - distance});
+
+        continue;
+      }
+
+      const auto *const t{&m_triangles[3 * (other - n)]};
+      const auto &a{positions[t[0]]};
+      const auto &b{positions[t[1]]};
+      const auto &c{positions[t[2]]};
+      const auto weights{closestPointWeights(p, a, b, c)};
+      const Vector3 closest{weights[0] * a + weights[1] * b + weights[2] * c};
+
+      if ((p - closest).dot() >= h * h)
+        continue;
+
+      const Vector3 normal{Math::cross(b - a, c - a)};
+      const Float area{normal.length()};
+      if (area == 0.0f)
+        continue;
+
+      // Keep the particle on the side of the triangle it came from
+      const Vector3 previousNormal{Math::cross(previous[t[1]] - previous[t[0]],
+                                               previous[t[2]] - previous[t[0]])};
+      const Float side{Math::dot(previous[i] - previous[t[0]], previousNormal)};
+      const Vector3 contactNormal{(side < 0.0f ? -normal : normal) / area};
+
+      contacts.push_back(Contact{i, other, contactNormal, weights,
+                                 h - Math::dot(p - closest, contactNormal)});
+    }
+  });
+}
+
+void SelfCollision::applyContacts(ArrayView<Vector3> positions,
+                                  ArrayView<Vector3> velocities,
+                                  const std::set<UnsignedInt> &pinned) {
+  const auto n{UnsignedInt(positions.size())};
+
+  std::fill(m_inverseMass.begin(), m_inverseMass.end(), 1.0f);
+  for (const auto id : pinned) {
+    if (id < n)
+      m_inverseMass[id] = 0.0f;
+  }
+
+  std::size_t candidates{0};
+  std::size_t contactCount{0};
+
+  for (std::size_t chunk = 0; chunk < m_contacts.size(); ++chunk) {
+    candidates += m_candidates[chunk].size();
+    contactCount += m_contacts[chunk].size();
+
+    for (const auto &contact : m_contacts[chunk]) {
+      const auto i{contact.particle};
+
+      // Moves the particle along the normal and the others against it
+      // until the penetration depth is resolved
+      UnsignedInt others[3];
+      Float weights[3];
+      std::size_t otherCount;
+
+      if (contact.other < n) {
+        others[0] = contact.other;
+        weights[0] = 1.0f;
+        otherCount = 1;
+      } else {
+        const auto *const t{&m_triangles[3 * (contact.other - n)]};
+        for (std::size_t k = 0; k < 3; ++k) {
+          others[k] = t[k];
+          weights[k] = contact.weights[k];
+        }
+        otherCount = 3;
+      }
+
+      Float denominator{m_inverseMass[i]};
+      Float relativeVelocity{Math::dot(velocities[i], contact.normal)};
+      for (std::size_t k = 0; k < otherCount; ++k) {
+        denominator += m_inverseMass[others[k]] * weights[k] * weights[k];
+        relativeVelocity -=
+            weights[k] * Math::dot(velocities[others[k]], contact.normal);
+      }
+
+      if (denominator == 0.0f)
+        continue;
+
+      const Vector3 correction{contact.normal * (contact.depth / denominator)};
+      const Vector3 impulse{
+          contact.normal *
+          (Math::min(relativeVelocity, 0.0f) / denominator)};
+
+      positions[i] += m_inverseMass[i] * correction;
+      velocities[i] -= m_inverseMass[i] * impulse;
+
+      for (std::size_t k = 0; k < otherCount; ++k) {
+        const Float w{m_inverseMass[others[k]] * weights[k]};
+        positions[others[k]] -= w * correction;
+        velocities[others[k]] += w * impulse;
+      }
+    }
+  }
+
+  m_statistics.candidates += candidates;
+  m_statistics.contacts += contactCount;
+}
+
+void ContinuousCollision::setTopology(ArrayView<const UnsignedInt> triangles,
+                                      const std::size_t particleCount) {
+  m_triangles.assign(triangles.begin(), triangles.end());
+  m_particleCount = particleCount;
+  m_bvhBuilt = false;
+
+  // Unique edges from the sorted triangle edges, each remembering its slot
+  const auto slots{m_triangles.size()};
+  std::vector<std::pair<std::pair<UnsignedInt, UnsignedInt>, UnsignedInt>>
+      sorted(slots);
+  for (std::size_t i = 0; i < slots; ++i) {
+    const auto a{m_triangles[i]};
+    const auto b{m_triangles[i - i % 3 + (i + 1) % 3]};
+    sorted[i] = {std::minmax(a, b), UnsignedInt(i)};
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  m_edges.clear();
+  m_triangleEdges.resize(slots);
+  for (std::size_t i = 0; i < slots; ++i) {
+    if (i == 0 || sorted[i].first != sorted[i - 1].first)
+      m_edges.push_back(sorted[i].first);
+
+    m_triangleEdges[sorted[i].second] = UnsignedInt(m_edges.size() - 1);
+  }
+}
+
+std::size_t ContinuousCollision::resolve(ArrayView<const Vector3> previous,
+                                         ArrayView<Vector3> positions,
+                                         ArrayView<Vector3> velocities,
+                                         ArrayView<const Float> inverseMass,
+                                         const Float thickness) {
+  constexpr std::size_t MaxIterations{8};
+
+  if (positions.size() != m_particleCount || m_triangles.empty())
+    return 0;
+
+  if (!m_bvhBuilt) {
+    m_bvh.build(previous, m_triangles);
+    m_bvhBuilt = true;
+  }
+
+  std::size_t impactCount{0};
+
+  for (std::size_t iteration = 0; iteration < MaxIterations; ++iteration) {
+    findImpacts(previous, positions, thickness);
+
+    std::size_t found{0};
+    for (const auto &impacts : m_impacts) {
+      found += impacts.size();
+
+      for (const auto &impact : impacts) {
+        Float denominator{0.0f};
+        Float distance{0.0f};
+        Float relativeVelocity{0.0f};
+        for (std::size_t k = 0; k < 4; ++k) {
+          const auto i{impact.particles[k]};
+          const Float w{impact.weights[k]};
+          denominator += inverseMass[i] * w * w;
+          distance += w * Math::dot(positions[i], impact.normal);
+          relativeVelocity += w * Math::dot(velocities[i], impact.normal);
+        }
+
+        if (denominator == 0.0f)
+          continue;
+
+        const Float correction{Math::max(impact.gap - distance, 0.0f) /
+                               denominator};
+        const Float impulse{Math::min(relativeVelocity, 0.0f) / denominator};
+
+        for (std::size_t k = 0; k < 4; ++k) {
+          const auto i{impact.particles[k]};
+          const Float w{inverseMass[i] * impact.weights[k]};
+          positions[i] += impact.normal * (w * correction);
+          velocities[i] -= impact.normal * (w * impulse);
+        }
+      }
+    }
+
+    if (iteration == 0)
+      impactCount = found;
+
+    if (found == 0)
+      return impactCount;
+  }
+
+  // Fail-safe: the previous positions are free of impacts, moving the
+  // particles involved back to them removes the motion that crosses
+  for (std::size_t iteration = 0; iteration < MaxIterations; ++iteration) {
+    findImpacts(previous, positions, thickness);
+
+    bool moved{false};
+    for (const auto &impacts : m_impacts) {
+      for (const auto &impact : impacts) {
+        for (const auto i : impact.particles) {
+          if (inverseMass[i] == 0.0f || positions[i] == previous[i])
+            continue;
+
+          positions[i] = previous[i];
+          velocities[i] = Vector3{0.0f};
+          moved = true;
+        }
+      }
+    }
+
+    if (!moved)
+      break;
+  }
+
+  return impactCount;
+}
+
+void ContinuousCollision::findImpacts(ArrayView<const Vector3> previous,
+                                      ArrayView<const Vector3> positions,
+                                      const Float thickness) {
+  const Float h{thickness};
+  const auto n{positions.size()};
+  const auto items{n + m_edges.size()};
+
+  m_bvh.refit(previous, positions);
+
+  const auto chunks{chunkCount(items)};
+  m_impacts.resize(chunks);
+
+  // Completes an impact from the weights and the normal at the time of
+  // contact. The normal is oriented along the separation at the start of
+  // the step, pairs that end far enough on that side are not impacts.
+  const auto addImpact{[&](std::vector<Impact> &impacts, Impact impact) {
+    Float start{0.0f};
+    Float end{0.0f};
+    for (std::size_t k = 0; k < 4; ++k) {
+      start += impact.weights[k] *
+               Math::dot(previous[impact.particles[k]], impact.normal);
+      end += impact.weights[k] *
+             Math::dot(positions[impact.particles[k]], impact.normal);
+    }
+
+    if (start < 0.0f) {
+      impact.normal = -impact.normal;
+      start = -start;
+      end = -end;
+    }
+
+    impact.gap = Math::max(Math::min(h, start), 0.1f * h);
+    if (end < 0.5f * impact.gap)
+      impacts.push_back(impact);
+  }};
+
+  const auto at{[&](const UnsignedInt i, const Float t) {
+    return previous[i] + (positions[i] - previous[i]) * t;
+  }};
+
+  parallelFor(TaskStage::Collision, chunks, 1, [&](const std::size_t chunk) {
+    auto &impacts{m_impacts[chunk]};
+    impacts.clear();
+
+    std::vector<UnsignedInt> found;
+    for (auto item = chunkBegin(chunk, chunks, items);
+         item < chunkBegin(chunk + 1, chunks, items); ++item) {
+      if (item < n) {
+        // Vertex against the triangles it does not belong to
+        const auto i{UnsignedInt(item)};
+        const Vector3 min{Math::min(previous[i], positions[i]) - Vector3{h}};
+        const Vector3 max{Math::max(previous[i], positions[i]) + Vector3{h}};
+
+        m_bvh.overlap(min, max, [&](const UnsignedInt t) {
+          const auto *const v{&m_triangles[3 * t]};
+          const UnsignedInt corners[]{v[0], v[1], v[2]};
+          if (v[0] == i || v[1] == i || v[2] == i ||
+              !sweptBoxOverlaps(previous, positions, corners, min, max))
+            return;
+
+          Float times[3];
+          const auto count{coplanarityTimes(
+              previous[v[1]] - previous[v[0]], positions[v[1]] - positions[v[0]],
+              previous[v[2]] - previous[v[0]], positions[v[2]] - positions[v[0]],
+              previous[i] - previous[v[0]], positions[i] - positions[v[0]],
+              times)};
+
+          for (std::size_t r = 0; r < count; ++r) {
+            const Vector3 p{at(i, times[r])};
+            const Vector3 a{at(v[0], times[r])};
+            const Vector3 b{at(v[1], times[r])};
+            const Vector3 c{at(v[2], times[r])};
+            const auto w{closestPointWeights(p, a, b, c)};
+            const Vector3 d{p - (w[0] * a + w[1] * b + w[2] * c)};
+
+            if (d.dot() >= h * h)
+              continue;
+
+            Vector3 normal{Math::cross(b - a, c - a)};
+            if (normal.dot() == 0.0f)
+              normal = d;
+            if (normal.dot() == 0.0f)
+              continue;
+
+            addImpact(impacts, Impact{{i, v[0], v[1], v[2]},
+                                      {1.0f, -w[0], -w[1], -w[2]},
+                                      normal.normalized(),
+                                      0.0f});
+            break;
+          }
+        });
+
+        continue;
+      }
+
+      // Edge against the edges of nearby triangles with a higher index
+      const auto e{UnsignedInt(item - n)};
+      const auto [a0, a1]{m_edges[e]};
+      const Vector3 min{Math::min(Math::min(previous[a0], positions[a0]),
+                                  Math::min(previous[a1], positions[a1])) -
+                        Vector3{h}};
+      const Vector3 max{Math::max(Math::max(previous[a0], positions[a0]),
+                                  Math::max(previous[a1], positions[a1])) +
+                        Vector3{h}};
+
+      found.clear();
+      m_bvh.overlap(min, max, [&](const UnsignedInt t) {
+        for (std::size_t k = 0; k < 3; ++k) {
+          const auto other{m_triangleEdges[3 * t + k]};
+          const auto [b0, b1]{m_edges[other]};
+          const UnsignedInt ends[]{b0, b1};
+          if (other > e && b0 != a0 && b0 != a1 && b1 != a0 && b1 != a1 &&
+              sweptBoxOverlaps(previous, positions, ends, min, max))
+            found.push_back(other);
+        }
+      });
+      std::sort(found.begin(), found.end());
+      found.erase(std::unique(found.begin(), found.end()), found.end());
+
+      for (const auto other : found) {
+        const auto [b0, b1]{m_edges[other]};
+
+        Float times[3];
+        const auto count{coplanarityTimes(
+            previous[a1] - previous[a0], positions[a1] - positions[a0],
+            previous[b1] - previous[b0], positions[b1] - positions[b0],
+            previous[b0] - previous[a0], positions[b0] - positions[a0],
+            times)};
+
+        for (std::size_t r = 0; r < count; ++r) {
+          const Vector3 p1{at(a0, times[r])};
+          const Vector3 q1{at(a1, times[r])};
+          const Vector3 p2{at(b0, times[r])};
+          const Vector3 q2{at(b1, times[r])};
+
+          Float s, u;
+          closestSegmentParameters(p1, q1, p2, q2, s, u);
+          const Vector3 d{p1 + (q1 - p1) * s - p2 - (q2 - p2) * u};
+
+          if (d.dot() >= h * h)
+            continue;
+
+          // Nearly parallel edges use the direction between them
+          Vector3 normal{Math::cross(q1 - p1, q2 - p2)};
+          if (normal.dot() <= 1e-6f * (q1 - p1).dot() * (q2 - p2).dot())
+            normal = d;
+          if (normal.dot() == 0.0f)
+            continue;
+
+          addImpact(impacts, Impact{{a0, a1, b0, b1},
+                                    {1.0f - s, s, u - 1.0f, -u},
+                                    normal.normalized(),
+                                    0.0f});
+          break;
+        }
+      }
+    }
+  });
+}
+
+const CollisionStatistics &SelfCollision::getStatistics() const {
+  return m_statistics;
+}
+
+void SelfCollision::resetStatistics() { m_statistics = {}; }
+} // namespace clothsim
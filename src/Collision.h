@@ -0,0 +1,206 @@
+#ifndef CLOTHSIM_COLLISION_H
+#define CLOTHSIM_COLLISION_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Functions.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "BVH.h"
+
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Closest point of a triangle to p as barycentric weights of its corners
+Vector3 closestPointWeights(const Vector3 &p, const Vector3 &a,
+                            const Vector3 &b, const Vector3 &c);
+
+// Uniform grid over an unbounded domain, cells are hashed into a fixed
+// size table. Rebuilt from scratch with a counting sort over the bucket
+// of every cell an item overlaps.
+class SpatialHash {
+public:
+  void build(Corrade::Containers::ArrayView<const Vector3> boxMin,
+             Corrade::Containers::ArrayView<const Vector3> boxMax,
+             const Float cellSize);
+
+  // Calls f(item) for every item in the buckets of the cells overlapping the
+  // box. Items can be reported more than once and hash collisions report
+  // items that are not near the box.
+  template <typename F>
+  void query(const Vector3 &min, const Vector3 &max, F &&f) const {
+    if (m_items.empty())
+      return;
+
+    const auto lo{cell(min)};
+    const auto hi{cell(max)};
+
+    for (Int z = lo.z(); z <= hi.z(); ++z) {
+      for (Int y = lo.y(); y <= hi.y(); ++y) {
+        for (Int x = lo.x(); x <= hi.x(); ++x) {
+          const auto b{bucket(Vector3i{x, y, z})};
+
+          for (auto i = m_bucketStart[b]; i < m_bucketStart[b + 1]; ++i)
+            f(m_items[i]);
+        }
+      }
+    }
+  }
+
+private:
+  Vector3i cell(const Vector3 &p) const {
+    return Vector3i{Math::floor(p / m_cellSize)};
+  }
+
+  std::size_t bucket(const Vector3i &c) const {
+    return ((UnsignedInt(c.x()) * 73856093u) ^ (UnsignedInt(c.y()) * 19349663u) ^
+            (UnsignedInt(c.z()) * 83492791u)) &
+           (m_bucketStart.size() - 2);
+  }
+
+  Float m_cellSize{1.0f};
+  std::vector<UnsignedInt> m_itemCells;
+  std::vector<UnsignedInt> m_entries;
+  std::vector<UnsignedInt> m_bucketStart;
+  std::vector<UnsignedInt> m_items;
+};
+
+struct SelfCollisionSettings {
+  bool enabled{false};
+  // Minimal distance kept between particles and triangles
+  Float thickness{0.01f};
+  // 0 picks the larger of twice the thickness and the mean edge length
+  Float cellSize{0.0f};
+  // Also checks the motion during the step for crossings of particles
+  // through triangles and of edges through edges
+  bool continuous{false};
+};
+
+struct CollisionStatistics {
+  std::size_t steps{0};
+  std::size_t candidates{0};
+  std::size_t contacts{0};
+  Double broadPhaseSeconds{0.0};
+  Double narrowPhaseSeconds{0.0};
+  Double responseSeconds{0.0};
+  std::size_t impacts{0};
+  Double continuousSeconds{0.0};
+};
+
+// Continuous collision detection for the vertex-triangle and edge-edge
+// pairs of a triangle mesh. The times of coplanarity are the roots of a
+// cubic in the step parameter, a pair closer than the thickness at such a
+// time is an impact. The triangle hierarchy is built once and refit to the
+// swept boxes of each step.
+class ContinuousCollision {
+public:
+  void setTopology(Corrade::Containers::ArrayView<const UnsignedInt> triangles,
+                   const std::size_t particleCount);
+
+  // Iteratively separates the impacting pairs at the end of the step. If
+  // impacts remain, the particles involved are moved back to their
+  // previous positions and stopped. Returns the number of impacts found.
+  std::size_t resolve(Corrade::Containers::ArrayView<const Vector3> previous,
+                      Corrade::Containers::ArrayView<Vector3> positions,
+                      Corrade::Containers::ArrayView<Vector3> velocities,
+                      Corrade::Containers::ArrayView<const Float> inverseMass,
+                      const Float thickness);
+
+private:
+  // Both kinds of impacts as a weighted sum of four particles whose
+  // distance along the normal has to stay positive
+  struct Impact {
+    UnsignedInt particles[4];
+    Float weights[4];
+    Vector3 normal;
+    Float gap;
+  };
+
+  void findImpacts(Corrade::Containers::ArrayView<const Vector3> previous,
+                   Corrade::Containers::ArrayView<const Vector3> positions,
+                   const Float thickness);
+
+  std::vector<UnsignedInt> m_triangles;
+  std::vector<std::pair<UnsignedInt, UnsignedInt>> m_edges;
+  std::vector<UnsignedInt> m_triangleEdges;
+  std::size_t m_particleCount{0};
+
+  TriangleBVH m_bvh;
+  bool m_bvhBuilt{false};
+
+  std::vector<std::vector<Impact>> m_impacts;
+};
+
+// Keeps particles of a triangle mesh apart from each other and from the
+// triangles they do not belong to. Contacts are found on the positions at
+// the end of a step and resolved by moving the particles apart and
+// removing their approaching velocity.
+class SelfCollision {
+public:
+  void setSettings(const SelfCollisionSettings &settings);
+  const SelfCollisionSettings &getSettings() const;
+
+  // Particles connected by one of the pairs never collide with each other
+  void setTopology(
+      Corrade::Containers::ArrayView<const UnsignedInt> triangles,
+      const std::vector<std::pair<UnsignedInt, UnsignedInt>> &connected,
+      const std::size_t particleCount);
+
+  void resolve(Corrade::Containers::ArrayView<const Vector3> previous,
+               Corrade::Containers::ArrayView<Vector3> positions,
+               Corrade::Containers::ArrayView<Vector3> velocities,
+               const std::set<UnsignedInt> &pinned);
+
+  // Accumulated since the last reset
+  const CollisionStatistics &getStatistics() const;
+  void resetStatistics();
+
+private:
+  struct Contact {
+    // The second particle for particle contacts, triangle + particle
+    // count for triangle contacts
+    UnsignedInt particle;
+    UnsignedInt other;
+    Vector3 normal;
+    Vector3 weights;
+    Float depth;
+  };
+
+  bool isConnected(const UnsignedInt a, const UnsignedInt b) const;
+
+  void findCandidates(Corrade::Containers::ArrayView<const Vector3> positions);
+  void findContacts(Corrade::Containers::ArrayView<const Vector3> previous,
+                    Corrade::Containers::ArrayView<const Vector3> positions);
+  void applyContacts(Corrade::Containers::ArrayView<Vector3> positions,
+                     Corrade::Containers::ArrayView<Vector3> velocities,
+                     const std::set<UnsignedInt> &pinned);
+
+  SelfCollisionSettings m_settings;
+  Float m_meanEdgeLength{0.0f};
+
+  std::vector<UnsignedInt> m_triangles;
+  std::vector<UnsignedInt> m_neighbourStart;
+  std::vector<UnsignedInt> m_neighbours;
+
+  SpatialHash m_particleHash;
+  SpatialHash m_triangleHash;
+  std::vector<Vector3> m_boxMin, m_boxMax;
+
+  // Per chunk of particles so that the phases run in parallel and still
+  // produce the contacts in a fixed order
+  std::vector<std::vector<std::pair<UnsignedInt, UnsignedInt>>> m_candidates;
+  std::vector<std::vector<Contact>> m_contacts;
+  std::vector<Float> m_inverseMass;
+
+  ContinuousCollision m_continuous;
+
+  CollisionStatistics m_statistics;
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_COLLISION_H
@@ -1,7 +1,5 @@
 #include "Drawable.h"
 
-#include <Magnum/MeshTools/Duplicate.h>
-#include <Magnum/MeshTools/GenerateFlatNormals.h>
 #include <Magnum/MeshTools/Interleave.h>
 #include <Magnum/MeshTools/Transform.h>
 
@@ -21,26 +19,34 @@ Drawable::Drawable(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
   initVertexMarkers();
 }
 
-void Drawable::initMesh() {
-  const Corrade::Containers::Array<Vector3> verticesExpanded{
-      Magnum::MeshTools::duplicate<UnsignedInt, Vector3>(getMeshIndices(),
-                                                         getMeshVertices())};
+void Drawable::initMeshLayout(const std::size_t indexCount) {
+  m_meshIndexCount = indexCount;
+  m_triangleData = Corrade::Containers::Array<Vector3>{
+      Corrade::Containers::NoInit, indexCount * 2};
 
-  const Corrade::Containers::Array<Vector3> normals{
-      Magnum::MeshTools::generateFlatNormals(verticesExpanded)};
-
-  std::vector<Vector3> colors(getMeshIndices().size(), Vector3{1.f, 1.f, 1.f});
-
-  m_triangleBuffer.setData(
-      Magnum::MeshTools::interleave(verticesExpanded, normals),
-      Magnum::GL::BufferUsage::StaticDraw);
+  const Corrade::Containers::Array<Vector3> colors{
+      Corrade::Containers::DirectInit, indexCount, Vector3{1.f, 1.f, 1.f}};
   m_colorBuffer.setData(colors, Magnum::GL::BufferUsage::StaticDraw);
 
+  m_triangles = Magnum::GL::Mesh{};
   m_triangles.setPrimitive(Magnum::GL::MeshPrimitive::Triangles)
       .addVertexBuffer(m_triangleBuffer, 0, PhongIdShader::Position{},
                        PhongIdShader::Normal{})
       .addVertexBuffer(m_colorBuffer, 0, PhongIdShader::VertexColor{})
-      .setCount(static_cast<Int>(getMeshIndices().size()));
+      .setCount(static_cast<Int>(indexCount));
+}
+
+void Drawable::updateMesh() {
+  const auto indices{getMeshIndices()};
+  const auto vertices{getMeshVertices()};
+
+  if (m_meshIndexCount != indices.size())
+    initMeshLayout(indices.size());
+
+  interleaveFlatTriangles(indices, vertices, m_triangleData);
+
+  m_triangleBuffer.setData(m_triangleData,
+                           Magnum::GL::BufferUsage::DynamicDraw);
 }
 
 void Drawable::initVertexMarkers() {
@@ -86,7 +92,8 @@ void Drawable::draw(const Matrix4 &viewProjection,
 
 void Drawable::drawVertexMarkers(const Matrix4 &viewProjection,
                                  const Magnum::SceneGraph::Camera3D &camera) {
-  const Corrade::Containers::Array<Magnum::Vector3> vertices{getMeshVertices()};
+  const auto vertices{getMeshVertices()};
+  const auto colors{getVertexMarkerColors()};
 
   for (UnsignedInt i{0}; i < vertices.size(); ++i) {
     m_vertexShader
@@ -98,8 +105,7 @@ void Drawable::drawVertexMarkers(const Matrix4 &viewProjection,
         .setProjectionMatrix(camera.projectionMatrix())
         .setLightPosition({13.0f, 2.0f, 5.0f});
 
-    const Color3 color{getVertexMarkerColors()[i]};
-    m_vertexShader.setColor(color);
+    m_vertexShader.setColor(colors[i]);
 
     m_vertexShader.setObjectId(static_cast<Int>(i));
 
@@ -109,7 +115,7 @@ void Drawable::drawVertexMarkers(const Matrix4 &viewProjection,
 
 void Drawable::drawMesh(const Matrix4 &viewProjection,
                         const Magnum::SceneGraph::Camera3D &camera) {
-  initMesh();
+  updateMesh();
 
   Magnum::GL::Renderer::disable(Magnum::GL::Renderer::Feature::DepthTest);
   Magnum::GL::Renderer::disable(Magnum::GL::Renderer::Feature::FaceCulling);
@@ -124,4 +130,29 @@ void Drawable::drawMesh(const Matrix4 &viewProjection,
 
   Magnum::GL::Renderer::enable(Magnum::GL::Renderer::Feature::DepthTest);
 }
+
+SnapshotDrawable::SnapshotDrawable(
+    const SnapshotChannel<SimulationSnapshot> &snapshots,
+    PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
+    Object3D &parent, Magnum::SceneGraph::DrawableGroup3D &drawables)
+    : Drawable(phongShader, vertexShader, parent, drawables),
+      m_snapshots{snapshots} {}
+
+Corrade::Containers::ArrayView<const UnsignedInt>
+SnapshotDrawable::getMeshIndices() const {
+  const auto &indices{m_snapshots.read().indices};
+  return {indices.data(), indices.size()};
+}
+
+Corrade::Containers::ArrayView<const Magnum::Vector3>
+SnapshotDrawable::getMeshVertices() const {
+  const auto &vertices{m_snapshots.read().vertices};
+  return {vertices.data(), vertices.size()};
+}
+
+Corrade::Containers::ArrayView<const Magnum::Color3>
+SnapshotDrawable::getVertexMarkerColors() {
+  const auto &colors{m_snapshots.read().markerColors};
+  return {colors.data(), colors.size()};
+}
 } // namespace clothsim
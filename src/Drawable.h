@@ -2,6 +2,7 @@
 #define CLOTHSIM_DRAWABLE_H
 
 #include <Corrade/Containers/Array.h>
+#include <Corrade/Containers/ArrayView.h>
 
 #include <Magnum/SceneGraph/Camera.h>
 #include <Magnum/SceneGraph/Drawable.h>
@@ -10,7 +11,11 @@
 #include <Magnum/GL/Mesh.h>
 #include <Magnum/GL/Buffer.h>
 
+#include <Magnum/Math/Color.h>
+
+#include "Channel.h"
 #include "Shaders.h"
+#include "Snapshot.h"
 #include "Util.h"
 
 namespace clothsim {
@@ -22,10 +27,12 @@ public:
   Drawable(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
            Object3D &parent, Magnum::SceneGraph::DrawableGroup3D &drawables);
 
-  virtual Corrade::Containers::Array<UnsignedInt> getMeshIndices() const = 0;
-  virtual Corrade::Containers::Array<Magnum::Vector3>
+  // Views are valid until the next modification of the underlying object
+  virtual Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const = 0;
+  virtual Corrade::Containers::ArrayView<const Magnum::Vector3>
   getMeshVertices() const = 0;
-  virtual const Corrade::Containers::Array<Magnum::Color3>&
+  virtual Corrade::Containers::ArrayView<const Magnum::Color3>
   getVertexMarkerColors() = 0;
 
   void drawVertexMarkers(bool);
@@ -39,8 +46,8 @@ private:
                          const Magnum::SceneGraph::Camera3D &camera);
 
   void initVertexMarkers();
-  void initVertexMarkerColors();
-  void initMesh();
+  void initMeshLayout(const std::size_t indexCount);
+  void updateMesh();
 
   bool m_drawVertexMarkers;
 
@@ -50,10 +57,36 @@ private:
   Magnum::GL::Buffer m_triangleBuffer, m_indexBuffer, m_colorBuffer;
   Magnum::GL::Mesh m_triangles;
 
+  // Interleaved position and flat normal for every triangle corner. Kept
+  // between frames so that updating the mesh does not allocate.
+  Corrade::Containers::Array<Magnum::Vector3> m_triangleData;
+  std::size_t m_meshIndexCount{~std::size_t{}};
+
   Magnum::GL::Buffer m_vertexMarkerVertexBuffer;
   Magnum::GL::Buffer m_vertexMarkerIndexBuffer;
   Magnum::GL::Mesh m_vertexMarkerMesh;
 };
+
+// Draws the latest snapshot the reader side of the channel switched to, so
+// that drawing never touches the system. The channel must outlive the
+// drawable.
+class SnapshotDrawable : public Drawable {
+public:
+  SnapshotDrawable(const SnapshotChannel<SimulationSnapshot> &snapshots,
+                   PhongIdShader &phongShader,
+                   VertexMarkerShader &vertexShader, Object3D &parent,
+                   Magnum::SceneGraph::DrawableGroup3D &drawables);
+
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const override;
+  Corrade::Containers::ArrayView<const Magnum::Vector3>
+  getMeshVertices() const override;
+  Corrade::Containers::ArrayView<const Magnum::Color3>
+  getVertexMarkerColors() override;
+
+private:
+  const SnapshotChannel<SimulationSnapshot> &m_snapshots;
+};
 } // namespace clothsim
 
 #endif // CLOTHSIM_DRAWABLE_H
@@ -1,90 +1,164 @@
 #include "Integrators.h"
+#include "Solver.h"
 
+#include <cmath>
 #include <iostream>
+#include <iterator>
 #include <numeric>
+#include <stdexcept>
 #include <unordered_set>
 
 namespace clothsim {
-void backwardMidpointStep(System &system, const Float dt) {
-  const System::Vector xInitial{system.getState()};
-
-  // Initial guess using forward Euler
-  System::Vector x{xInitial + dt * system.evalDerivative(xInitial)};
-
-  System::Vector dx{xInitial.size()};
-  dx.setOnes();
-
-  // Newton's method
-  for (int i = 0; i < 10 && dx.norm() > 1e-12f; ++i) {
-    const System::SparseMatrix dfdx{system.evalJacobian(0.5f * (x + xInitial))};
-    const System::Vector dxdt{system.evalDerivative(0.5f * (x + xInitial))};
-
-    System::SparseMatrix J{dfdx.rows(), dfdx.cols()};
-    {
-      J.setIdentity();
-      J = J - dt * dfdx * 0.5f * J;
+namespace {
+constexpr Float StallContraction{0.9f};
+
+// Solves x = x0 + dt f(x0 + theta (x - x0)) for x, starting from the guess
+// in x. The Jacobian of the residual is I - theta dt df/dx.
+void newtonSolve(System &system, const System::Vector &x0, System::Vector &x,
+                 const Float dt, const Float theta,
+                 const NewtonPolicy &policy) {
+  auto &solver{system.getSolver()};
+  const Float h{theta * dt};
+
+  const auto evalPoint{[&](const System::Vector &y) -> System::Vector {
+    if (theta == 1.0f)
+      return y;
+    return x0 + theta * (y - x0);
+  }};
+  const auto residual{[&](const System::Vector &y) -> System::Vector {
+    return y - x0 - dt * system.evalDerivative(evalPoint(y));
+  }};
+
+  System::Vector r{residual(x)};
+  Float norm{r.norm()};
+  const Float initialNorm{norm};
+  // Relative to the predicted change over the step rather than to the
+  // initial residual, so that better predictions take fewer iterations
+  const Float tolerance{Math::max(policy.absoluteTolerance,
+                                  policy.relativeTolerance * (x - x0).norm())};
+
+  std::size_t iterations{0};
+  std::size_t backtracks{0};
+
+  while (iterations < policy.maxIterations && norm > tolerance) {
+    // Whether the Jacobian was evaluated at the current x
+    bool fresh{false};
+    if (!policy.reuseJacobian || !solver.isFactorizationValid(system, h)) {
+      solver.factorize(system, system.evalJacobian(evalPoint(x)), h);
+      fresh = true;
     }
 
-    const System::Vector b{-(x - xInitial - dt * dxdt)};
+    const System::Vector dx{solver.solveFactorized(-r)};
+    ++iterations;
+
+    Float alpha{1.0f};
+    System::Vector next{x + dx};
+    System::Vector nextR{residual(next)};
+    Float nextNorm{nextR.norm()};
+
+    for (UnsignedInt k = 0;
+         policy.lineSearch && k < policy.maxBacktracks && !(nextNorm < norm);
+         ++k) {
+      alpha *= 0.5f;
+      next = x + alpha * dx;
+      nextR = residual(next);
+      nextNorm = nextR.norm();
+      ++backtracks;
+    }
 
-    Eigen::SparseLU<System::SparseMatrix> solver;
-    solver.compute(J);
+    if (policy.reuseJacobian && !(nextNorm <= policy.maxContraction * norm)) {
+      solver.invalidateFactorization();
 
-    if (solver.info() != Eigen::Success) {
-      throw std::runtime_error("Solver failed");
+      // An old Jacobian may point the wrong way, retry with a new one
+      if (!fresh && !(nextNorm < norm))
+        continue;
     }
 
-    dx = solver.solve(b);
+    // With a new Jacobian the residual shrinks quickly until it is down to
+    // rounding errors, which further iterations cannot remove
+    const bool stalled{fresh && !(nextNorm <= StallContraction * norm)};
 
-    if (solver.info() != Eigen::Success) {
-      throw std::runtime_error("Solver failed");
+    if (!stalled || nextNorm < norm) {
+      x = std::move(next);
+      r = std::move(nextR);
+      norm = nextNorm;
     }
 
-    x += dx;
+    if (stalled)
+      break;
   }
 
-  system.setState(std::move(x));
+  solver.recordNewtonStep(iterations, backtracks, initialNorm, norm);
 }
 
-void backwardEulerStep(System &system, const Float dt) {
-  const System::Vector xInitial{system.getState()};
+bool isHistoryValid(const System::StepHistory &history,
+                    const System::Vector &x0) {
+  return history.count > 0 && history.states[0].size() == x0.size() &&
+         history.states[0] == x0;
+}
 
-  // Initial guess using forward Euler
-  System::Vector x{xInitial + dt * system.evalDerivative(xInitial)};
+// Extrapolates the recorded states to the end of the step
+System::Vector predict(System &system, const System::Vector &x0,
+                       const Float dt, const NewtonPredictor predictor) {
+  const auto &history{system.getStepHistory()};
+  const std::size_t count{isHistoryValid(history, x0) ? history.count : 0};
+
+  if (predictor == NewtonPredictor::Quadratic && count >= 3) {
+    // Lagrange polynomial through the times 0, t1 and t2
+    const Float t1{-history.steps[0]};
+    const Float t2{t1 - history.steps[1]};
+    const Float l0{(dt - t1) * (dt - t2) / (t1 * t2)};
+    const Float l1{dt * (dt - t2) / (t1 * (t1 - t2))};
+    const Float l2{dt * (dt - t1) / (t2 * (t2 - t1))};
+    return l0 * x0 + l1 * history.states[1] + l2 * history.states[2];
+  }
 
-  System::Vector dx{xInitial.size()};
-  dx.setOnes();
+  if (predictor != NewtonPredictor::ForwardEuler && count >= 2)
+    return x0 + (dt / history.steps[0]) * (x0 - history.states[1]);
 
-  // Newton's method
-  for (int i = 0; i < 10 && dx.norm() > 1e-12f; ++i) {
-    const System::SparseMatrix dfdx{system.evalJacobian(x)};
-    const System::Vector dxdt{system.evalDerivative(x)};
+  return x0 + dt * system.evalDerivative(x0);
+}
 
-    System::SparseMatrix J{dfdx.rows(), dfdx.cols()};
-    {
-      J.setIdentity();
-      J = J - dt * dfdx;
-    }
+void recordStep(System &system, const System::Vector &x0, const Float dt) {
+  auto &history{system.getStepHistory()};
+  if (!isHistoryValid(history, x0)) {
+    history.states[0] = x0;
+    history.count = 1;
+  }
 
-    const System::Vector b{-(x - xInitial - dt * dxdt)};
+  history.states[2] = std::move(history.states[1]);
+  history.states[1] = std::move(history.states[0]);
+  history.states[0] = system.getState();
+  history.steps[1] = history.steps[0];
+  history.steps[0] = dt;
+  history.count = Math::min<std::size_t>(history.count + 1, 3);
+}
+} // namespace
 
-    Eigen::SparseLU<System::SparseMatrix> solver;
-    solver.compute(J);
+void backwardMidpointStep(System &system, const Float dt,
+                          const NewtonPolicy &policy) {
+  const System::Vector xInitial{system.getState()};
 
-    if (solver.info() != Eigen::Success) {
-      throw std::runtime_error("Solver failed");
-    }
+  System::Vector x{predict(system, xInitial, dt, policy.predictor)};
 
-    dx = solver.solve(b);
+  newtonSolve(system, xInitial, x, dt, 0.5f, policy);
 
-    if (solver.info() != Eigen::Success) {
-      throw std::runtime_error("Solver failed");
-    }
+  system.resolveCollisions(xInitial, x, dt);
+  system.setState(std::move(x));
+  recordStep(system, xInitial, dt);
+}
 
-    x += dx;
-  }
+void backwardEulerStep(System &system, const Float dt,
+                       const NewtonPolicy &policy) {
+  const System::Vector xInitial{system.getState()};
+
+  System::Vector x{predict(system, xInitial, dt, policy.predictor)};
+
+  newtonSolve(system, xInitial, x, dt, 1.0f, policy);
 
+  system.resolveCollisions(xInitial, x, dt);
   system.setState(std::move(x));
+  recordStep(system, xInitial, dt);
 }
 
 void forwardEulerStep(System &system, const Float dt) {
@@ -92,6 +166,7 @@ void forwardEulerStep(System &system, const Float dt) {
   const auto dxdt = system.evalDerivative(x0);
   System::Vector x1 = x0 + dt * dxdt;
 
+  system.resolveCollisions(x0, x1, dt);
   system.setState(std::move(x1));
 }
 
@@ -111,8 +186,161 @@ void rk4Step(System &system, const Float dt) {
 
   const auto k4{system.evalDerivative(xT)};
 
-  const System::Vector x1{x0 + dt / 6.0f * (k1 + 2.0f * k2 + 2.0f * k3 + k4)};
+  System::Vector x1{x0 + dt / 6.0f * (k1 + 2.0f * k2 + 2.0f * k3 + k4)};
 
+  system.resolveCollisions(x0, x1, dt);
   system.setState(std::move(x1));
 }
-} // namespace clothsim
\ No newline at end of file
+
+namespace {
+// Moves the positions along the velocities of the state. Pinned and sleeping
+// particles keep the positions of the start of the step.
+void drift(const System &system, const System::Vector &x0, System::Vector &x,
+           const Float h) {
+  const auto n{x.size() / 2};
+  x.head(n) += h * x.tail(n);
+
+  for (const auto id : system.getPinnedParticleIds())
+    x.segment<3>(3 * id) = x0.segment<3>(3 * id);
+  for (const auto id : system.getSleepingParticleIds())
+    x.segment<3>(3 * id) = x0.segment<3>(3 * id);
+}
+
+// Changes the velocities by the accelerations in the derivative
+void kick(System::Vector &x, const System::Vector &dxdt, const Float h) {
+  const auto n{x.size() / 2};
+  x.tail(n) += h * dxdt.tail(n);
+}
+} // namespace
+
+void velocityVerletStep(System &system, const Float dt) {
+  if (!system.isSecondOrder()) {
+    rk4Step(system, dt);
+    return;
+  }
+
+  const auto &x0{system.getState()};
+
+  // The accelerations at the end of the previous step are the ones at the
+  // start of this one, unless the state was changed in between
+  auto &cache{system.getDerivativeCache()};
+  if (cache.state.size() != x0.size() || cache.state != x0)
+    cache.derivative = system.evalDerivative(x0);
+
+  System::Vector x1{x0};
+  kick(x1, cache.derivative, 0.5f * dt);
+  drift(system, x0, x1, dt);
+
+  System::Vector dxdt{system.evalDerivative(x1)};
+  kick(x1, dxdt, 0.5f * dt);
+
+  // Contacts and particles falling asleep change the state after the
+  // derivative was evaluated, which then belongs to no state at all
+  cache.state = x1;
+  system.resolveCollisions(x0, x1, dt);
+  const bool unchanged{cache.state.size() == x1.size() && cache.state == x1};
+
+  system.setState(std::move(x1));
+  if (unchanged) {
+    cache.state = system.getState();
+    cache.derivative = std::move(dxdt);
+  }
+}
+
+void leapfrogStep(System &system, const Float dt) {
+  if (!system.isSecondOrder()) {
+    rk4Step(system, dt);
+    return;
+  }
+
+  const auto &x0{system.getState()};
+
+  System::Vector x1{x0};
+  drift(system, x0, x1, 0.5f * dt);
+  kick(x1, system.evalDerivative(x1), dt);
+  drift(system, x0, x1, 0.5f * dt);
+
+  system.resolveCollisions(x0, x1, dt);
+  system.setState(std::move(x1));
+}
+
+void yoshidaStep(System &system, const Float dt) {
+  if (!system.isSecondOrder()) {
+    rk4Step(system, dt);
+    return;
+  }
+
+  // Three leapfrog steps, the middle one backwards in time, cancel each
+  // other's third order error
+  const Float cbrt2{std::cbrt(2.0f)};
+  const Float w1{1.0f / (2.0f - cbrt2)};
+  const Float w0{-cbrt2 / (2.0f - cbrt2)};
+  const Float c[]{0.5f * w1, 0.5f * (w0 + w1), 0.5f * (w0 + w1), 0.5f * w1};
+  const Float d[]{w1, w0, w1};
+
+  const auto &x0{system.getState()};
+
+  System::Vector x1{x0};
+  for (std::size_t i = 0; i < std::size(d); ++i) {
+    drift(system, x0, x1, c[i] * dt);
+    kick(x1, system.evalDerivative(x1), d[i] * dt);
+  }
+  drift(system, x0, x1, c[3] * dt);
+
+  system.resolveCollisions(x0, x1, dt);
+  system.setState(std::move(x1));
+}
+
+Integrator integratorByIndex(const std::size_t i,
+                             const NewtonPolicy &policy) {
+  switch (i) {
+  case 0:
+    return forwardEulerStep;
+  case 1:
+    return rk4Step;
+  case 2:
+    return [policy](System &system, const Float dt) {
+      backwardEulerStep(system, dt, policy);
+    };
+  case 3:
+    return [policy](System &system, const Float dt) {
+      backwardMidpointStep(system, dt, policy);
+    };
+  case 4:
+    return velocityVerletStep;
+  case 5:
+    return leapfrogStep;
+  case 6:
+    return yoshidaStep;
+  default:
+    return {};
+  }
+}
+
+bool isImplicitIntegrator(const std::size_t i) { return i == 2 || i == 3; }
+
+std::size_t integratorIndex(const std::string &name) {
+  const std::string names[]{"forwardEuler",     "rk4",
+                            "backwardEuler",    "backwardMidpoint",
+                            "velocityVerlet",   "leapfrog",
+                            "yoshida"};
+
+  for (std::size_t i = 0; i < std::size(names); ++i) {
+    if (names[i] == name)
+      return i;
+  }
+
+  throw std::runtime_error("Unknown integrator " + name);
+}
+
+NewtonPredictor newtonPredictor(const std::string &name) {
+  if (name == "forwardEuler")
+    return NewtonPredictor::ForwardEuler;
+  if (name == "linear")
+    return NewtonPredictor::Linear;
+  if (name == "quadratic")
+    return NewtonPredictor::Quadratic;
+
+  throw std::runtime_error("Unknown predictor " + name);
+}
+} // namespace clothsim
@@ -3,11 +3,73 @@
 
 #include "System.h"
 
+#include <functional>
+#include <string>
+
 namespace clothsim {
-void backwardMidpointStep(System &system, const Float dt);
+using Integrator = std::function<void(System &, const float)>;
+
+// Initial guesses for Newton's method. Until enough steps are recorded, for
+// example after a reset, they fall back to forward Euler.
+enum class NewtonPredictor : UnsignedInt {
+  ForwardEuler = 0,
+  // Continues the change of the state over the last step
+  Linear = 1,
+  // Quadratic in time through the states of the last two steps
+  Quadratic = 2
+};
+
+// How the implicit integrators solve their nonlinear equation for the end of
+// the step with Newton's method
+struct NewtonPolicy {
+  // Converged once the norm of the residual is at most the absolute
+  // tolerance or the relative tolerance times the norm of the predicted
+  // change of the state over the step
+  Float relativeTolerance{1e-3f};
+  Float absoluteTolerance{1e-6f};
+  UnsignedInt maxIterations{10};
+  // Chord method: the factorized Jacobian is kept across iterations and
+  // steps, and only evaluated again once an iteration shrinks the residual
+  // by less than the contraction factor
+  bool reuseJacobian{true};
+  Float maxContraction{0.5f};
+  // Halves the update while it does not shrink the residual
+  bool lineSearch{true};
+  UnsignedInt maxBacktracks{4};
+  NewtonPredictor predictor{NewtonPredictor::Quadratic};
+};
+
+void backwardMidpointStep(System &system, const Float dt,
+                          const NewtonPolicy &policy = {});
 void forwardEulerStep(System &system, const Float dt);
-void backwardEulerStep(System &system, const Float dt);
+void backwardEulerStep(System &system, const Float dt,
+                       const NewtonPolicy &policy = {});
 void rk4Step(System &system, const Float dt);
+
+// Symplectic integrators for second order systems, others are stepped with
+// RK4. They alternate drifts of the positions with kicks of the velocities
+// and keep the energy error bounded instead of letting it drift. Velocity
+// Verlet and leapfrog are second order and evaluate the derivative once per
+// step, Yoshida's method is fourth order with three evaluations. Velocity
+// dependent forces such as drag see the velocities of the last kick.
+void velocityVerletStep(System &system, const Float dt);
+void leapfrogStep(System &system, const Float dt);
+void yoshidaStep(System &system, const Float dt);
+
+constexpr std::size_t IntegratorCount{7};
+
+// Integrators in the order of the UI selection. Returns an empty function
+// for an invalid index. The policy applies to the implicit integrators.
+Integrator integratorByIndex(const std::size_t i,
+                             const NewtonPolicy &policy = {});
+// Whether the integrator solves with Newton's method
+bool isImplicitIntegrator(const std::size_t i);
+// Accepts the step function names without the "Step" suffix, throws
+// std::runtime_error for unknown names
+std::size_t integratorIndex(const std::string &name);
+// Accepts "forwardEuler", "linear" and "quadratic", throws
+// std::runtime_error for unknown names
+NewtonPredictor newtonPredictor(const std::string &name);
 } // namespace clothsim
 
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "Multigrid.h"
+#include "TaskPool.h"
+
+#include <Eigen/LU>
+
+#include <cmath>
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+constexpr UnsignedInt MinCoarseSize{8};
+constexpr std::size_t SmoothingSteps{2};
+
+// Dot product summed over ranges on the shared pool, reproducible across
+// thread counts in its deterministic mode
+Multigrid::ScalarT dot(const Multigrid::Vector &a,
+                       const Multigrid::Vector &b) {
+  return parallelSum<Multigrid::ScalarT>(
+      TaskStage::Solver, std::size_t(a.size()),
+      [&](const std::size_t begin, const std::size_t end) {
+        const auto size{Eigen::Index(end - begin)};
+        return a.segment(Eigen::Index(begin), size)
+            .dot(b.segment(Eigen::Index(begin), size));
+      });
+}
+
+// Coarse particles and their weights contributing to a fine coordinate
+std::size_t interpolation(const UnsignedInt fine, const UnsignedInt coarseSize,
+                          UnsignedInt coarse[2], Float weights[2]) {
+  if (fine % 2 == 0) {
+    coarse[0] = fine / 2;
+    weights[0] = 1.0f;
+    return 1;
+  }
+
+  coarse[0] = fine / 2;
+  if (fine / 2 + 1 >= coarseSize) {
+    weights[0] = 1.0f;
+    return 1;
+  }
+
+  coarse[1] = fine / 2 + 1;
+  weights[0] = weights[1] = 0.5f;
+  return 2;
+}
+} // namespace
+
+void Multigrid::buildLevels(const Vector2ui gridSize) {
+  m_levels.clear();
+
+  Vector2ui size{gridSize};
+  for (;;) {
+    m_levels.emplace_back();
+    auto &level{m_levels.back()};
+    level.size = size;
+
+    for (UnsignedInt y = 0; y < size.y(); ++y) {
+      for (UnsignedInt x = 0; x < size.x(); ++x)
+        level.colors[(y % 3) * 3 + x % 3].push_back(y * size.x() + x);
+    }
+
+    if (size.x() <= MinCoarseSize || size.y() <= MinCoarseSize)
+      break;
+
+    const Vector2ui coarseSize{(size.x() + 1) / 2, (size.y() + 1) / 2};
+
+    using T = Eigen::Triplet<ScalarT>;
+    std::vector<T> triplets;
+    triplets.reserve(std::size_t(size.x()) * size.y() * 3 * 4);
+
+    for (UnsignedInt y = 0; y < size.y(); ++y) {
+      UnsignedInt cy[2];
+      Float wy[2];
+      const auto ny{interpolation(y, coarseSize.y(), cy, wy)};
+
+      for (UnsignedInt x = 0; x < size.x(); ++x) {
+        UnsignedInt cx[2];
+        Float wx[2];
+        const auto nx{interpolation(x, coarseSize.x(), cx, wx)};
+
+        const auto fine{y * size.x() + x};
+        for (std::size_t j = 0; j < ny; ++j) {
+          for (std::size_t i = 0; i < nx; ++i) {
+            const auto coarse{cy[j] * coarseSize.x() + cx[i]};
+            for (UnsignedInt k = 0; k < 3; ++k)
+              triplets.emplace_back(3 * fine + k, 3 * coarse + k,
+                                    wx[i] * wy[j]);
+          }
+        }
+      }
+    }
+
+    level.prolongation.resize(3 * Eigen::Index(size.x()) * size.y(),
+                              3 * Eigen::Index(coarseSize.x()) * coarseSize.y());
+    level.prolongation.setFromTriplets(triplets.begin(), triplets.end());
+
+    size = coarseSize;
+  }
+}
+
+void Multigrid::setup(const SparseMatrix &A, const Vector2ui gridSize) {
+  if (A.rows() != 3 * Eigen::Index(gridSize.x()) * gridSize.y() ||
+      A.rows() != A.cols())
+    throw std::runtime_error("Multigrid matrix does not match the grid");
+
+  if (m_levels.empty() || m_levels.front().size != gridSize)
+    buildLevels(gridSize);
+
+  m_levels.front().A = A;
+
+  for (std::size_t l = 0; l < m_levels.size(); ++l) {
+    auto &level{m_levels[l]};
+
+    if (l > 0) {
+      const auto &P{m_levels[l - 1].prolongation};
+      const SparseMatrix AP{m_levels[l - 1].A * P};
+      level.A = SparseMatrixRM(P.transpose() * AP);
+    }
+
+    const auto n{level.A.rows() / 3};
+    level.inverseDiagonal.resize(n);
+    level.x.setZero(level.A.rows());
+    level.b.setZero(level.A.rows());
+    level.r.setZero(level.A.rows());
+
+    parallelFor(
+        TaskStage::Solver, std::size_t(n), 0, [&](const std::size_t index) {
+          const Eigen::Index i{Eigen::Index(index)};
+          Eigen::Matrix<ScalarT, 3, 3> block{
+              Eigen::Matrix<ScalarT, 3, 3>::Zero()};
+
+          for (Eigen::Index k = 0; k < 3; ++k) {
+            for (SparseMatrixRM::InnerIterator it(level.A, 3 * i + k); it;
+                 ++it) {
+              if (it.col() >= 3 * i && it.col() < 3 * i + 3)
+                block(k, it.col() - 3 * i) = it.value();
+            }
+          }
+
+          // Diagonal blocks of a positive definite matrix are invertible, fall
+          // back to the diagonal for anything else
+          Eigen::Matrix<ScalarT, 3, 3> inverse;
+          bool invertible;
+          block.computeInverseWithCheck(inverse, invertible);
+          if (!invertible) {
+            inverse.setZero();
+            for (Eigen::Index k = 0; k < 3; ++k)
+              inverse(k, k) = block(k, k) != 0.0f ? 1.0f / block(k, k) : 0.0f;
+          }
+
+          level.inverseDiagonal[i] = inverse;
+        });
+  }
+
+  m_coarseSolver.compute(SparseMatrix(m_levels.back().A));
+  if (m_coarseSolver.info() != Eigen::Success)
+    throw std::runtime_error("Multigrid coarse level is singular");
+}
+
+void Multigrid::smooth(Level &level, const bool reverse) const {
+  // Block Gauss-Seidel, colors in reverse for the post-smoothing keep the
+  // V-cycle symmetric
+  for (std::size_t c = 0; c < 9; ++c) {
+    const auto &color{level.colors[reverse ? 8 - c : c]};
+
+    parallelFor(TaskStage::Solver, color.size(), 0, [&](const std::size_t j) {
+      const Eigen::Index i{color[j]};
+
+      Eigen::Matrix<ScalarT, 3, 1> residual;
+      for (Eigen::Index k = 0; k < 3; ++k) {
+        ScalarT sum{level.b[3 * i + k]};
+        for (SparseMatrixRM::InnerIterator it(level.A, 3 * i + k); it; ++it)
+          sum -= it.value() * level.x[it.col()];
+        residual[k] = sum;
+      }
+
+      level.x.segment<3>(3 * i) += level.inverseDiagonal[i] * residual;
+    });
+  }
+}
+
+void Multigrid::vCycle(const std::size_t l) {
+  auto &level{m_levels[l]};
+
+  if (l + 1 == m_levels.size()) {
+    level.x = m_coarseSolver.solve(level.b);
+    return;
+  }
+
+  level.x.setZero();
+  for (std::size_t i = 0; i < SmoothingSteps; ++i)
+    smooth(level, false);
+
+  level.r = level.b - level.A * level.x;
+
+  auto &coarse{m_levels[l + 1]};
+  coarse.b = level.prolongation.transpose() * level.r;
+  vCycle(l + 1);
+  level.x += level.prolongation * coarse.x;
+
+  for (std::size_t i = 0; i < SmoothingSteps; ++i)
+    smooth(level, true);
+}
+
+bool Multigrid::solve(const Vector &b, Vector &x, const ScalarT tolerance,
+                      const std::size_t maxIterations,
+                      std::size_t &iterations) {
+  iterations = 0;
+
+  if (m_levels.empty() || b.size() != m_levels.front().A.rows())
+    return false;
+
+  auto &fine{m_levels.front()};
+  const ScalarT bNorm{std::sqrt(dot(b, b))};
+  if (bNorm == 0.0f) {
+    x.setZero(b.size());
+    return true;
+  }
+
+  if (x.size() != b.size())
+    x.setZero(b.size());
+
+  Vector r{b - fine.A * x};
+
+  fine.b = r;
+  vCycle(0);
+  Vector p{fine.x};
+  ScalarT rz{dot(r, fine.x)};
+
+  while (iterations < maxIterations) {
+    const Vector Ap{fine.A * p};
+    const ScalarT pAp{dot(p, Ap)};
+
+    if (!(pAp > 0.0f))
+      return false;
+
+    const ScalarT alpha{rz / pAp};
+    x += alpha * p;
+    r -= alpha * Ap;
+    ++iterations;
+
+    if (std::sqrt(dot(r, r)) <= tolerance * bNorm)
+      return true;
+
+    fine.b = r;
+    vCycle(0);
+
+    const ScalarT rzNext{dot(r, fine.x)};
+    p = fine.x + (rzNext / rz) * p;
+    rz = rzNext;
+  }
+
+  return false;
+}
+
+std::size_t Multigrid::getLevelCount() const { return m_levels.size(); }
+} // namespace clothsim
@@ -0,0 +1,61 @@
+#ifndef CLOTHSIM_MULTIGRID_H
+#define CLOTHSIM_MULTIGRID_H
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector2.h>
+
+#include <Eigen/Sparse>
+
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Geometric multigrid for symmetric positive definite systems on a grid of
+// particles with three unknowns each, numbered row by row. Coarse levels
+// keep every other particle in both directions, the prolongation
+// interpolates bilinearly and the coarse operators are the Galerkin
+// products P^T A P, so coarse springs follow from the fine ones.
+class Multigrid {
+public:
+  using ScalarT = float;
+  using Vector = Eigen::Matrix<ScalarT, Eigen::Dynamic, 1>;
+  using SparseMatrix = Eigen::SparseMatrix<ScalarT>;
+  using SparseMatrixRM = Eigen::SparseMatrix<ScalarT, Eigen::RowMajor>;
+
+  // The transfer operators are kept as long as the grid size does not
+  // change, the coarse operators are recomputed from A on every call
+  void setup(const SparseMatrix &A, const Vector2ui gridSize);
+
+  // Conjugate gradients preconditioned with one V-cycle per iteration,
+  // starting from x. Returns false if the residual did not drop below the
+  // tolerance relative to b or the matrix is not positive definite.
+  bool solve(const Vector &b, Vector &x, const ScalarT tolerance,
+             const std::size_t maxIterations, std::size_t &iterations);
+
+  std::size_t getLevelCount() const;
+
+private:
+  struct Level {
+    Vector2ui size;
+    SparseMatrixRM A;
+    // Interpolates the next coarser level to this one
+    SparseMatrix prolongation;
+    std::vector<Eigen::Matrix<ScalarT, 3, 3>> inverseDiagonal;
+    // Particles by their x and y coordinates modulo 3. Springs and the
+    // Galerkin products never couple particles further than two apart, so
+    // particles of one color are smoothed in parallel.
+    std::vector<UnsignedInt> colors[9];
+    Vector x, b, r;
+  };
+
+  void buildLevels(const Vector2ui gridSize);
+  void vCycle(const std::size_t level);
+  void smooth(Level &level, const bool reverse) const;
+
+  std::vector<Level> m_levels;
+  Eigen::SparseLU<SparseMatrix> m_coarseSolver;
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_MULTIGRID_H
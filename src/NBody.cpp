@@ -0,0 +1,490 @@
+#include "NBody.h"
+#include "TaskPool.h"
+
+#include <Corrade/Containers/Array.h>
+
+#include <Magnum/Math/Constants.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+using Vector3 = System::Vector3;
+using ScalarT = System::ScalarT;
+
+// Bits of the Morton codes per axis, also the deepest level of the tree
+constexpr UnsignedInt MortonBits{21};
+constexpr UnsignedInt LeafSize{8};
+// The top of the tree is split into subtrees of at most this many bodies or
+// at this level, whichever comes first
+constexpr UnsignedInt SubtreeSize{4096};
+constexpr UnsignedInt SubtreeLevel{3};
+constexpr std::size_t SortChunks{16};
+
+// Spreads the lowest 21 bits of v to every third bit
+UnsignedLong spreadBits(UnsignedLong v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+UnsignedInt octant(const UnsignedLong code, const UnsignedInt level) {
+  return UnsignedInt(code >> (3 * (MortonBits - 1 - level))) & 7;
+}
+
+// Calls f(begin, end) for the non-empty children of a cell, the codes of the
+// cell only differ from the level on
+template <typename F>
+void forEachOctant(
+    const std::vector<std::pair<UnsignedLong, UnsignedInt>> &order,
+    const UnsignedInt begin, const UnsignedInt end, const UnsignedInt level,
+    F &&f) {
+  auto childBegin{begin};
+
+  while (childBegin < end) {
+    const auto child{octant(order[childBegin].first, level)};
+    const auto childEnd{UnsignedInt(
+        std::partition_point(order.begin() + childBegin, order.begin() + end,
+                             [&](const auto &body) {
+                               return octant(body.first, level) == child;
+                             }) -
+        order.begin())};
+
+    f(childBegin, childEnd);
+    childBegin = childEnd;
+  }
+}
+
+// Sorts chunks in parallel and merges them pairwise
+template <typename T> void parallelSort(std::vector<T> &values) {
+  const std::size_t chunk{(values.size() + SortChunks - 1) / SortChunks};
+
+  if (chunk == 0)
+    return;
+
+  parallelFor(TaskStage::Gravity, SortChunks, 0, [&](const std::size_t i) {
+    const auto begin{std::min(i * chunk, values.size())};
+    const auto end{std::min(begin + chunk, values.size())};
+    std::sort(values.begin() + begin, values.begin() + end);
+  });
+
+  for (std::size_t width = chunk; width < values.size(); width *= 2) {
+    const std::size_t merges{(values.size() + 2 * width - 1) / (2 * width)};
+
+    parallelFor(TaskStage::Gravity, merges, 0, [&](const std::size_t i) {
+      const auto begin{i * 2 * width};
+      const auto middle{std::min(begin + width, values.size())};
+      const auto end{std::min(begin + 2 * width, values.size())};
+      std::inplace_merge(values.begin() + begin, values.begin() + middle,
+                         values.begin() + end);
+    });
+  }
+}
+
+// Softened attraction of a unit mass at d
+inline Vector3 attraction(const Vector3 &d, const ScalarT softening2) {
+  const ScalarT inverse{1.0f / std::sqrt(d.squaredNorm() + softening2)};
+  return d * (inverse * inverse * inverse);
+}
+} // namespace
+
+NBody::NBody(const NBodySettings &settings) : m_settings{settings} {
+  reset();
+}
+
+NBody::~NBody() {}
+
+void NBody::reset() {
+  if (m_settings.bodies == 0 || !(m_settings.totalMass > 0.0f) ||
+      !(m_settings.radius > 0.0f))
+    throw std::runtime_error("Invalid n-body settings");
+
+  const auto n{m_settings.bodies};
+  Vector state{Vector::Zero(6 * n)};
+
+  // The same disc every time
+  std::mt19937 random{12345};
+  std::uniform_real_distribution<ScalarT> uniform{0.0f, 1.0f};
+  std::normal_distribution<ScalarT> normal{0.0f, 1.0f};
+
+  const ScalarT radius{m_settings.radius};
+  const ScalarT softening2{m_settings.softening * m_settings.softening};
+
+  for (UnsignedInt i = 0; i < n; ++i) {
+    // Uniform density over the disc
+    const ScalarT r{radius * std::sqrt(uniform(random))};
+    const ScalarT angle{2.0f * Constants::pi() * uniform(random)};
+    const Vector3 direction{std::cos(angle), 0.0f, std::sin(angle)};
+
+    // Circular orbit around the mass inside r as if it were a point
+    const ScalarT enclosed{m_settings.totalMass * r * r / (radius * radius)};
+    const ScalarT speed{
+        std::sqrt(enclosed * r * r / std::pow(r * r + softening2, 1.5f))};
+
+    state.segment<3>(3 * i) =
+        r * direction + Vector3{0.0f, 0.02f * radius * normal(random), 0.0f};
+    state.segment<3>(3 * (n + i)) = speed * Vector3{-direction.z(), 0.0f,
+                                                    direction.x()};
+  }
+
+  setState(std::move(state));
+  clearPinnedParticles();
+}
+
+void NBody::setSettings(const NBodySettings &settings) {
+  const bool restart{settings.bodies != m_settings.bodies ||
+                     settings.totalMass != m_settings.totalMass ||
+                     settings.radius != m_settings.radius};
+
+  const auto previous{m_settings};
+  m_settings = settings;
+  invalidateDerivativeCache();
+
+  if (restart) {
+    try {
+      reset();
+    } catch (...) {
+      m_settings = previous;
+      throw;
+    }
+  }
+}
+
+const NBodySettings &NBody::getSettings() const { return m_settings; }
+
+const NBodyStatistics &NBody::getStatistics() const { return m_statistics; }
+
+void NBody::resetStatistics() { m_statistics = {}; }
+
+System::Vector NBody::evalDerivative(const Vector &state) const {
+  const auto n{Eigen::Index(m_settings.bodies)};
+  Vector d{Vector::Zero(6 * n)};
+  d.head(3 * n) = state.tail(3 * n);
+
+  Vector accelerations{3 * n};
+  computeAccelerations(state, m_settings.method, accelerations);
+  d.tail(3 * n) = accelerations;
+
+  for (const auto pinnedIdx : getPinnedParticleIds()) {
+    d.segment<3>(3 * pinnedIdx).setZero();
+    d.segment<3>(3 * (n + pinnedIdx)).setZero();
+  }
+
+  return d;
+}
+
+System::SparseMatrix NBody::evalJacobian(const Vector & /*state*/) const {
+  const auto n{Eigen::Index(m_settings.bodies)};
+  SparseMatrix j{6 * n, 6 * n};
+
+  j.reserve(Eigen::VectorXi::Constant(6 * n, 1));
+  for (Eigen::Index i = 0; i < 3 * n; ++i)
+    j.insert(i, 3 * n + i) = 1.0f;
+
+  for (const auto pinnedIdx : getPinnedParticleIds()) {
+    for (Eigen::Index k = 0; k < 3; ++k)
+      j.coeffRef(3 * Eigen::Index(pinnedIdx) + k,
+                 3 * (n + Eigen::Index(pinnedIdx)) + k) = 0.0f;
+  }
+
+  return j;
+}
+
+void NBody::computeAccelerations(const Vector &state,
+                                 const GravityMethod method,
+                                 Vector &accelerations) const {
+  using namespace std::chrono;
+
+  if (method == GravityMethod::Direct) {
+    const auto start{steady_clock::now()};
+    sumDirect(state, accelerations);
+    m_statistics.forceSeconds +=
+        duration<Double>(steady_clock::now() - start).count();
+  } else {
+    const auto start{steady_clock::now()};
+    buildTree(state);
+    const auto built{steady_clock::now()};
+    sumTree(accelerations);
+
+    m_statistics.buildSeconds += duration<Double>(built - start).count();
+    m_statistics.forceSeconds +=
+        duration<Double>(steady_clock::now() - built).count();
+    m_statistics.nodes = m_nodes.size();
+  }
+
+  m_statistics.evaluations += 1;
+}
+
+void NBody::buildTree(const Vector &state) const {
+  const auto n{m_settings.bodies};
+
+  // Cheap next to the rest of the build, not worth splitting up
+  const Eigen::Map<const Eigen::Matrix<ScalarT, 3, Eigen::Dynamic>> positions{
+      state.data(), 3, Eigen::Index(n)};
+  const Vector3 origin{positions.rowwise().minCoeff()};
+  const Vector3 extent{positions.rowwise().maxCoeff() - origin};
+  m_rootSize =
+      std::max(extent.maxCoeff(), std::numeric_limits<ScalarT>::min());
+  const ScalarT cells{ScalarT(1u << MortonBits)};
+  const ScalarT scale{cells / m_rootSize};
+  const ScalarT maxCell{cells - 1.0f};
+
+  m_order.resize(n);
+
+  parallelFor(
+      TaskStage::Gravity, std::size_t(n), 0, [&](const std::size_t index) {
+        const UnsignedInt i{UnsignedInt(index)};
+        const Vector3 cell{((state.segment<3>(3 * i) - origin) * scale)
+                               .cwiseMax(0.0f)
+                               .cwiseMin(maxCell)};
+        const auto code{spreadBits(UnsignedLong(cell.x())) << 2 |
+                        spreadBits(UnsignedLong(cell.y())) << 1 |
+                        spreadBits(UnsignedLong(cell.z()))};
+        m_order[i] = {code, i};
+      });
+
+  parallelSort(m_order);
+
+  m_sortedPositions.resize(n);
+
+  parallelFor(
+      TaskStage::Gravity, std::size_t(n), 0, [&](const std::size_t index) {
+        const UnsignedInt i{UnsignedInt(index)};
+        m_sortedPositions[i] = state.segment<3>(3 * m_order[i].second);
+      });
+
+  m_subtrees.clear();
+  planSubtrees(0, n, 0);
+
+  if (m_subtreeNodes.size() < m_subtrees.size())
+    m_subtreeNodes.resize(m_subtrees.size());
+
+  parallelFor(
+      TaskStage::Gravity, m_subtrees.size(), 1, [&](const std::size_t i) {
+        const auto &subtree{m_subtrees[i]};
+        m_subtreeNodes[i].clear();
+        buildNode(subtree.begin, subtree.end, subtree.level,
+                  m_rootSize / ScalarT(1u << subtree.level), m_subtreeNodes[i]);
+      });
+
+  m_nodes.clear();
+  std::size_t subtree{0};
+  assembleNode(0, n, 0, m_rootSize, subtree);
+}
+
+void NBody::planSubtrees(const UnsignedInt begin, const UnsignedInt end,
+                         const UnsignedInt level) const {
+  if (end - begin <= SubtreeSize || level == SubtreeLevel) {
+    m_subtrees.push_back(Subtree{begin, end, level});
+    return;
+  }
+
+  forEachOctant(m_order, begin, end, level,
+                [&](const UnsignedInt childBegin, const UnsignedInt childEnd) {
+                  planSubtrees(childBegin, childEnd, level + 1);
+                });
+}
+
+void NBody::buildNode(const UnsignedInt begin, const UnsignedInt end,
+                      const UnsignedInt level, const ScalarT size,
+                      std::vector<Node> &nodes) const {
+  const auto index{nodes.size()};
+  nodes.push_back(Node{Vector3::Zero(), 0.0f, size, 0, begin, end});
+
+  Vector3 weighted{Vector3::Zero()};
+
+  if (end - begin <= LeafSize || level == MortonBits) {
+    for (auto i = begin; i < end; ++i)
+      weighted += m_sortedPositions[i];
+  } else {
+    forEachOctant(
+        m_order, begin, end, level,
+        [&](const UnsignedInt childBegin, const UnsignedInt childEnd) {
+          const auto child{nodes.size()};
+          buildNode(childBegin, childEnd, level + 1, 0.5f * size, nodes);
+          weighted +=
+              ScalarT(childEnd - childBegin) * nodes[child].centerOfMass;
+        });
+  }
+
+  auto &node{nodes[index]};
+  node.centerOfMass = weighted / ScalarT(end - begin);
+  node.mass = ScalarT(end - begin) * getParticleMass();
+  node.next = UnsignedInt(nodes.size());
+}
+
+void NBody::assembleNode(const UnsignedInt begin, const UnsignedInt end,
+                         const UnsignedInt level, const ScalarT size,
+                         std::size_t &subtree) const {
+  // Mirrors planSubtrees, whose subtrees come in the same order
+  if (end - begin <= SubtreeSize || level == SubtreeLevel) {
+    const auto offset{UnsignedInt(m_nodes.size())};
+
+    for (auto node : m_subtreeNodes[subtree]) {
+      node.next += offset;
+      m_nodes.push_back(node);
+    }
+
+    ++subtree;
+    return;
+  }
+
+  const auto index{m_nodes.size()};
+  m_nodes.push_back(Node{Vector3::Zero(), 0.0f, size, 0, begin, end});
+
+  Vector3 weighted{Vector3::Zero()};
+  forEachOctant(m_order, begin, end, level,
+                [&](const UnsignedInt childBegin, const UnsignedInt childEnd) {
+                  const auto child{m_nodes.size()};
+                  assembleNode(childBegin, childEnd, level + 1, 0.5f * size,
+                               subtree);
+                  weighted += ScalarT(childEnd - childBegin) *
+                              m_nodes[child].centerOfMass;
+                });
+
+  auto &node{m_nodes[index]};
+  node.centerOfMass = weighted / ScalarT(end - begin);
+  node.mass = ScalarT(end - begin) * getParticleMass();
+  node.next = UnsignedInt(m_nodes.size());
+}
+
+void NBody::sumTree(Vector &accelerations) const {
+  const auto n{m_settings.bodies};
+  const auto nodeCount{UnsignedInt(m_nodes.size())};
+  const ScalarT theta2{m_settings.openingAngle * m_settings.openingAngle};
+  const ScalarT softening2{m_settings.softening * m_settings.softening};
+  const ScalarT mass{getParticleMass()};
+
+  // Neighbours along the curve visit mostly the same nodes
+  parallelFor(
+      TaskStage::Gravity, std::size_t(n), 256, [&](const std::size_t index) {
+        const UnsignedInt body{UnsignedInt(index)};
+        const Vector3 position{m_sortedPositions[body]};
+        Vector3 a{Vector3::Zero()};
+
+        UnsignedInt i{0};
+        while (i < nodeCount) {
+          const auto &node{m_nodes[i]};
+          const bool leaf{node.next == i + 1};
+          // Cells holding the body itself are always opened
+          const bool inside{node.begin <= body && body < node.end};
+
+          if (leaf) {
+            for (auto other = node.begin; other < node.end; ++other) {
+              if (other != body)
+                a += mass * attraction(m_sortedPositions[other] - position,
+                                       softening2);
+            }
+
+            i = node.next;
+            continue;
+          }
+
+          const Vector3 d{node.centerOfMass - position};
+          if (!inside && node.size * node.size < theta2 * d.squaredNorm()) {
+            a += node.mass * attraction(d, softening2);
+            i = node.next;
+          } else {
+            ++i;
+          }
+        }
+
+        accelerations.segment<3>(3 * m_order[body].second) = a;
+      });
+}
+
+void NBody::sumDirect(const Vector &state, Vector &accelerations) const {
+  const auto n{m_settings.bodies};
+  const ScalarT softening2{m_settings.softening * m_settings.softening};
+  const ScalarT mass{getParticleMass()};
+
+  parallelFor(
+      TaskStage::Gravity, std::size_t(n), 64, [&](const std::size_t index) {
+        const UnsignedInt i{UnsignedInt(index)};
+        const Vector3 position{state.segment<3>(3 * i)};
+        Vector3 a{Vector3::Zero()};
+
+        for (UnsignedInt j = 0; j < n; ++j) {
+          if (j != i)
+            a += mass * attraction(Vector3{state.segment<3>(3 * j)} - position,
+                                   softening2);
+        }
+
+        accelerations.segment<3>(3 * i) = a;
+      });
+}
+
+NBodyComparison NBody::compareWithDirectSum() const {
+  using namespace std::chrono;
+  const auto n{Eigen::Index(m_settings.bodies)};
+  const auto &state{getState()};
+  const auto statistics{m_statistics};
+
+  NBodyComparison comparison;
+  Vector tree{3 * n};
+  Vector direct{3 * n};
+
+  auto start{steady_clock::now()};
+  computeAccelerations(state, GravityMethod::BarnesHut, tree);
+  comparison.barnesHutSeconds =
+      duration<Double>(steady_clock::now() - start).count();
+
+  start = steady_clock::now();
+  computeAccelerations(state, GravityMethod::Direct, direct);
+  comparison.directSeconds =
+      duration<Double>(steady_clock::now() - start).count();
+
+  Double squaredErrors{0.0};
+  for (Eigen::Index i = 0; i < n; ++i) {
+    const Double reference{direct.segment<3>(3 * i).norm()};
+    const Double error{(tree.segment<3>(3 * i) - direct.segment<3>(3 * i))
+                           .norm() /
+                       std::max(reference, 1e-12)};
+    squaredErrors += error * error;
+    comparison.maxError = std::max(comparison.maxError, error);
+  }
+
+  comparison.rmsError = std::sqrt(squaredErrors / Double(n));
+  // Not part of the simulation
+  m_statistics = statistics;
+
+  return comparison;
+}
+
+System::ScalarT NBody::getKineticEnergy(const Vector &state) const {
+  const auto n{Eigen::Index(m_settings.bodies)};
+
+  return 0.5f * getParticleMass() * state.tail(3 * n).squaredNorm();
+}
+
+System::ScalarT NBody::getParticleMass() const {
+  return m_settings.totalMass / ScalarT(m_settings.bodies);
+}
+
+std::size_t NBody::getParticleCount() const { return m_settings.bodies; }
+
+bool NBody::isSecondOrder() const { return true; }
+
+Corrade::Containers::ArrayView<const UnsignedInt>
+NBody::getMeshIndices() const {
+  return nullptr;
+}
+
+GravityMethod gravityMethod(const std::string &name) {
+  if (name == "barnesHut")
+    return GravityMethod::BarnesHut;
+  if (name == "direct")
+    return GravityMethod::Direct;
+
+  throw std::runtime_error("Unknown gravity method " + name);
+}
+} // namespace clothsim
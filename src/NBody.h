@@ -0,0 +1,138 @@
+#ifndef CLOTHSIM_NBODY_H
+#define CLOTHSIM_NBODY_H
+
+#include <Corrade/Containers/Array.h>
+
+#include <Magnum/Magnum.h>
+
+#include <Eigen/Sparse>
+
+#include "System.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// In the order of the UI selection
+enum class GravityMethod : UnsignedInt { BarnesHut = 0, Direct = 1 };
+
+struct NBodySettings {
+  UnsignedInt bodies{2000};
+  // Shared evenly by the bodies, the gravitational constant is one
+  Float totalMass{1.0f};
+  // Of the disc the bodies start in
+  Float radius{1.0f};
+  // Cells smaller than this times their distance act through their centre
+  // of mass. Zero visits every body.
+  Float openingAngle{0.5f};
+  // Plummer softening length, keeps close encounters finite
+  Float softening{0.01f};
+  GravityMethod method{GravityMethod::BarnesHut};
+};
+
+// Accumulated over the evaluations of the derivative
+struct NBodyStatistics {
+  std::size_t evaluations{0};
+  // Of the last tree
+  std::size_t nodes{0};
+  Double buildSeconds{0.0};
+  Double forceSeconds{0.0};
+};
+
+struct NBodyComparison {
+  Double barnesHutSeconds{0.0};
+  Double directSeconds{0.0};
+  // Of the Barnes-Hut accelerations relative to the direct ones
+  Double rmsError{0.0};
+  Double maxError{0.0};
+};
+
+// Planet generalized to many bodies that attract each other. They start on
+// circular orbits in a thin disc in the xz plane. The gravity is summed over
+// a Barnes-Hut octree built from scratch for every evaluated state: bodies
+// are sorted along a Morton curve, the top of the tree is split into
+// subtrees that are built in parallel, and distant cells act through their
+// centre of mass.
+class NBody : public System {
+public:
+  explicit NBody(const NBodySettings &settings = {});
+  ~NBody() override;
+
+  std::size_t getParticleCount() const override;
+  bool isSecondOrder() const override;
+
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const override;
+
+  Vector evalDerivative(const Vector &state) const override;
+  // Gravity is left out, the implicit integrators only see the motion
+  SparseMatrix evalJacobian(const Vector &state) const override;
+  ScalarT getKineticEnergy(const Vector &state) const override;
+  ScalarT getParticleMass() const override;
+
+  void reset() override;
+
+  // Changes of the body count, mass or radius restart the simulation
+  void setSettings(const NBodySettings &settings);
+  const NBodySettings &getSettings() const;
+  const NBodyStatistics &getStatistics() const;
+  void resetStatistics();
+
+  // Evaluates the current state both ways
+  NBodyComparison compareWithDirectSum() const;
+
+private:
+  // In depth first order, children follow their parent
+  struct Node {
+    Vector3 centerOfMass;
+    ScalarT mass;
+    // Edge length of the cell
+    ScalarT size;
+    // Index of the first node after the subtree, the next one for leaves
+    UnsignedInt next;
+    // Range of sorted bodies in the cell
+    UnsignedInt begin;
+    UnsignedInt end;
+  };
+
+  struct Subtree {
+    UnsignedInt begin;
+    UnsignedInt end;
+    UnsignedInt level;
+  };
+
+  void computeAccelerations(const Vector &state, const GravityMethod method,
+                            Vector &accelerations) const;
+  void buildTree(const Vector &state) const;
+  void planSubtrees(const UnsignedInt begin, const UnsignedInt end,
+                    const UnsignedInt level) const;
+  void buildNode(const UnsignedInt begin, const UnsignedInt end,
+                 const UnsignedInt level, const ScalarT size,
+                 std::vector<Node> &nodes) const;
+  void assembleNode(const UnsignedInt begin, const UnsignedInt end,
+                    const UnsignedInt level, const ScalarT size,
+                    std::size_t &subtree) const;
+  void sumTree(Vector &accelerations) const;
+  void sumDirect(const Vector &state, Vector &accelerations) const;
+
+  NBodySettings m_settings;
+
+  // Scratch space of the evaluations
+  mutable std::vector<std::pair<UnsignedLong, UnsignedInt>> m_order;
+  mutable std::vector<Vector3> m_sortedPositions;
+  mutable std::vector<Subtree> m_subtrees;
+  mutable std::vector<std::vector<Node>> m_subtreeNodes;
+  mutable std::vector<Node> m_nodes;
+  mutable ScalarT m_rootSize{0.0f};
+  mutable NBodyStatistics m_statistics;
+};
+
+// Accepts "barnesHut" and "direct", throws std::runtime_error for unknown
+// names
+GravityMethod gravityMethod(const std::string &name);
+} // namespace clothsim
+
+#endif // CLOTHSIM_NBODY_H
@@ -8,10 +8,7 @@
 #include <iostream>
 
 namespace clothsim {
-Oscillator::Oscillator(PhongIdShader &phongShader,
-                       VertexMarkerShader &vertexShader, Object3D &parent,
-                       Magnum::SceneGraph::DrawableGroup3D &drawableGroup)
-    : System(phongShader, vertexShader, parent, drawableGroup) {
+Oscillator::Oscillator() {
   reset();
 }
 
@@ -46,19 +43,11 @@ System::Vector Oscillator::evalDerivative(const Vector &state) const {
   return d;
 }
 
-Corrade::Containers::Array<Magnum::Vector3>
-Oscillator::getParticlePositions(const Vector &state) const {
-  Corrade::Containers::Array<Magnum::Vector3> vertices{1};
+std::size_t Oscillator::getParticleCount() const { return 1; }
 
-  vertices[0].x() = static_cast<Float>(state(0));
-  vertices[0].y() = static_cast<Float>(state(1));
-  vertices[0].z() = static_cast<Float>(state(2));
-
-  return vertices;
-}
-
-Corrade::Containers::Array<UnsignedInt> Oscillator::getMeshIndices() const {
-  return Corrade::Containers::Array<UnsignedInt>{};
+Corrade::Containers::ArrayView<const UnsignedInt>
+Oscillator::getMeshIndices() const {
+  return nullptr;
 }
 
 } // namespace clothsim
@@ -18,15 +18,13 @@ using namespace Magnum;
 
 class Oscillator : public System {
 public:
-  Oscillator(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-             Object3D &parent,
-             Magnum::SceneGraph::DrawableGroup3D &drawableGroup);
+  Oscillator();
   ~Oscillator() override;
 
-  Corrade::Containers::Array<Magnum::Vector3>
-  getParticlePositions(const Vector &state) const override;
+  std::size_t getParticleCount() const override;
 
-  Corrade::Containers::Array<UnsignedInt> getMeshIndices() const override;
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const override;
 
   Vector evalDerivative(const Vector &state) const override;
   SparseMatrix evalJacobian(const Vector &state) const override;
@@ -0,0 +1,497 @@
+#include "Perf.h"
+
+#include <Corrade/Utility/Arguments.h>
+#include <Corrade/Utility/Debug.h>
+#include <Corrade/Utility/Directory.h>
+
+#include "Integrators.h"
+#include "TaskPool.h"
+#include "Telemetry.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace clothsim {
+namespace {
+using namespace Magnum;
+
+struct JsonValue;
+using JsonArray = std::vector<JsonValue>;
+using JsonObject = std::vector<std::pair<std::string, JsonValue>>;
+
+struct JsonValue {
+  std::variant<std::nullptr_t, bool, Double, std::string, JsonArray,
+               JsonObject>
+      value;
+};
+
+// Just enough JSON for the baseline: no \u escapes in strings
+class JsonReader {
+public:
+  JsonReader(std::string text, std::string filename)
+      : m_text{std::move(text)}, m_filename{std::move(filename)} {}
+
+  JsonValue read() {
+    auto value{readValue()};
+    skipSpace();
+    if (m_position != m_text.size())
+      fail("trailing characters");
+    return value;
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &what) const {
+    throw std::runtime_error("Invalid JSON in " + m_filename + " at " +
+                             std::to_string(m_position) + ": " + what);
+  }
+
+  void skipSpace() {
+    while (m_position < m_text.size() &&
+           std::strchr(" \t\r\n", m_text[m_position]))
+      ++m_position;
+  }
+
+  bool consume(const char c) {
+    skipSpace();
+    if (m_position < m_text.size() && m_text[m_position] == c) {
+      ++m_position;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(const char c) {
+    if (!consume(c))
+      fail(std::string{"expected "} + c);
+  }
+
+  bool consumeWord(const char *word) {
+    const std::size_t length{std::strlen(word)};
+    if (m_text.compare(m_position, length, word) != 0)
+      return false;
+    m_position += length;
+    return true;
+  }
+
+  JsonValue readValue() {
+    skipSpace();
+    if (m_position == m_text.size())
+      fail("unexpected end");
+
+    const char c{m_text[m_position]};
+    if (c == '{')
+      return {readObject()};
+    if (c == '[')
+      return {readArray()};
+    if (c == '"')
+      return {readString()};
+    if (consumeWord("true"))
+      return {true};
+    if (consumeWord("false"))
+      return {false};
+    if (consumeWord("null"))
+      return {nullptr};
+
+    const char *begin{m_text.c_str() + m_position};
+    char *end;
+    const Double number{std::strtod(begin, &end)};
+    if (end == begin)
+      fail("unexpected character");
+    m_position += std::size_t(end - begin);
+    return {number};
+  }
+
+  JsonObject readObject() {
+    expect('{');
+    JsonObject object;
+    if (consume('}'))
+      return object;
+
+    do {
+      skipSpace();
+      auto key{readString()};
+      expect(':');
+      object.emplace_back(std::move(key), readValue());
+    } while (consume(','));
+
+    expect('}');
+    return object;
+  }
+
+  JsonArray readArray() {
+    expect('[');
+    JsonArray array;
+    if (consume(']'))
+      return array;
+
+    do {
+      array.push_back(readValue());
+    } while (consume(','));
+
+    expect(']');
+    return array;
+  }
+
+  std::string readString() {
+    if (m_position == m_text.size() || m_text[m_position] != '"')
+      fail("expected a string");
+    ++m_position;
+
+    std::string string;
+    while (m_position < m_text.size() && m_text[m_position] != '"') {
+      char c{m_text[m_position++]};
+      if (c == '\\') {
+        if (m_position == m_text.size())
+          fail("unexpected end");
+
+        switch (const char escaped{m_text[m_position++]}) {
+        case 'n':
+          c = '\n';
+          break;
+        case 't':
+          c = '\t';
+          break;
+        case '"':
+        case '\\':
+        case '/':
+          c = escaped;
+          break;
+        default:
+          fail("unsupported escape");
+        }
+      }
+      string += c;
+    }
+
+    if (m_position == m_text.size())
+      fail("unterminated string");
+    ++m_position;
+    return string;
+  }
+
+  std::string m_text;
+  std::string m_filename;
+  std::size_t m_position{0};
+};
+
+const JsonValue *member(const JsonObject &object, const std::string &key) {
+  for (const auto &[name, value] : object) {
+    if (name == key)
+      return &value;
+  }
+  return nullptr;
+}
+
+template <typename T>
+void readMember(const JsonObject &object, const std::string &key, T &value,
+                const std::string &filename) {
+  const auto found{member(object, key)};
+  if (!found)
+    return;
+
+  if constexpr (std::is_same_v<T, std::string>) {
+    if (!std::holds_alternative<std::string>(found->value))
+      throw std::runtime_error(key + " is not a string in " + filename);
+    value = std::get<std::string>(found->value);
+  } else {
+    if (!std::holds_alternative<Double>(found->value))
+      throw std::runtime_error(key + " is not a number in " + filename);
+    value = T(std::get<Double>(found->value));
+  }
+}
+
+std::string quoted(const std::string &string) {
+  std::string result{"\""};
+  for (const char c : string) {
+    if (c == '"' || c == '\\')
+      result += '\\';
+    result += c;
+  }
+  return result + '"';
+}
+
+Double relativeError(const Double value, const Double expected) {
+  return std::abs(value - expected) / Math::max(std::abs(expected), 1e-12);
+}
+} // namespace
+
+PerfBaseline readPerfBaseline(const std::string &filename) {
+  std::ifstream file{filename};
+  if (!file)
+    throw std::runtime_error("Cannot read baseline " + filename);
+
+  std::stringstream text;
+  text << file.rdbuf();
+
+  const auto json{JsonReader{text.str(), filename}.read()};
+  if (!std::holds_alternative<JsonObject>(json.value))
+    throw std::runtime_error("Baseline " + filename + " is not an object");
+  const auto &root{std::get<JsonObject>(json.value)};
+
+  PerfBaseline baseline;
+  readMember(root, "threads", baseline.threads, filename);
+  readMember(root, "repeats", baseline.repeats, filename);
+  readMember(root, "minSeconds", baseline.minSeconds, filename);
+  readMember(root, "timeTolerance", baseline.timeTolerance, filename);
+  readMember(root, "energyTolerance", baseline.energyTolerance, filename);
+
+  const auto scenarios{member(root, "scenarios")};
+  if (!scenarios || !std::holds_alternative<JsonArray>(scenarios->value))
+    throw std::runtime_error("No scenarios in " + filename);
+
+  for (const auto &entry : std::get<JsonArray>(scenarios->value)) {
+    if (!std::holds_alternative<JsonObject>(entry.value))
+      throw std::runtime_error("Scenario is not an object in " + filename);
+    const auto &object{std::get<JsonObject>(entry.value)};
+
+    PerfScenario scenario;
+    readMember(object, "name", scenario.name, filename);
+    readMember(object, "scene", scenario.scene, filename);
+    readMember(object, "integrator", scenario.integrator, filename);
+    readMember(object, "steps", scenario.steps, filename);
+    readMember(object, "stepsPerSecond", scenario.stepsPerSecond, filename);
+    readMember(object, "energy", scenario.energy, filename);
+    readMember(object, "springEnergy", scenario.springEnergy, filename);
+
+    if (scenario.name.empty() || scenario.scene.empty() ||
+        scenario.steps == 0)
+      throw std::runtime_error("Invalid scenario in " + filename);
+
+    baseline.scenarios.push_back(std::move(scenario));
+  }
+
+  if (baseline.threads == 0 || baseline.repeats == 0 ||
+      !(baseline.minSeconds >= 0.0) || !(baseline.timeTolerance >= 0.0) ||
+      !(baseline.energyTolerance >= 0.0))
+    throw std::runtime_error("Invalid tolerances in " + filename);
+
+  return baseline;
+}
+
+void writePerfBaseline(const std::string &filename,
+                       const PerfBaseline &baseline) {
+  std::ofstream file{filename, std::ios::trunc};
+  if (!file)
+    throw std::runtime_error("Cannot open " + filename + " for writing");
+
+  file << std::setprecision(10) << "{\n"
+       << "  \"threads\": " << baseline.threads << ",\n"
+       << "  \"repeats\": " << baseline.repeats << ",\n"
+       << "  \"minSeconds\": " << baseline.minSeconds << ",\n"
+       << "  \"timeTolerance\": " << baseline.timeTolerance << ",\n"
+       << "  \"energyTolerance\": " << baseline.energyTolerance << ",\n"
+       << "  \"scenarios\": [";
+
+  for (std::size_t i = 0; i < baseline.scenarios.size(); ++i) {
+    const auto &s{baseline.scenarios[i]};
+    file << (i ? ",\n" : "\n") << "    {\n"
+         << "      \"name\": " << quoted(s.name) << ",\n"
+         << "      \"scene\": " << quoted(s.scene) << ",\n";
+    if (!s.integrator.empty())
+      file << "      \"integrator\": " << quoted(s.integrator) << ",\n";
+    file << "      \"steps\": " << s.steps << ",\n"
+         << "      \"stepsPerSecond\": " << s.stepsPerSecond << ",\n"
+         << "      \"energy\": " << s.energy << ",\n"
+         << "      \"springEnergy\": " << s.springEnergy << "\n"
+         << "    }";
+  }
+
+  file << "\n  ]\n}\n";
+
+  if (!file)
+    throw std::runtime_error("Writing " + filename + " failed");
+}
+
+std::string stateHash(const System &system) {
+  const auto &state{system.getState()};
+  const auto bytes{reinterpret_cast<const unsigned char *>(state.data())};
+
+  std::uint64_t hash{14695981039346656037ull};
+  for (std::size_t i = 0; i < sizeof(System::ScalarT) * state.size(); ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+
+  std::ostringstream out;
+  out << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return out.str();
+}
+
+PerfResult runPerfScenario(const Scene &scene, const UnsignedInt steps,
+                           const Double minSeconds) {
+  const auto integrator{integratorByIndex(scene.integrator, scene.newton)};
+  if (!integrator)
+    throw std::runtime_error("Unknown integrator");
+
+  PerfResult result;
+  Double seconds{0.0};
+  std::size_t timedSteps{0};
+
+  for (std::size_t run = 0; run == 0 || seconds < minSeconds; ++run) {
+    const auto system{createSystem(scene)};
+
+    measureStep(integrator, *system, scene.stepLength);
+    for (UnsignedInt i = 1; i < steps; ++i)
+      seconds += measureStep(integrator, *system, scene.stepLength).seconds;
+    timedSteps += steps - 1;
+
+    const auto hash{stateHash(*system)};
+    if (run > 0) {
+      result.deterministic &= hash == result.hash;
+      continue;
+    }
+
+    // The positions must be a view into the state, a copy would allocate
+    // on every draw
+    const auto &state{system->getState()};
+    const auto positions{system->getParticlePositions(state)};
+    if (static_cast<const void *>(positions.data()) != state.data() ||
+        positions.size() != system->getParticleCount())
+      throw std::runtime_error("Particle positions are not viewed in place");
+
+    result.energy = Double(system->getKineticEnergy(state));
+    if (const auto cloth = dynamic_cast<const Cloth *>(system.get()))
+      result.springEnergy = Double(cloth->getSpringEnergy(state));
+    result.hash = hash;
+
+    if (!std::isfinite(result.energy) || !std::isfinite(result.springEnergy))
+      throw std::runtime_error("Simulation diverged");
+
+    // Nothing to time
+    if (steps < 2)
+      break;
+  }
+
+  result.stepsPerSecond = Double(timedSteps) / Math::max(seconds, 1e-9);
+  return result;
+}
+
+std::size_t runPerfSuite(const std::string &baselineFile,
+                         const PerfOptions &options) {
+  auto baseline{readPerfBaseline(baselineFile)};
+  const Double timeTolerance{options.timeTolerance > 0.0
+                                 ? options.timeTolerance
+                                 : baseline.timeTolerance};
+  const auto directory{Corrade::Utility::Directory::path(baselineFile)};
+
+  // Timings are only comparable with the same number of threads, the states
+  // of the runs only with parallel sums in a fixed order
+  auto &pool{TaskPool::shared()};
+  pool.setThreadCount(baseline.threads);
+  pool.setDeterministic(true);
+
+  std::size_t failed{0};
+
+  for (auto &scenario : baseline.scenarios) {
+    try {
+      auto scene{loadScene(
+          Corrade::Utility::Directory::join(directory, scenario.scene))};
+      if (!scenario.integrator.empty())
+        scene.integrator = integratorIndex(scenario.integrator);
+
+      auto result{
+          runPerfScenario(scene, scenario.steps, baseline.minSeconds)};
+      for (std::size_t i = 1; i < baseline.repeats; ++i) {
+        const auto repeat{
+            runPerfScenario(scene, scenario.steps, baseline.minSeconds)};
+        result.stepsPerSecond =
+            Math::max(result.stepsPerSecond, repeat.stepsPerSecond);
+        result.deterministic &=
+            repeat.deterministic && repeat.hash == result.hash;
+      }
+
+      const Double speed{scenario.stepsPerSecond > 0.0
+                             ? result.stepsPerSecond / scenario.stepsPerSecond
+                             : 1.0};
+      const Double energyError{relativeError(result.energy, scenario.energy)};
+      const Double springEnergyError{
+          relativeError(result.springEnergy, scenario.springEnergy)};
+
+      std::vector<const char *> failures;
+      if (!options.update) {
+        if (speed < 1.0 - timeTolerance)
+          failures.push_back("slower");
+        if (energyError > baseline.energyTolerance)
+          failures.push_back("energy");
+        if (springEnergyError > baseline.energyTolerance)
+          failures.push_back("spring energy");
+      }
+      if (!result.deterministic)
+        failures.push_back("nondeterministic");
+
+      Debug debug;
+      debug << scenario.name << Debug::nospace << ":"
+            << result.stepsPerSecond << "steps/s," << speed
+            << "of the baseline, energy" << result.energy
+            << Debug::nospace << ", spring energy" << result.springEnergy;
+
+      if (!failures.empty()) {
+        debug << Debug::nospace << ", failed:";
+        for (const auto failure : failures)
+          debug << failure;
+        ++failed;
+      }
+
+      if (options.update) {
+        scenario.stepsPerSecond = result.stepsPerSecond;
+        scenario.energy = result.energy;
+        scenario.springEnergy = result.springEnergy;
+      }
+    } catch (const std::exception &e) {
+      ++failed;
+      Error{} << scenario.name << Debug::nospace << ":" << e.what();
+    }
+  }
+
+  if (options.update && failed == 0)
+    writePerfBaseline(baselineFile, baseline);
+
+  return failed;
+}
+
+bool isPerfInvocation(const int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--perf") == 0)
+      return true;
+  }
+
+  return false;
+}
+
+int perfMain(const int argc, char **argv) {
+  Corrade::Utility::Arguments args;
+  args.addOption("perf")
+      .setHelp("perf", "baseline of the performance scenarios to compare to",
+               "FILE")
+      .addOption("tolerance", "0")
+      .setHelp("tolerance",
+               "allowed relative drop of the throughput, 0 for the one of "
+               "the baseline",
+               "T")
+      .addBooleanOption("update")
+      .setHelp("update", "record the measured values as the new baseline")
+      .parse(argc, argv);
+
+  PerfOptions options;
+  options.timeTolerance = args.value<Double>("tolerance");
+  options.update = args.isSet("update");
+
+  try {
+    const auto failed{runPerfSuite(args.value("perf"), options)};
+    Debug{} << failed << "scenarios failed";
+    return failed == 0 ? 0 : 1;
+  } catch (const std::exception &e) {
+    Error{} << e.what();
+    return 1;
+  }
+}
+} // namespace clothsim
@@ -0,0 +1,110 @@
+#ifndef CLOTHSIM_PERF_H
+#define CLOTHSIM_PERF_H
+
+#include <Magnum/Magnum.h>
+
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+namespace clothsim {
+using namespace Magnum;
+
+// A scene stepped a fixed number of times and what it gave when the baseline
+// was recorded
+struct PerfScenario {
+  std::string name;
+  // Relative to the baseline file
+  std::string scene;
+  // Replaces the integrator of the scene if not empty
+  std::string integrator;
+  UnsignedInt steps{100};
+
+  Double stepsPerSecond{0.0};
+  // Final kinetic energy
+  Double energy{0.0};
+  // Final elastic energy of all springs of a cloth, zero for other systems
+  Double springEnergy{0.0};
+};
+
+// Read from and written to a JSON file:
+//
+//   {
+//     "threads": 1,
+//     "repeats": 3,
+//     "minSeconds": 1,
+//     "timeTolerance": 0.25,
+//     "energyTolerance": 0.0001,
+//     "scenarios": [
+//       {
+//         "name": "cloth64-rk4",
+//         "scene": "cloth64.conf",
+//         "integrator": "rk4",
+//         "steps": 50,
+//         "stepsPerSecond": 412.5,
+//         "energy": 0.0123,
+//         "springEnergy": 0.0045
+//       }
+//     ]
+//   }
+//
+// A repeat runs the scenario from the start as often as needed to time at
+// least minSeconds of stepping, the best throughput of the repeats counts.
+// It fails when that drops by more than the time tolerance, when the final
+// kinetic or spring energy differs relatively by more than the energy
+// tolerance or when the runs on this machine do not end in exactly the same
+// state. The energies sum over all particles and springs, the spring energy
+// follows the deformation of the whole cloth rather than its rigid motion.
+struct PerfBaseline {
+  std::size_t threads{1};
+  std::size_t repeats{3};
+  Double minSeconds{1.0};
+  Double timeTolerance{0.25};
+  Double energyTolerance{1e-4};
+  std::vector<PerfScenario> scenarios;
+};
+
+// Both throw std::runtime_error for unreadable files or invalid contents
+PerfBaseline readPerfBaseline(const std::string &filename);
+void writePerfBaseline(const std::string &filename,
+                       const PerfBaseline &baseline);
+
+struct PerfResult {
+  Double stepsPerSecond{0.0};
+  Double energy{0.0};
+  Double springEnergy{0.0};
+  // Only comparable between runs on the same machine and build
+  std::string hash;
+  // Whether all runs ended in the same state
+  bool deterministic{true};
+};
+
+// Steps the scene with parallel sums in a fixed order, from the start again
+// until at least minSeconds were timed. The first step of every run sets up
+// the solvers and is not timed. The final state is the one of the first
+// run.
+PerfResult runPerfScenario(const Scene &scene, const UnsignedInt steps,
+                           const Double minSeconds);
+
+// 64 bit FNV-1a of the bytes of the state, in hexadecimal
+std::string stateHash(const System &system);
+
+struct PerfOptions {
+  // Overrides the tolerance of the baseline if positive
+  Double timeTolerance{0.0};
+  // Replaces the recorded values with the measured ones
+  bool update{false};
+};
+
+// Runs every scenario of the baseline and compares it, returns the number of
+// failed scenarios
+std::size_t runPerfSuite(const std::string &baselineFile,
+                         const PerfOptions &options);
+
+// Entry point for --perf on the command line
+bool isPerfInvocation(const int argc, char **argv);
+int perfMain(const int argc, char **argv);
+} // namespace clothsim
+
+#endif // CLOTHSIM_PERF_H
@@ -9,10 +9,7 @@
 #include <iostream>
 
 namespace clothsim {
-Planet::Planet(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-               Object3D &parent,
-               Magnum::SceneGraph::DrawableGroup3D &drawableGroup)
-    : System(phongShader, vertexShader, parent, drawableGroup) {
+Planet::Planet() {
   reset();
 }
 
@@ -84,19 +81,17 @@ System::Vector Planet::evalDerivative(const Vector &state) const {
   return d;
 }
 
-Corrade::Containers::Array<Magnum::Vector3>
-Planet::getParticlePositions(const Vector &state) const {
-  Corrade::Containers::Array<Magnum::Vector3> vertices{1};
+System::ScalarT Planet::getKineticEnergy(const Vector &state) const {
+  return 0.5f * getParticleMass() * state.segment(3, 3).squaredNorm();
+}
 
-  vertices[0].x() = static_cast<Float>(state(0));
-  vertices[0].y() = static_cast<Float>(state(1));
-  vertices[0].z() = static_cast<Float>(state(2));
+std::size_t Planet::getParticleCount() const { return 1; }
 
-  return vertices;
-}
+bool Planet::isSecondOrder() const { return true; }
 
-Corrade::Containers::Array<UnsignedInt> Planet::getMeshIndices() const {
-  return Corrade::Containers::Array<UnsignedInt>();
+Corrade::Containers::ArrayView<const UnsignedInt>
+Planet::getMeshIndices() const {
+  return nullptr;
 }
 
 } // namespace clothsim
@@ -18,17 +18,18 @@ using namespace Magnum;
 
 class Planet : public System {
 public:
-  Planet(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-         Object3D &parent, Magnum::SceneGraph::DrawableGroup3D &drawableGroup);
+  Planet();
   ~Planet() override;
 
-  Corrade::Containers::Array<Magnum::Vector3>
-  getParticlePositions(const Vector &state) const override;
+  std::size_t getParticleCount() const override;
+  bool isSecondOrder() const override;
 
-  Corrade::Containers::Array<UnsignedInt> getMeshIndices() const override;
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const override;
 
   Vector evalDerivative(const Vector &state) const override;
   SparseMatrix evalJacobian(const Vector &state) const override;
+  ScalarT getKineticEnergy(const Vector &state) const override;
 
   void reset() override;
 
@@ -0,0 +1,205 @@
+#include "PointCache.h"
+
+#include <Corrade/Utility/Debug.h>
+#include <Corrade/Utility/Directory.h>
+#include <Corrade/Utility/Endianness.h>
+#include <Corrade/Utility/String.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+struct Pc2Header {
+  char magic[12];
+  Int version;
+  Int pointCount;
+  Float startFrame;
+  Float sampleRate;
+  Int sampleCount;
+};
+
+static_assert(sizeof(Pc2Header) == 32, "Unexpected padding in the PC2 header");
+
+constexpr char Pc2Magic[12]{'P', 'O', 'I', 'N', 'T', 'C',
+                            'A', 'C', 'H', 'E', '2', '\0'};
+
+// First line of the rest meshes, marks them as safe to replace
+constexpr char RestMeshComment[]{"# Rest mesh of a clothsim point cache"};
+
+// A mesh of the user may have the same name, for example the one loaded
+// into the simulation
+void checkReplaceable(const std::string &filename) {
+  std::ifstream file{filename};
+  if (!file)
+    return;
+
+  std::string line;
+  std::getline(file, line);
+  if (line != RestMeshComment)
+    throw std::runtime_error("Not replacing " + filename +
+                             ", it was not written by the exporter");
+}
+
+void writeRestMesh(const std::string &filename,
+                   Corrade::Containers::ArrayView<const UnsignedInt> indices,
+                   Corrade::Containers::ArrayView<const Vector3> positions) {
+  checkReplaceable(filename);
+
+  std::ofstream file{filename, std::ios::trunc};
+  if (!file)
+    throw std::runtime_error("Cannot open " + filename + " for writing");
+
+  file << RestMeshComment << '\n';
+  for (const auto &p : positions)
+    file << "v " << p.x() << ' ' << p.y() << ' ' << p.z() << '\n';
+
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    file << "f " << indices[i] + 1 << ' ' << indices[i + 1] + 1 << ' '
+         << indices[i + 2] + 1 << '\n';
+  }
+
+  if (!file)
+    throw std::runtime_error("Writing " + filename + " failed");
+}
+
+std::string temporaryFilename(const std::string &filename) {
+  return filename + ".tmp";
+}
+} // namespace
+
+PointCacheFormat pointCacheFormat(const std::string &filename) {
+  return Corrade::Utility::String::endsWith(
+             Corrade::Utility::String::lowercase(filename), ".mdd")
+             ? PointCacheFormat::Mdd
+             : PointCacheFormat::Pc2;
+}
+
+PointCacheWriter::PointCacheWriter(
+    const std::string &filename,
+    Corrade::Containers::ArrayView<const UnsignedInt> meshIndices,
+    Corrade::Containers::ArrayView<const Vector3> restPositions,
+    const UnsignedInt frameStride)
+    : m_filename{filename}, m_format{pointCacheFormat(filename)},
+      m_particleCount{restPositions.size()}, m_frameStride{frameStride} {
+  if (frameStride == 0)
+    throw std::runtime_error("Invalid frame stride");
+
+  writeRestMesh(
+      Corrade::Utility::Directory::splitExtension(filename).first +
+          ".rest.obj",
+      meshIndices, restPositions);
+
+  if (m_format == PointCacheFormat::Pc2) {
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+
+    // The sample count is patched when finishing
+    Pc2Header header{};
+    std::memcpy(header.magic, Pc2Magic, sizeof(Pc2Magic));
+    header.version = 1;
+    header.pointCount = static_cast<Int>(m_particleCount);
+    // Frames between two samples
+    header.sampleRate = Float(frameStride);
+    m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  } else {
+    m_file.open(temporaryFilename(filename),
+                std::ios::binary | std::ios::trunc);
+    m_buffer.resize(m_particleCount * 3);
+  }
+
+  if (!m_file)
+    throw std::runtime_error("Cannot open " + filename + " for writing");
+}
+
+PointCacheWriter::~PointCacheWriter() {
+  if (!m_finished)
+    finish();
+}
+
+void PointCacheWriter::record(
+    const Double time,
+    Corrade::Containers::ArrayView<const Vector3> positions) {
+  if (positions.size() != m_particleCount)
+    throw std::runtime_error("Particle count changed during export");
+
+  if (m_recorded++ % m_frameStride != 0)
+    return;
+
+  // PC2 is little endian like the simulation data, MDD is big endian
+  if (m_format == PointCacheFormat::Pc2) {
+    m_file.write(reinterpret_cast<const char *>(positions.data()),
+                 static_cast<std::streamsize>(positions.size() *
+                                              sizeof(Vector3)));
+    m_times.push_back(static_cast<Float>(time));
+    return;
+  }
+
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    for (std::size_t c = 0; c < 3; ++c)
+      m_buffer[i * 3 + c] =
+          Corrade::Utility::Endianness::bigEndian(positions[i][c]);
+  }
+
+  m_file.write(reinterpret_cast<const char *>(m_buffer.data()),
+               static_cast<std::streamsize>(m_buffer.size() * sizeof(Float)));
+  m_times.push_back(static_cast<Float>(time));
+}
+
+std::size_t PointCacheWriter::finish() {
+  m_finished = true;
+
+  if (m_format == PointCacheFormat::Pc2)
+    finishPc2();
+  else
+    finishMdd();
+
+  return m_times.size();
+}
+
+void PointCacheWriter::finishPc2() {
+  const auto sampleCount{static_cast<Int>(m_times.size())};
+  m_file.seekp(offsetof(Pc2Header, sampleCount));
+  m_file.write(reinterpret_cast<const char *>(&sampleCount),
+               sizeof(sampleCount));
+  m_file.close();
+
+  if (!m_file)
+    Corrade::Utility::Error{} << "Writing the point cache failed";
+}
+
+void PointCacheWriter::finishMdd() {
+  m_file.close();
+  const auto temporary{temporaryFilename(m_filename)};
+
+  if (!m_file) {
+    Corrade::Utility::Error{} << "Writing the point cache failed";
+    std::remove(temporary.data());
+    return;
+  }
+
+  std::ofstream out{m_filename, std::ios::binary | std::ios::trunc};
+  const Int header[]{
+      Corrade::Utility::Endianness::bigEndian(Int(m_times.size())),
+      Corrade::Utility::Endianness::bigEndian(Int(m_particleCount))};
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+  for (auto &time : m_times)
+    time = Corrade::Utility::Endianness::bigEndian(time);
+
+  out.write(reinterpret_cast<const char *>(m_times.data()),
+            static_cast<std::streamsize>(m_times.size() * sizeof(Float)));
+
+  if (!m_times.empty()) {
+    std::ifstream in{temporary, std::ios::binary};
+    out << in.rdbuf();
+  }
+
+  out.close();
+  std::remove(temporary.data());
+
+  if (!out)
+    Corrade::Utility::Error{} << "Writing the point cache failed";
+}
+} // namespace clothsim
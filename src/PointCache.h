@@ -0,0 +1,63 @@
+#ifndef CLOTHSIM_POINTCACHE_H
+#define CLOTHSIM_POINTCACHE_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+enum class PointCacheFormat { Pc2, Mdd };
+
+// MDD for the .mdd extension, PC2 otherwise
+PointCacheFormat pointCacheFormat(const std::string &filename);
+
+// Streams particle positions into a PC2 or MDD point cache. The rest mesh
+// is written next to it as <base name>.rest.obj so that the cache can be
+// applied to it in external tools. Throws std::runtime_error rather than
+// replace an existing file of that name not written by the exporter. Only
+// every frameStride-th recorded frame is exported.
+class PointCacheWriter {
+public:
+  PointCacheWriter(const std::string &filename,
+                   Corrade::Containers::ArrayView<const UnsignedInt> meshIndices,
+                   Corrade::Containers::ArrayView<const Vector3> restPositions,
+                   const UnsignedInt frameStride = 1);
+  ~PointCacheWriter();
+
+  PointCacheWriter(const PointCacheWriter &) = delete;
+  PointCacheWriter &operator=(const PointCacheWriter &) = delete;
+
+  void record(const Double time,
+              Corrade::Containers::ArrayView<const Vector3> positions);
+
+  // Completes the file and returns the number of exported frames. Called by
+  // the destructor if not called explicitly.
+  std::size_t finish();
+
+private:
+  void finishPc2();
+  void finishMdd();
+
+  std::string m_filename;
+  PointCacheFormat m_format;
+  std::ofstream m_file;
+  std::size_t m_particleCount;
+  UnsignedInt m_frameStride;
+  std::size_t m_recorded{0};
+  bool m_finished{false};
+
+  // MDD stores all frame times before the positions, so the positions
+  // are streamed into a temporary file until the frame count is known
+  std::vector<Float> m_times;
+  std::vector<Float> m_buffer;
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_POINTCACHE_H
@@ -0,0 +1,274 @@
+#include "Scene.h"
+
+#include <Corrade/Utility/Configuration.h>
+#include <Corrade/Utility/Directory.h>
+
+#include <Magnum/Math/ConfigurationValue.h>
+
+#include "Cloth.h"
+#include "Integrators.h"
+#include "NBody.h"
+#include "Oscillator.h"
+#include "Planet.h"
+#include "TriangleMesh.h"
+
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+using Corrade::Utility::ConfigurationGroup;
+
+template <typename T>
+void readValue(const ConfigurationGroup *group, const std::string &key,
+               T &value) {
+  if (group && group->hasValue(key))
+    value = group->value<T>(key);
+}
+
+std::string readPath(const ConfigurationGroup *group, const std::string &key,
+                     const std::string &directory) {
+  if (!group || !group->hasValue(key))
+    return {};
+
+  return Corrade::Utility::Directory::join(directory,
+                                           group->value<std::string>(key));
+}
+
+std::size_t systemIndex(const std::string &name) {
+  if (name == "oscillator")
+    return 0;
+  if (name == "planet")
+    return 1;
+  if (name == "cloth")
+    return 2;
+  if (name == "nbody")
+    return 3;
+
+  throw std::runtime_error("Unknown system " + name);
+}
+
+ColliderDescription::Type colliderType(const std::string &name) {
+  if (name == "sphere")
+    return ColliderDescription::Type::Sphere;
+  if (name == "capsule")
+    return ColliderDescription::Type::Capsule;
+  if (name == "plane")
+    return ColliderDescription::Type::Plane;
+  if (name == "mesh")
+    return ColliderDescription::Type::Mesh;
+
+  throw std::runtime_error("Unknown collider " + name);
+}
+
+ColliderDescription readCollider(const ConfigurationGroup *group,
+                                 const std::string &directory) {
+  ColliderDescription collider;
+
+  if (group->hasValue("type"))
+    collider.type = colliderType(group->value("type"));
+
+  readValue(group, "center", collider.center);
+  readValue(group, "radius", collider.radius);
+  readValue(group, "a", collider.a);
+  readValue(group, "b", collider.b);
+  readValue(group, "point", collider.point);
+  readValue(group, "normal", collider.normal);
+  collider.mesh = readPath(group, "mesh", directory);
+
+  readValue(group, "velocity", collider.motion.velocity);
+  readValue(group, "angularVelocity", collider.motion.angularVelocity);
+  readValue(group, "pivot", collider.motion.pivot);
+  readValue(group, "friction", collider.friction);
+  readValue(group, "thickness", collider.thickness);
+
+  if (collider.type == ColliderDescription::Type::Mesh &&
+      collider.mesh.empty())
+    throw std::runtime_error("Mesh collider without a mesh");
+
+  if (collider.normal.dot() == 0.0f || collider.friction < 0.0f ||
+      collider.thickness < 0.0f)
+    throw std::runtime_error("Invalid collider parameters");
+
+  return collider;
+}
+} // namespace
+
+Scene loadScene(const std::string &filename) {
+  const Corrade::Utility::Configuration conf{
+      filename, Corrade::Utility::Configuration::Flag::ReadOnly};
+
+  if (!conf.isValid() || !Corrade::Utility::Directory::exists(filename))
+    throw std::runtime_error("Cannot read scene " + filename);
+
+  const auto directory{Corrade::Utility::Directory::path(filename)};
+
+  Scene scene;
+  scene.name = Corrade::Utility::Directory::splitExtension(
+                   Corrade::Utility::Directory::filename(filename))
+                   .first;
+
+  if (conf.hasValue("system"))
+    scene.systemType = systemIndex(conf.value("system"));
+  if (conf.hasValue("integrator"))
+    scene.integrator = integratorIndex(conf.value("integrator"));
+
+  if (conf.hasValue("solver"))
+    scene.solver = linearSolverType(conf.value("solver"));
+
+  readValue(&conf, "stepLength", scene.stepLength);
+  readValue(&conf, "stepsPerFrame", scene.stepsPerFrame);
+
+  const auto newton{conf.group("newton")};
+  readValue(newton, "relativeTolerance", scene.newton.relativeTolerance);
+  readValue(newton, "absoluteTolerance", scene.newton.absoluteTolerance);
+  readValue(newton, "maxIterations", scene.newton.maxIterations);
+  readValue(newton, "reuseJacobian", scene.newton.reuseJacobian);
+  readValue(newton, "maxContraction", scene.newton.maxContraction);
+  readValue(newton, "lineSearch", scene.newton.lineSearch);
+  readValue(newton, "maxBacktracks", scene.newton.maxBacktracks);
+  if (newton && newton->hasValue("predictor"))
+    scene.newton.predictor = newtonPredictor(newton->value("predictor"));
+
+  const auto cloth{conf.group("cloth")};
+  readValue(cloth, "size", scene.clothSize);
+  readValue(cloth, "extent", scene.clothExtent);
+  readValue(cloth, "stiffness", scene.stiffness);
+  readValue(cloth, "drag", scene.drag);
+  readValue(cloth, "mass", scene.particleMass);
+  scene.mesh = readPath(cloth, "mesh", directory);
+
+  if (cloth && cloth->hasValue("pin")) {
+    scene.hasPins = true;
+    scene.pins = cloth->values<UnsignedInt>("pin");
+  }
+
+  const auto collision{conf.group("collision")};
+  readValue(collision, "enabled", scene.selfCollision.enabled);
+  readValue(collision, "thickness", scene.selfCollision.thickness);
+  readValue(collision, "cellSize", scene.selfCollision.cellSize);
+  readValue(collision, "continuous", scene.selfCollision.continuous);
+
+  const auto sleep{conf.group("sleep")};
+  readValue(sleep, "enabled", scene.sleep.enabled);
+  readValue(sleep, "velocity", scene.sleep.velocity);
+  readValue(sleep, "acceleration", scene.sleep.acceleration);
+  readValue(sleep, "steps", scene.sleep.steps);
+
+  const auto nbody{conf.group("nbody")};
+  readValue(nbody, "bodies", scene.nbody.bodies);
+  readValue(nbody, "mass", scene.nbody.totalMass);
+  readValue(nbody, "radius", scene.nbody.radius);
+  readValue(nbody, "openingAngle", scene.nbody.openingAngle);
+  readValue(nbody, "softening", scene.nbody.softening);
+  if (nbody && nbody->hasValue("method"))
+    scene.nbody.method = gravityMethod(nbody->value("method"));
+
+  for (const auto group : conf.groups("collider"))
+    scene.colliders.push_back(readCollider(group, directory));
+
+  const auto output{conf.group("output")};
+  readValue(output, "frames", scene.frames);
+  readValue(output, "exportStride", scene.exportStride);
+  scene.pointCache = readPath(output, "pointCache", directory);
+  scene.trajectory = readPath(output, "trajectory", directory);
+  scene.checkpoint = readPath(output, "checkpoint", directory);
+  scene.telemetry = readPath(output, "telemetry", directory);
+
+  if (!(scene.stepLength > 0.0f) || scene.stepsPerFrame == 0 ||
+      scene.exportStride == 0)
+    throw std::runtime_error("Invalid stepping parameters in " + filename);
+
+  if (scene.newton.maxIterations == 0 ||
+      !(scene.newton.relativeTolerance >= 0.0f) ||
+      !(scene.newton.absoluteTolerance >= 0.0f) ||
+      !(scene.newton.maxContraction > 0.0f))
+    throw std::runtime_error("Invalid Newton parameters in " + filename);
+
+  if (scene.clothSize.x() < 2 || scene.clothSize.y() < 2)
+    throw std::runtime_error("Invalid cloth size in " + filename);
+
+  return scene;
+}
+
+std::unique_ptr<Collider> createCollider(const ColliderDescription &collider) {
+  std::unique_ptr<Collider> result;
+
+  switch (collider.type) {
+  case ColliderDescription::Type::Sphere:
+    result = std::make_unique<SphereCollider>(collider.center, collider.radius);
+    break;
+  case ColliderDescription::Type::Capsule:
+    result = std::make_unique<CapsuleCollider>(collider.a, collider.b,
+                                               collider.radius);
+    break;
+  case ColliderDescription::Type::Plane:
+    result = std::make_unique<PlaneCollider>(collider.point, collider.normal);
+    break;
+  case ColliderDescription::Type::Mesh: {
+    auto mesh{loadTriangleMesh(collider.mesh)};
+    result = std::make_unique<MeshCollider>(std::move(mesh.positions),
+                                            std::move(mesh.indices));
+    break;
+  }
+  }
+
+  result->motion = collider.motion;
+  result->friction = collider.friction;
+  result->thickness = collider.thickness;
+  return result;
+}
+
+std::unique_ptr<System> createSystem(const Scene &scene) {
+  std::unique_ptr<System> system;
+
+  switch (scene.systemType) {
+  case 0:
+    system = std::make_unique<Oscillator>();
+    break;
+  case 1:
+    system = std::make_unique<Planet>();
+    break;
+  case 2: {
+    auto cloth{std::make_unique<Cloth>()};
+    cloth->setStiffness(scene.stiffness);
+    cloth->setDragCoefficient(scene.drag);
+    cloth->setExtent(scene.clothExtent);
+    cloth->setSelfCollisionSettings(scene.selfCollision);
+    cloth->setSleepSettings(scene.sleep);
+
+    for (const auto &collider : scene.colliders)
+      cloth->addCollider(createCollider(collider));
+
+    if (scene.mesh.empty())
+      cloth->setSize(scene.clothSize);
+    else
+      cloth->loadMesh(scene.mesh);
+
+    system = std::move(cloth);
+    break;
+  }
+  case 3:
+    system = std::make_unique<NBody>(scene.nbody);
+    break;
+  default:
+    throw std::runtime_error("Unknown system type");
+  }
+
+  system->setParticleMass(scene.particleMass);
+  system->getSolver().setType(scene.solver);
+
+  if (scene.hasPins) {
+    system->clearPinnedParticles();
+
+    for (const auto pin : scene.pins) {
+      if (pin >= system->getParticleCount())
+        throw std::runtime_error("Pinned particle " + std::to_string(pin) +
+                                 " does not exist");
+
+      system->setPinnedParticle(pin, true);
+    }
+  }
+
+  return system;
+}
+} // namespace clothsim
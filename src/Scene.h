@@ -0,0 +1,154 @@
+#ifndef CLOTHSIM_SCENE_H
+#define CLOTHSIM_SCENE_H
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector2.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "Cloth.h"
+#include "Colliders.h"
+#include "Collision.h"
+#include "Integrators.h"
+#include "NBody.h"
+#include "Solver.h"
+#include "System.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Everything needed to set up and run a simulation without the UI. Read
+// from a Corrade configuration file:
+//
+//   system=cloth
+//   integrator=backwardEuler
+//   stepLength=0.001
+//   stepsPerFrame=5
+//   solver=multigrid
+//
+//   [newton]
+//   relativeTolerance=0.001
+//   absoluteTolerance=0.000001
+//   maxIterations=10
+//   reuseJacobian=true
+//   maxContraction=0.5
+//   lineSearch=true
+//   maxBacktracks=4
+//   predictor=quadratic
+//
+//   [cloth]
+//   size=32 32
+//   extent=1.5 1.5
+//   stiffness=300
+//   drag=0.08
+//   mass=0.025
+//   mesh=flag.obj
+//   pin=0
+//   pin=31
+//
+//   [collision]
+//   enabled=true
+//   thickness=0.01
+//   cellSize=0
+//   continuous=false
+//
+//   [sleep]
+//   enabled=true
+//   velocity=0.01
+//   acceleration=0.1
+//   steps=50
+//
+//   [nbody]
+//   bodies=100000
+//   mass=1
+//   radius=1
+//   openingAngle=0.5
+//   softening=0.01
+//   method=barnesHut
+//
+//   [collider]
+//   type=sphere
+//   center=0 -0.5 0.3
+//   radius=0.2
+//   velocity=0 0 0
+//   angularVelocity=0 1 0
+//   pivot=0 0 0
+//   friction=0.3
+//   thickness=0.005
+//
+//   [output]
+//   frames=600
+//   pointCache=flag.pc2
+//   exportStride=2
+//   trajectory=flag.trajectory
+//   checkpoint=flag.checkpoint
+//   telemetry=flag.csv
+//
+// Every key is optional. The newton group applies to the implicit
+// integrators. Without pin entries the default pins of the
+// system are kept. Relative paths are relative to the scene file. The
+// collider group can be repeated, its type is sphere (center, radius),
+// capsule (a, b, radius), plane (point, normal) or mesh (mesh).
+struct ColliderDescription {
+  enum class Type { Sphere, Capsule, Plane, Mesh };
+
+  Type type{Type::Sphere};
+  Vector3 center{0.0f};
+  Float radius{0.1f};
+  Vector3 a{0.0f};
+  Vector3 b{0.0f, 1.0f, 0.0f};
+  Vector3 point{0.0f};
+  Vector3 normal{0.0f, 1.0f, 0.0f};
+  std::string mesh;
+
+  ColliderMotion motion;
+  Float friction{0.3f};
+  Float thickness{0.005f};
+};
+
+// Throws std::runtime_error if a mesh cannot be loaded
+std::unique_ptr<Collider> createCollider(const ColliderDescription &collider);
+
+struct Scene {
+  std::string name;
+
+  std::size_t systemType{2};
+  std::size_t integrator{0};
+  Float stepLength{0.0001f};
+  UnsignedInt stepsPerFrame{5};
+  LinearSolverType solver{LinearSolverType::SparseLU};
+  NewtonPolicy newton;
+
+  Vector2ui clothSize{32, 32};
+  Vector2 clothExtent{1.5f, 1.5f};
+  Float stiffness{300.0f};
+  Float drag{0.08f};
+  Float particleMass{0.025f};
+  std::string mesh;
+  bool hasPins{false};
+  std::vector<UnsignedInt> pins;
+  SelfCollisionSettings selfCollision;
+  SleepSettings sleep;
+  NBodySettings nbody;
+  std::vector<ColliderDescription> colliders;
+
+  UnsignedInt frames{100};
+  std::string pointCache;
+  UnsignedInt exportStride{1};
+  std::string trajectory;
+  std::string checkpoint;
+  // Work of every step, see writeTelemetry
+  std::string telemetry;
+};
+
+// Throws std::runtime_error for unreadable files or invalid values
+Scene loadScene(const std::string &filename);
+
+// Creates the system with all parameters of the scene applied
+std::unique_ptr<System> createSystem(const Scene &scene);
+} // namespace clothsim
+
+#endif // CLOTHSIM_SCENE_H
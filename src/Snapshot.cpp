@@ -0,0 +1,42 @@
+#include "Snapshot.h"
+#include "TaskPool.h"
+
+#include <cassert>
+
+namespace clothsim {
+void takeSnapshot(System &system, const Double time,
+                  SimulationSnapshot &snapshot) {
+  const auto indices{system.getMeshIndices()};
+  const auto vertices{system.getMeshVertices()};
+  const auto colors{system.getVertexMarkerColors()};
+
+  snapshot.time = time;
+  snapshot.indices.assign(indices.begin(), indices.end());
+  snapshot.vertices.assign(vertices.begin(), vertices.end());
+  snapshot.markerColors.assign(colors.begin(), colors.end());
+}
+
+void interleaveFlatTriangles(
+    const Corrade::Containers::ArrayView<const UnsignedInt> indices,
+    const Corrade::Containers::ArrayView<const Magnum::Vector3> vertices,
+    const Corrade::Containers::ArrayView<Magnum::Vector3> data) {
+  assert(data.size() == 2 * indices.size());
+
+  const std::size_t triangles{indices.size() / 3};
+
+  parallelFor(TaskStage::Normals, triangles, 0, [&](const std::size_t t) {
+    const std::size_t i{3 * t};
+    const Vector3 a{vertices[indices[i]]};
+    const Vector3 b{vertices[indices[i + 1]]};
+    const Vector3 c{vertices[indices[i + 2]]};
+    const Vector3 normal{Magnum::Math::cross(b - a, c - a).normalized()};
+
+    data[2 * i] = a;
+    data[2 * i + 1] = normal;
+    data[2 * i + 2] = b;
+    data[2 * i + 3] = normal;
+    data[2 * i + 4] = c;
+    data[2 * i + 5] = normal;
+  });
+}
+} // namespace clothsim
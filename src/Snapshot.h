@@ -0,0 +1,39 @@
+#ifndef CLOTHSIM_SNAPSHOT_H
+#define CLOTHSIM_SNAPSHOT_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Color.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "System.h"
+
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Copy of what is drawn of a system, taken after it was stepped
+struct SimulationSnapshot {
+  Double time{0.0};
+  std::vector<UnsignedInt> indices;
+  std::vector<Magnum::Vector3> vertices;
+  std::vector<Magnum::Color3> markerColors;
+};
+
+// Copies the mesh and the marker colors of the system into the snapshot.
+// Reuses its memory, so taking a snapshot of a system of the same size as
+// the last one does not allocate.
+void takeSnapshot(System &system, const Double time,
+                  SimulationSnapshot &snapshot);
+
+// Writes position and flat normal of every triangle corner of the mesh to
+// data, which must hold two vectors per index
+void interleaveFlatTriangles(
+    Corrade::Containers::ArrayView<const UnsignedInt> indices,
+    Corrade::Containers::ArrayView<const Magnum::Vector3> vertices,
+    Corrade::Containers::ArrayView<Magnum::Vector3> data);
+} // namespace clothsim
+
+#endif // CLOTHSIM_SNAPSHOT_H
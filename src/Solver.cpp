@@ -0,0 +1,307 @@
+#include "Solver.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+namespace clothsim {
+namespace {
+constexpr ImplicitSolver::ScalarT Tolerance{1e-5f};
+constexpr std::size_t MaxIterations{100};
+
+using ScalarT = ImplicitSolver::ScalarT;
+using Vector = ImplicitSolver::Vector;
+using SparseMatrix = ImplicitSolver::SparseMatrix;
+} // namespace
+
+ImplicitSolver::ReducedSystem
+ImplicitSolver::reduce(const System &system, const SparseMatrix &dfdx,
+                       const ScalarT h) {
+  const Eigen::Index n{3 * Eigen::Index(system.getParticleCount())};
+
+  ReducedSystem reduced{SparseMatrix{n, n}, dfdx.bottomLeftCorner(n, n),
+                        dfdx.bottomRightCorner(n, n), std::vector<char>(n, 0)};
+  auto &A{reduced.A};
+  auto &fixed{reduced.fixed};
+
+  A.setIdentity();
+  A = A - h * reduced.dadv - (h * h) * reduced.dadx;
+
+  const auto fix{[&](const UnsignedInt id) {
+    for (Eigen::Index k = 0; k < 3; ++k)
+      fixed[3 * Eigen::Index(id) + k] = 1;
+  }};
+  for (const auto id : system.getPinnedParticleIds())
+    fix(id);
+  for (const auto id : system.getSleepingParticleIds())
+    fix(id);
+
+  // Keeping the diagonal leaves the matrix compressed when it is set below
+  A.prune([&](const Eigen::Index row, const Eigen::Index col, const ScalarT) {
+    return row == col || (!fixed[row] && !fixed[col]);
+  });
+  for (Eigen::Index i = 0; i < n; ++i) {
+    if (fixed[i])
+      A.coeffRef(i, i) = 1.0f;
+  }
+
+  return reduced;
+}
+
+Vector ImplicitSolver::reduceRhs(const ReducedSystem &reduced,
+                                 const Vector &b, const ScalarT h) {
+  const Eigen::Index n{reduced.A.rows()};
+  const Vector rx{b.head(n)};
+  const Vector rv{b.tail(n)};
+
+  Vector rhs{rv + h * (reduced.dadx * rx)};
+
+  // Velocity changes of pinned and sleeping particles are known, move them to
+  // the right hand side to keep the matrix symmetric
+  Vector known{Vector::Zero(n)};
+  for (Eigen::Index i = 0; i < n; ++i) {
+    if (reduced.fixed[i])
+      known[i] = rv[i];
+  }
+
+  rhs -= known - h * (reduced.dadv * known) -
+         (h * h) * (reduced.dadx * known);
+  for (Eigen::Index i = 0; i < n; ++i) {
+    if (reduced.fixed[i])
+      rhs[i] = known[i];
+  }
+
+  return rhs;
+}
+
+// Positions follow from the velocity changes, except for removed particles
+Vector ImplicitSolver::expand(const ReducedSystem &reduced, const Vector &b,
+                              const Vector &dv, const ScalarT h) {
+  const Eigen::Index n{dv.size()};
+  const Vector rx{b.head(n)};
+
+  Vector dx{2 * n};
+  dx.tail(n) = dv;
+  dx.head(n) = rx + h * dv;
+  for (Eigen::Index i = 0; i < n; ++i) {
+    if (reduced.fixed[i])
+      dx[i] = rx[i];
+  }
+
+  return dx;
+}
+
+std::vector<UnsignedInt>
+ImplicitSolver::fixedParticles(const System &system) {
+  const auto &pinned{system.getPinnedParticleIds()};
+  const auto sleeping{system.getSleepingParticleIds()};
+
+  std::vector<UnsignedInt> fixed(pinned.begin(), pinned.end());
+  fixed.insert(fixed.end(), sleeping.begin(), sleeping.end());
+  return fixed;
+}
+
+void ImplicitSolver::setType(const LinearSolverType type) { m_type = type; }
+
+LinearSolverType ImplicitSolver::getType() const { return m_type; }
+
+void ImplicitSolver::factorize(const System &system, const SparseMatrix &dfdx,
+                               const ScalarT h) {
+  const auto gridSize{system.getGridSize()};
+  m_method = Method::None;
+
+  if (m_type == LinearSolverType::Multigrid && system.isSecondOrder() &&
+      gridSize.product() > 0)
+    factorizeMultigrid(system, dfdx, h);
+  else if (m_type == LinearSolverType::LDLT && system.isSecondOrder())
+    factorizeLDLT(system, dfdx, h);
+  else
+    factorizeSparseLU(dfdx, h);
+
+  // Multigrid may still fall back to SparseLU when solving
+  m_dfdx = dfdx;
+  m_h = h;
+  m_factoredType = m_type;
+  m_fixedParticles = fixedParticles(system);
+  m_statistics.jacobianUpdates += 1;
+}
+
+bool ImplicitSolver::isFactorizationValid(const System &system,
+                                          const ScalarT h) const {
+  return m_method != Method::None && m_factoredType == m_type && m_h == h &&
+         m_dfdx.rows() == system.getState().size() &&
+         m_fixedParticles == fixedParticles(system);
+}
+
+void ImplicitSolver::invalidateFactorization() { m_method = Method::None; }
+
+ImplicitSolver::Vector ImplicitSolver::solveFactorized(const Vector &b) {
+  using namespace std::chrono;
+  const auto start{steady_clock::now()};
+
+  Vector dx;
+
+  switch (m_method) {
+  case Method::None:
+    throw std::runtime_error("Nothing factorized to solve with");
+  case Method::SparseLU:
+    dx = solveSparseLU(b);
+    break;
+  case Method::Multigrid: {
+    Vector dv{Vector::Zero(m_reduced.A.rows())};
+    std::size_t iterations;
+    const bool converged{m_multigrid.solve(reduceRhs(m_reduced, b, m_h), dv,
+                                           Tolerance, MaxIterations,
+                                           iterations)};
+    m_statistics.iterations += iterations;
+
+    if (converged) {
+      dx = expand(m_reduced, b, dv, m_h);
+    } else {
+      // Later solves with this Jacobian go to SparseLU right away
+      m_statistics.fallbacks += 1;
+      factorizeSparseLU(m_dfdx, m_h);
+      dx = solveSparseLU(b);
+    }
+    break;
+  }
+  case Method::LDLT:
+    dx = expand(m_reduced, b, m_ldlt.solve(reduceRhs(m_reduced, b, m_h)),
+                m_h);
+    break;
+  }
+
+  m_statistics.solves += 1;
+  m_statistics.solveSeconds +=
+      duration<Double>(steady_clock::now() - start).count();
+
+  return dx;
+}
+
+ImplicitSolver::Vector ImplicitSolver::solve(const System &system,
+                                             const SparseMatrix &dfdx,
+                                             const Vector &b,
+                                             const ScalarT h) {
+  factorize(system, dfdx, h);
+  return solveFactorized(b);
+}
+
+void ImplicitSolver::factorizeSparseLU(const SparseMatrix &dfdx,
+                                       const ScalarT h) {
+  using namespace std::chrono;
+  const auto start{steady_clock::now()};
+
+  SparseMatrix J{dfdx.rows(), dfdx.cols()};
+  J.setIdentity();
+  J = J - h * dfdx;
+
+  m_lu.compute(J);
+
+  if (m_lu.info() != Eigen::Success) {
+    throw std::runtime_error("Solver failed");
+  }
+
+  m_method = Method::SparseLU;
+  m_statistics.factorizations += 1;
+  m_statistics.factorNonZeros += std::size_t(m_lu.nnzL() + m_lu.nnzU());
+  m_statistics.factorSeconds +=
+      duration<Double>(steady_clock::now() - start).count();
+}
+
+ImplicitSolver::Vector ImplicitSolver::solveSparseLU(const Vector &b) {
+  Vector dx{m_lu.solve(b)};
+
+  if (m_lu.info() != Eigen::Success) {
+    throw std::runtime_error("Solver failed");
+  }
+
+  return dx;
+}
+
+void ImplicitSolver::factorizeMultigrid(const System &system,
+                                        const SparseMatrix &dfdx,
+                                        const ScalarT h) {
+  using namespace std::chrono;
+  const auto start{steady_clock::now()};
+
+  m_reduced = reduce(system, dfdx, h);
+  m_multigrid.setup(m_reduced.A, system.getGridSize());
+  m_method = Method::Multigrid;
+
+  m_statistics.setupSeconds +=
+      duration<Double>(steady_clock::now() - start).count();
+}
+
+void ImplicitSolver::factorizeLDLT(const System &system,
+                                   const SparseMatrix &dfdx, const ScalarT h) {
+  using namespace std::chrono;
+  const auto start{steady_clock::now()};
+
+  m_reduced = reduce(system, dfdx, h);
+  const auto &A{m_reduced.A};
+  m_statistics.setupSeconds +=
+      duration<Double>(steady_clock::now() - start).count();
+
+  const auto factorStart{steady_clock::now()};
+
+  // The ordering and the elimination tree only depend on the sparsity
+  // pattern, which stays the same between Newton iterations and time steps
+  const std::vector<SparseMatrix::StorageIndex> outer(
+      A.outerIndexPtr(), A.outerIndexPtr() + A.outerSize() + 1);
+  const std::vector<SparseMatrix::StorageIndex> inner(
+      A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros());
+  if (outer != m_ldltOuter || inner != m_ldltInner) {
+    m_ldlt.analyzePattern(A);
+    m_ldltOuter = outer;
+    m_ldltInner = inner;
+  }
+
+  m_ldlt.factorize(A);
+  const Double factorSeconds{
+      duration<Double>(steady_clock::now() - factorStart).count()};
+
+  // LDLT factors indefinite matrices too, they come from strongly compressed
+  // springs. Those are left to the pivoting SparseLU.
+  if (m_ldlt.info() != Eigen::Success ||
+      (m_ldlt.vectorD().array() <= 0.0f).any()) {
+    m_statistics.fallbacks += 1;
+    m_statistics.fallbackSeconds += factorSeconds;
+    factorizeSparseLU(dfdx, h);
+    return;
+  }
+
+  m_statistics.factorSeconds += factorSeconds;
+  m_method = Method::LDLT;
+  m_statistics.factorizations += 1;
+  m_statistics.factorNonZeros +=
+      std::size_t(m_ldlt.matrixL().nestedExpression().nonZeros() + A.rows());
+}
+
+void ImplicitSolver::recordNewtonStep(const std::size_t iterations,
+                                      const std::size_t backtracks,
+                                      const Float initialResidual,
+                                      const Float finalResidual) {
+  m_statistics.steps += 1;
+  m_statistics.newtonIterations += iterations;
+  m_statistics.backtracks += backtracks;
+  m_statistics.initialResidual = initialResidual;
+  m_statistics.finalResidual = finalResidual;
+}
+
+const SolverStatistics &ImplicitSolver::getStatistics() const {
+  return m_statistics;
+}
+
+void ImplicitSolver::resetStatistics() { m_statistics = {}; }
+
+LinearSolverType linearSolverType(const std::string &name) {
+  if (name == "sparseLU")
+    return LinearSolverType::SparseLU;
+  if (name == "multigrid")
+    return LinearSolverType::Multigrid;
+  if (name == "ldlt")
+    return LinearSolverType::LDLT;
+
+  throw std::runtime_error("Unknown solver " + name);
+}
+} // namespace clothsim
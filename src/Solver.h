@@ -0,0 +1,154 @@
+#ifndef CLOTHSIM_SOLVER_H
+#define CLOTHSIM_SOLVER_H
+
+#include <Magnum/Magnum.h>
+
+#include <Eigen/SparseCholesky>
+#include <Eigen/SparseLU>
+
+#include <string>
+#include <vector>
+
+#include "Multigrid.h"
+#include "System.h"
+
+namespace clothsim {
+using namespace Magnum;
+
+// In the order of the UI selection
+enum class LinearSolverType : UnsignedInt {
+  SparseLU = 0,
+  Multigrid = 1,
+  LDLT = 2
+};
+
+struct SolverStatistics {
+  std::size_t solves{0};
+  // Conjugate gradient iterations of the multigrid solver
+  std::size_t iterations{0};
+  // Multigrid solves that did not converge and LDLT factorizations of
+  // matrices that were not positive definite, both redone with SparseLU
+  std::size_t fallbacks{0};
+  std::size_t factorizations{0};
+  // Summed over all factorizations, L and U for SparseLU, L and D for LDLT
+  std::size_t factorNonZeros{0};
+  Double setupSeconds{0.0};
+  // Of the counted factorizations only
+  Double factorSeconds{0.0};
+  // Spent in LDLT factorizations that failed and were redone with SparseLU
+  Double fallbackSeconds{0.0};
+  // Spent in solves with an existing factorization
+  Double solveSeconds{0.0};
+
+  // Implicit steps, their Newton iterations and line search backtracks
+  std::size_t steps{0};
+  std::size_t newtonIterations{0};
+  std::size_t backtracks{0};
+  // Jacobians factored or set up for multigrid
+  std::size_t jacobianUpdates{0};
+  // Residual norms of the last implicit step before and after its iterations
+  Float initialResidual{0.0f};
+  Float finalResidual{0.0f};
+};
+
+// Solves the linear systems of the Newton iterations of the implicit
+// integrators. SparseLU factors the whole system over positions and
+// velocities. The other solvers need a second order system: the positions
+// are eliminated, which leaves the symmetric system
+//
+//   (I - h dv/dv - h^2 dv/dx) dv = r_v + h dv/dx r_x
+//
+// in the velocities. Pinned and sleeping particles are removed from it.
+// Multigrid solves it iteratively on particle grids, LDLT factors it with a
+// fill-reducing ordering on any mesh.
+class ImplicitSolver {
+public:
+  using ScalarT = System::ScalarT;
+  using Vector = System::Vector;
+  using SparseMatrix = System::SparseMatrix;
+
+  void setType(const LinearSolverType type);
+  LinearSolverType getType() const;
+
+  // Factors I - h dfdx for the following solves, throws std::runtime_error
+  // if that fails. Multigrid falls back to SparseLU on systems without a
+  // particle grid, both Multigrid and LDLT on first order systems.
+  void factorize(const System &system, const SparseMatrix &dfdx,
+                 const ScalarT h);
+  // Whether the last factorization was made with the current solver type
+  // for a system of this size with the same h and the same pinned and
+  // sleeping particles. The Jacobian itself may have changed since.
+  bool isFactorizationValid(const System &system, const ScalarT h) const;
+  void invalidateFactorization();
+  // Solves (I - h dfdx) dx = b with the last factorization, throws
+  // std::runtime_error if that fails
+  Vector solveFactorized(const Vector &b);
+
+  // Factors and solves at once
+  Vector solve(const System &system, const SparseMatrix &dfdx, const Vector &b,
+               const ScalarT h);
+
+  void recordNewtonStep(const std::size_t iterations,
+                        const std::size_t backtracks,
+                        const Float initialResidual,
+                        const Float finalResidual);
+
+  // Accumulated since the creation of the solver
+  const SolverStatistics &getStatistics() const;
+  void resetStatistics();
+
+private:
+  enum class Method { None, SparseLU, Multigrid, LDLT };
+
+  // The symmetric system in the velocity changes without its right hand
+  // side, see ImplicitSolver
+  struct ReducedSystem {
+    SparseMatrix A;
+    SparseMatrix dadx;
+    SparseMatrix dadv;
+    std::vector<char> fixed;
+  };
+
+  void factorizeSparseLU(const SparseMatrix &dfdx, const ScalarT h);
+  void factorizeMultigrid(const System &system, const SparseMatrix &dfdx,
+                          const ScalarT h);
+  void factorizeLDLT(const System &system, const SparseMatrix &dfdx,
+                     const ScalarT h);
+  Vector solveSparseLU(const Vector &b);
+
+  static ReducedSystem reduce(const System &system, const SparseMatrix &dfdx,
+                              const ScalarT h);
+  static Vector reduceRhs(const ReducedSystem &reduced, const Vector &b,
+                          const ScalarT h);
+  static Vector expand(const ReducedSystem &reduced, const Vector &b,
+                       const Vector &dv, const ScalarT h);
+  // Pinned particles followed by the sleeping ones
+  static std::vector<UnsignedInt> fixedParticles(const System &system);
+
+  LinearSolverType m_type{LinearSolverType::SparseLU};
+
+  // Of the last factorization
+  Method m_method{Method::None};
+  LinearSolverType m_factoredType{LinearSolverType::SparseLU};
+  ScalarT m_h{0.0f};
+  SparseMatrix m_dfdx;
+  std::vector<UnsignedInt> m_fixedParticles;
+  ReducedSystem m_reduced;
+
+  Eigen::SparseLU<SparseMatrix> m_lu;
+  Multigrid m_multigrid;
+  Eigen::SimplicialLDLT<SparseMatrix, Eigen::Lower,
+                        Eigen::AMDOrdering<SparseMatrix::StorageIndex>>
+      m_ldlt;
+  // Sparsity pattern the ordering of m_ldlt was computed for
+  std::vector<SparseMatrix::StorageIndex> m_ldltOuter;
+  std::vector<SparseMatrix::StorageIndex> m_ldltInner;
+  SolverStatistics m_statistics;
+};
+
+// Accepts "sparseLU", "multigrid" and "ldlt", throws std::runtime_error for
+// unknown names
+LinearSolverType linearSolverType(const std::string &name);
+} // namespace clothsim
+
+#endif // CLOTHSIM_SOLVER_H
@@ -1,26 +1,80 @@
 #include "System.h"
+#include "Solver.h"
 
 #include <Corrade/Containers/Array.h>
 
 #include <cassert>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
 
 namespace clothsim {
-System::System(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-               Object3D &parent,
-               Magnum::SceneGraph::DrawableGroup3D &drawableGroup)
-    : Drawable(phongShader, vertexShader, parent, drawableGroup) {}
+System::System() : m_solver{std::make_unique<ImplicitSolver>()} {}
+
+System::~System() = default;
 
 const System::Vector &System::getState() const { return m_state; }
 
-void System::setState(Vector newState) { m_state = std::move(newState); }
+void System::setState(Vector newState) {
+  m_state = std::move(newState);
+  invalidateDerivativeCache();
+}
+
+Corrade::Containers::ArrayView<const Magnum::Vector3>
+System::getParticlePositions(const Vector &state) const {
+  static_assert(std::is_same<ScalarT, Float>::value,
+                "Positions are viewed directly as Magnum::Vector3");
+
+  const auto n{getParticleCount()};
+  assert(static_cast<std::size_t>(state.size()) >= n * 3);
+
+  return Corrade::Containers::arrayCast<const Magnum::Vector3>(
+      Corrade::Containers::arrayView(state.data(), n * 3));
+}
+
+Corrade::Containers::ArrayView<const Magnum::Vector3>
+System::getMeshVertices() const {
+  return getParticlePositions(m_state);
+}
+
+void System::resolveCollisions(const Vector & /*previous*/, Vector & /*next*/,
+                               const ScalarT /*dt*/) {}
+
+bool System::isSecondOrder() const { return false; }
+
+Vector2ui System::getGridSize() const { return Vector2ui{0}; }
+
+Corrade::Containers::ArrayView<const UnsignedInt>
+System::getSleepingParticleIds() const {
+  return {};
+}
+
+ImplicitSolver &System::getSolver() { return *m_solver; }
+
+const ImplicitSolver &System::getSolver() const { return *m_solver; }
 
-Corrade::Containers::Array<Magnum::Vector3> System::getMeshVertices() const {
-  return Corrade::Containers::Array<Magnum::Vector3>{
-      getParticlePositions(m_state)};
+System::DerivativeCache &System::getDerivativeCache() {
+  return m_derivativeCache;
 }
 
-System::ScalarT System::getParticleMass() const { return 0.025f; }
+void System::invalidateDerivativeCache() { m_derivativeCache.state = {}; }
+
+System::StepHistory &System::getStepHistory() { return m_stepHistory; }
+
+System::ScalarT System::getParticleMass() const { return m_particleMass; }
+
+void System::setParticleMass(const ScalarT mass) {
+  if (!(mass > 0.0f))
+    throw std::runtime_error("Particle mass must be positive");
+
+  m_particleMass = mass;
+  invalidateDerivativeCache();
+}
+
+System::ScalarT System::getKineticEnergy(const Vector & /*state*/) const {
+  return std::numeric_limits<ScalarT>::infinity();
+}
 
 void System::togglePinnedParticle(const UnsignedInt particleId) {
   const auto pos = m_pinnedParticleIds.find(particleId);
@@ -28,10 +82,13 @@ void System::togglePinnedParticle(const UnsignedInt particleId) {
     m_pinnedParticleIds.erase(pos);
   else
     m_pinnedParticleIds.insert(particleId);
+
+  invalidateDerivativeCache();
 }
 
 void System::clearPinnedParticles() {
   m_pinnedParticleIds.clear();
+  invalidateDerivativeCache();
 }
 
 void System::setPinnedParticle(const UnsignedInt particleId,
@@ -43,24 +100,33 @@ void System::setPinnedParticle(const UnsignedInt particleId,
   } else {
     m_pinnedParticleIds.insert(particleId);
   }
+
+  invalidateDerivativeCache();
 }
 
 const std::set<UnsignedInt> &System::getPinnedParticleIds() const {
   return m_pinnedParticleIds;
 }
 
-const Corrade::Containers::Array<Magnum::Color3>& System::getVertexMarkerColors() {
-  // TODO: Add a nParticles getter
-  const auto nVertices{getParticlePositions(getState()).size()};
-  m_vertexMarkerColors = Corrade::Containers::Array<Color3>{Corrade::Containers::NoInit,
-                                                 nVertices};
-
-  for (std::size_t i{0}; i < nVertices; ++i) {
-    if (m_pinnedParticleIds.find(i) == m_pinnedParticleIds.end()) {
-      m_vertexMarkerColors[i] = Color3{1.0f, 1.0f, 1.0f};
-    } else {
-      m_vertexMarkerColors[i] = Color3{1.0f, 0.0f, 0.0f};
-    }
+Corrade::Containers::ArrayView<const Magnum::Color3>
+System::getVertexMarkerColors() {
+  const auto nVertices{getParticleCount()};
+
+  if (m_vertexMarkerColors.size() != nVertices)
+    m_vertexMarkerColors = Corrade::Containers::Array<Color3>{
+        Corrade::Containers::NoInit, nVertices};
+
+  for (auto &color : m_vertexMarkerColors)
+    color = Color3{1.0f, 1.0f, 1.0f};
+
+  for (const auto sleepingIdx : getSleepingParticleIds()) {
+    if (sleepingIdx < nVertices)
+      m_vertexMarkerColors[sleepingIdx] = Color3{0.3f, 0.5f, 1.0f};
+  }
+
+  for (const auto pinnedIdx : m_pinnedParticleIds) {
+    if (pinnedIdx < nVertices)
+      m_vertexMarkerColors[pinnedIdx] = Color3{1.0f, 0.0f, 0.0f};
   }
 
   return m_vertexMarkerColors;
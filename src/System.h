@@ -2,22 +2,28 @@
 #define CLOTHSIM_SYSTEM_H
 
 #include <Corrade/Containers/Array.h>
+#include <Corrade/Containers/ArrayView.h>
 
 #include <Magnum/Magnum.h>
+#include <Magnum/Math/Color.h>
+#include <Magnum/Math/Vector2.h>
+#include <Magnum/Math/Vector3.h>
 
 #include <Eigen/Sparse>
 
-#include "Drawable.h"
-
+#include <array>
+#include <memory>
 #include <set>
 #include <vector>
 
 namespace clothsim {
+class ImplicitSolver;
 class PhongShader;
 class VertexShader;
 using namespace Magnum;
 
-class System : public Drawable {
+// The simulated state without any rendering, drawn through snapshots of it
+class System {
 public:
   using ScalarT = float;
   using Vector3 = Eigen::Matrix<ScalarT, 3, 1>;
@@ -28,20 +34,72 @@ public:
   using SparseMatrix = Eigen::SparseMatrix<ScalarT>;
   using SparseMatrixRM = Eigen::SparseMatrix<ScalarT, Eigen::RowMajor>;
 
-  System(PhongIdShader &phongShader, VertexMarkerShader &vertexShader,
-         Object3D &parent, Magnum::SceneGraph::DrawableGroup3D &drawableGroup);
+  System();
+  virtual ~System();
+
+  System(const System &) = delete;
+  System &operator=(const System &) = delete;
 
   virtual Vector evalDerivative(const Vector &state) const = 0;
   virtual SparseMatrix evalJacobian(const Vector &state) const = 0;
 
   virtual void reset() = 0;
 
-  virtual Corrade::Containers::Array<Magnum::Vector3>
-  getParticlePositions(const Vector &state) const = 0;
-  Corrade::Containers::Array<Magnum::Vector3> getMeshVertices() const override;
-  const Corrade::Containers::Array<Magnum::Color3>& getVertexMarkerColors() override;
+  // Called by the integrators with the states before and after a step so
+  // that contacts can be resolved in the new state. Does nothing by default.
+  virtual void resolveCollisions(const Vector &previous, Vector &next,
+                                 const ScalarT dt);
+
+  virtual std::size_t getParticleCount() const = 0;
+
+  // Whether the state holds the positions followed by the velocities, the
+  // derivative of the positions being the velocities. False by default.
+  virtual bool isSecondOrder() const;
+  // Size of the grid if the particles are laid out on one row by row, zero
+  // otherwise
+  virtual Vector2ui getGridSize() const;
+
+  // Linear solver used by the implicit integrators
+  ImplicitSolver &getSolver();
+  const ImplicitSolver &getSolver() const;
+
+  // Lets an integrator hand the derivative it ended a step with to the next
+  // step, valid only as long as the state equals the stored one. Setting the
+  // state, the pins, the mass or anything else the derivative depends on
+  // empties it.
+  struct DerivativeCache {
+    Vector state;
+    Vector derivative;
+  };
+  DerivativeCache &getDerivativeCache();
+  void invalidateDerivativeCache();
+
+  // States at the end of the last implicit steps, most recent first, and the
+  // lengths of the steps between them. Valid only as long as the most recent
+  // state equals the current one.
+  struct StepHistory {
+    std::array<Vector, 3> states;
+    std::array<ScalarT, 2> steps{};
+    std::size_t count{0};
+  };
+  StepHistory &getStepHistory();
+
+  // Views are valid until the next modification of the system
+  virtual Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const = 0;
+
+  // Positions are viewed in place, the state must outlive the returned view
+  Corrade::Containers::ArrayView<const Magnum::Vector3>
+  getParticlePositions(const Vector &state) const;
+  Corrade::Containers::ArrayView<const Magnum::Vector3>
+  getMeshVertices() const;
+  Corrade::Containers::ArrayView<const Magnum::Color3>
+  getVertexMarkerColors();
 
   virtual ScalarT getParticleMass() const;
+  void setParticleMass(const ScalarT mass);
+  // Systems without a notion of velocity never come to rest
+  virtual ScalarT getKineticEnergy(const Vector &state) const;
 
   const Vector &getState() const;
   void setState(Vector newState);
@@ -51,10 +109,19 @@ public:
   const std::set<UnsignedInt> &getPinnedParticleIds() const;
   void clearPinnedParticles();
 
+  // Particles left out of the simulation for now, they have zero derivatives
+  // like pinned particles. None by default.
+  virtual Corrade::Containers::ArrayView<const UnsignedInt>
+  getSleepingParticleIds() const;
+
 private:
   Vector m_state{};
+  ScalarT m_particleMass{0.025f};
   std::set<UnsignedInt> m_pinnedParticleIds{};
   Corrade::Containers::Array<Magnum::Color3> m_vertexMarkerColors;
+  std::unique_ptr<ImplicitSolver> m_solver;
+  DerivativeCache m_derivativeCache;
+  StepHistory m_stepHistory;
 };
 } // namespace clothsim
 
@@ -0,0 +1,431 @@
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Queue of the pool the current thread works for
+thread_local const TaskPool *currentPool{nullptr};
+thread_local std::size_t currentQueue{0};
+// Calls of forRanges and run the current thread is inside of
+thread_local std::size_t callDepth{0};
+
+Double secondsSince(const Clock::time_point start) {
+  return std::chrono::duration<Double>(Clock::now() - start).count();
+}
+
+long long nanosecondsSince(const Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+} // namespace
+
+const char *taskStageName(const TaskStage stage) {
+  switch (stage) {
+  case TaskStage::Forces:
+    return "Forces";
+  case TaskStage::Jacobian:
+    return "Jacobian";
+  case TaskStage::Solver:
+    return "Solver";
+  case TaskStage::Collision:
+    return "Collision";
+  case TaskStage::Gravity:
+    return "Gravity";
+  case TaskStage::Normals:
+    return "Normals";
+  case TaskStage::Compression:
+    return "Compression";
+  case TaskStage::Other:
+    return "Other";
+  }
+
+  return "";
+}
+
+Double TaskStageStatistics::efficiency() const {
+  return threadSeconds > 0.0 ? busySeconds / threadSeconds : 0.0;
+}
+
+TaskGraph::TaskId TaskGraph::add(std::function<void()> task,
+                                 const TaskStage stage) {
+  m_nodes.push_back(Node{std::move(task), stage, {}, 0});
+  return m_nodes.size() - 1;
+}
+
+void TaskGraph::precede(const TaskId before, const TaskId after) {
+  // Dependencies only pointing forward cannot form cycles
+  if (before >= after || after >= m_nodes.size())
+    throw std::runtime_error("Tasks must depend on earlier tasks");
+
+  m_nodes[before].successors.push_back(after);
+  m_nodes[after].predecessors += 1;
+}
+
+std::size_t TaskGraph::size() const { return m_nodes.size(); }
+
+struct TaskPool::Batch {
+  virtual ~Batch() = default;
+  virtual void run(TaskPool &pool, const std::size_t begin,
+                   const std::size_t end) = 0;
+
+  std::atomic<std::size_t> remaining{0};
+  std::mutex errorMutex;
+  std::exception_ptr error;
+};
+
+struct TaskPool::RangeBatch : TaskPool::Batch {
+  explicit RangeBatch(const RangeFunction &function) : f{function} {}
+
+  void run(TaskPool &, const std::size_t begin,
+           const std::size_t end) override {
+    const auto start{Clock::now()};
+    try {
+      f(begin, end);
+    } catch (...) {
+      busyNanoseconds.fetch_add(nanosecondsSince(start));
+      throw;
+    }
+    busyNanoseconds.fetch_add(nanosecondsSince(start));
+  }
+
+  const RangeFunction &f;
+  std::atomic<long long> busyNanoseconds{0};
+};
+
+struct TaskPool::GraphBatch : TaskPool::Batch {
+  explicit GraphBatch(const TaskGraph &taskGraph)
+      : graph{taskGraph}, pending(taskGraph.m_nodes.size()) {
+    for (std::size_t i = 0; i < pending.size(); ++i)
+      pending[i].store(graph.m_nodes[i].predecessors);
+  }
+
+  void run(TaskPool &pool, const std::size_t node, const std::size_t) override {
+    const auto &current{graph.m_nodes[node]};
+    const auto stage{std::size_t(current.stage)};
+
+    // Successors are released even if the task fails, so that the graph
+    // finishes and the error reaches the caller
+    const auto start{Clock::now()};
+    try {
+      current.task();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock{errorMutex};
+      if (!error)
+        error = std::current_exception();
+    }
+    busyNanoseconds[stage].fetch_add(nanosecondsSince(start));
+    tasks[stage].fetch_add(1);
+
+    std::vector<Job> ready;
+    for (const auto successor : current.successors) {
+      if (pending[successor].fetch_sub(1) == 1)
+        ready.push_back(Job{this, successor, successor + 1});
+    }
+
+    if (!ready.empty())
+      pool.push(ready.data(), ready.size());
+  }
+
+  const TaskGraph &graph;
+  std::vector<std::atomic<std::size_t>> pending;
+  std::array<std::atomic<long long>, TaskStageCount> busyNanoseconds{};
+  std::array<std::atomic<std::size_t>, TaskStageCount> tasks{};
+};
+
+// Counts a call as active for its duration. Calls from tasks are nested in
+// an active call already and must not wait for a resize, which in turn
+// waits for the outer call.
+class TaskPool::ActiveCall {
+public:
+  explicit ActiveCall(TaskPool &pool)
+      : m_pool{pool}, m_outer{callDepth == 0 && currentPool != &pool} {
+    ++callDepth;
+    if (!m_outer)
+      return;
+
+    std::unique_lock<std::mutex> lock{m_pool.m_activeMutex};
+    m_pool.m_activeChanged.wait(lock, [this] { return !m_pool.m_resizing; });
+    ++m_pool.m_activeCalls;
+  }
+
+  ~ActiveCall() {
+    --callDepth;
+    if (!m_outer)
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock{m_pool.m_activeMutex};
+      --m_pool.m_activeCalls;
+    }
+    m_pool.m_activeChanged.notify_all();
+  }
+
+  ActiveCall(const ActiveCall &) = delete;
+  ActiveCall &operator=(const ActiveCall &) = delete;
+
+private:
+  TaskPool &m_pool;
+  const bool m_outer;
+};
+
+TaskPool &TaskPool::shared() {
+  static TaskPool pool;
+  return pool;
+}
+
+TaskPool::TaskPool(const std::size_t threads) { start(threads); }
+
+TaskPool::~TaskPool() { stop(); }
+
+void TaskPool::setThreadCount(const std::size_t threads) {
+  {
+    std::unique_lock<std::mutex> lock{m_activeMutex};
+    m_activeChanged.wait(lock, [this] { return !m_resizing; });
+    m_resizing = true;
+    m_activeChanged.wait(lock, [this] { return m_activeCalls == 0; });
+  }
+
+  // Nothing runs on the pool now, so the queues are empty and only the
+  // workers look at them
+  stop();
+  start(threads);
+
+  {
+    std::lock_guard<std::mutex> lock{m_activeMutex};
+    m_resizing = false;
+  }
+  m_activeChanged.notify_all();
+}
+
+std::size_t TaskPool::getThreadCount() const { return m_threadCount.load(); }
+
+void TaskPool::start(const std::size_t threads) {
+  const std::size_t count{
+      threads > 0 ? threads
+                  : std::max<std::size_t>(1, std::thread::hardware_concurrency())};
+
+  m_stopping = false;
+  while (m_queues.size() < count)
+    m_queues.push_back(std::make_unique<Queue>());
+  m_threadCount.store(count);
+
+  // The first queue belongs to the threads outside of the pool
+  for (std::size_t i = 1; i < count; ++i)
+    m_workers.emplace_back(&TaskPool::workerLoop, this, i);
+}
+
+void TaskPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock{m_sleepMutex};
+    m_stopping = true;
+  }
+  m_wake.notify_all();
+
+  for (auto &worker : m_workers)
+    worker.join();
+  m_workers.clear();
+}
+
+void TaskPool::workerLoop(const std::size_t index) {
+  currentPool = this;
+  currentQueue = index;
+
+  for (;;) {
+    if (tryRunOne(index))
+      continue;
+
+    std::unique_lock<std::mutex> lock{m_sleepMutex};
+    m_wake.wait(lock, [this] { return m_stopping || m_queued.load() > 0; });
+
+    if (m_stopping)
+      return;
+  }
+}
+
+std::size_t TaskPool::queueIndex() const {
+  return currentPool == this ? currentQueue : 0;
+}
+
+void TaskPool::push(const Job *jobs, const std::size_t count) {
+  // Counted first, so that the counter never drops below the queued jobs
+  m_queued.fetch_add(count);
+
+  {
+    auto &queue{*m_queues[queueIndex()]};
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    queue.jobs.insert(queue.jobs.end(), jobs, jobs + count);
+  }
+
+  if (m_threadCount.load() > 1) {
+    { std::lock_guard<std::mutex> lock{m_sleepMutex}; }
+    m_wake.notify_all();
+  }
+}
+
+bool TaskPool::tryRunOne(const std::size_t index) {
+  Job job{};
+  bool found{false};
+
+  // Newest of the own jobs first, it is likely still in the cache
+  {
+    auto &queue{*m_queues[index]};
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (!queue.jobs.empty()) {
+      job = queue.jobs.back();
+      queue.jobs.pop_back();
+      found = true;
+    }
+  }
+
+  // Oldest of the others, it likely spawns the most work
+  const auto threads{m_threadCount.load()};
+  for (std::size_t k = 1; !found && k < threads; ++k) {
+    auto &queue{*m_queues[(index + k) % threads]};
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (!queue.jobs.empty()) {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+      found = true;
+    }
+  }
+
+  if (!found)
+    return false;
+
+  m_queued.fetch_sub(1);
+  execute(job);
+  return true;
+}
+
+void TaskPool::execute(const Job &job) {
+  auto &batch{*job.batch};
+
+  try {
+    batch.run(*this, job.begin, job.end);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock{batch.errorMutex};
+    if (!batch.error)
+      batch.error = std::current_exception();
+  }
+
+  // The batch may be gone right after the last job is counted
+  batch.remaining.fetch_sub(1);
+}
+
+void TaskPool::wait(Batch &batch) {
+  const auto index{queueIndex()};
+
+  while (batch.remaining.load() > 0) {
+    if (!tryRunOne(index))
+      std::this_thread::yield();
+  }
+
+  if (batch.error)
+    std::rethrow_exception(batch.error);
+}
+
+void TaskPool::forRanges(const TaskStage stage, const std::size_t count,
+                         std::size_t grain, const RangeFunction &f) {
+  if (count == 0)
+    return;
+
+  const ActiveCall active{*this};
+  const auto threads{getThreadCount()};
+  if (grain == 0)
+    grain = std::max<std::size_t>(1, (count + 4 * threads - 1) / (4 * threads));
+
+  const std::size_t chunks{(count + grain - 1) / grain};
+  const auto start{Clock::now()};
+
+  if (threads == 1 || chunks == 1) {
+    for (std::size_t begin = 0; begin < count; begin += grain)
+      f(begin, std::min(begin + grain, count));
+
+    const auto seconds{secondsSince(start)};
+    record(stage, chunks, seconds, seconds, 1);
+    return;
+  }
+
+  RangeBatch batch{f};
+  batch.remaining.store(chunks);
+
+  std::vector<Job> jobs;
+  jobs.reserve(chunks);
+  for (std::size_t begin = 0; begin < count; begin += grain)
+    jobs.push_back(Job{&batch, begin, std::min(begin + grain, count)});
+
+  push(jobs.data(), jobs.size());
+  wait(batch);
+
+  record(stage, chunks, secondsSince(start),
+         Double(batch.busyNanoseconds.load()) * 1e-9,
+         std::min(threads, chunks));
+}
+
+void TaskPool::run(const TaskGraph &graph) {
+  const auto &nodes{graph.m_nodes};
+  if (nodes.empty())
+    return;
+
+  const ActiveCall active{*this};
+  const auto start{Clock::now()};
+
+  GraphBatch batch{graph};
+  batch.remaining.store(nodes.size());
+
+  std::vector<Job> roots;
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    if (nodes[i].predecessors == 0)
+      roots.push_back(Job{&batch, i, i + 1});
+  }
+
+  push(roots.data(), roots.size());
+  wait(batch);
+
+  // The stages of a graph share its wall time
+  const auto seconds{secondsSince(start)};
+  for (std::size_t s = 0; s < TaskStageCount; ++s) {
+    const auto tasks{batch.tasks[s].load()};
+    if (tasks > 0)
+      record(TaskStage(s), tasks, seconds,
+             Double(batch.busyNanoseconds[s].load()) * 1e-9,
+             std::min(getThreadCount(), tasks));
+  }
+}
+
+void TaskPool::setDeterministic(const bool deterministic) {
+  m_deterministic.store(deterministic);
+}
+
+bool TaskPool::isDeterministic() const { return m_deterministic.load(); }
+
+void TaskPool::record(const TaskStage stage, const std::size_t tasks,
+                      const Double wallSeconds, const Double busySeconds,
+                      const std::size_t threads) {
+  std::lock_guard<std::mutex> lock{m_statisticsMutex};
+  auto &statistics{m_statistics[std::size_t(stage)]};
+
+  statistics.calls += 1;
+  statistics.tasks += tasks;
+  statistics.wallSeconds += wallSeconds;
+  statistics.busySeconds += busySeconds;
+  statistics.threadSeconds += wallSeconds * Double(threads);
+}
+
+TaskStageStatistics TaskPool::getStageStatistics(const TaskStage stage) const {
+  std::lock_guard<std::mutex> lock{m_statisticsMutex};
+  return m_statistics[std::size_t(stage)];
+}
+
+void TaskPool::resetStageStatistics() {
+  std::lock_guard<std::mutex> lock{m_statisticsMutex};
+  m_statistics = {};
+}
+} // namespace clothsim
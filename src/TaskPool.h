@@ -0,0 +1,233 @@
+#ifndef CLOTHSIM_TASKPOOL_H
+#define CLOTHSIM_TASKPOOL_H
+
+#include <Magnum/Magnum.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Parts of the simulation whose parallel work is timed separately
+enum class TaskStage : UnsignedInt {
+  Forces = 0,
+  Jacobian,
+  Solver,
+  Collision,
+  Gravity,
+  Normals,
+  Compression,
+  Other
+};
+
+constexpr std::size_t TaskStageCount{std::size_t(TaskStage::Other) + 1};
+
+const char *taskStageName(const TaskStage stage);
+
+// Accumulated over the parallel calls of a stage. The busy time is spent in
+// the tasks themselves, the wall time from the start of a call to its end.
+struct TaskStageStatistics {
+  std::size_t calls{0};
+  std::size_t tasks{0};
+  Double wallSeconds{0.0};
+  Double busySeconds{0.0};
+  // Wall time times the threads that could take part in each call
+  Double threadSeconds{0.0};
+
+  // Busy time per available thread time, one for perfect scaling
+  Double efficiency() const;
+};
+
+class TaskPool;
+
+// Tasks with dependencies between them, run once by TaskPool::run
+class TaskGraph {
+public:
+  using TaskId = std::size_t;
+
+  TaskId add(std::function<void()> task,
+             const TaskStage stage = TaskStage::Other);
+  // The second task only starts once the first one has finished
+  void precede(const TaskId before, const TaskId after);
+
+  std::size_t size() const;
+
+private:
+  friend class TaskPool;
+
+  struct Node {
+    std::function<void()> task;
+    TaskStage stage;
+    std::vector<TaskId> successors;
+    std::size_t predecessors{0};
+  };
+
+  std::vector<Node> m_nodes;
+};
+
+// Work stealing thread pool. Every worker has a queue of its own, takes the
+// newest task from it and steals the oldest ones from the others when it
+// runs dry. Threads that wait for their tasks run queued tasks meanwhile,
+// so tasks may start parallel work of their own without blocking a thread
+// or adding threads beyond the configured count.
+class TaskPool {
+public:
+  using RangeFunction = std::function<void(std::size_t, std::size_t)>;
+
+  // Shared by the whole simulation
+  static TaskPool &shared();
+
+  // The thread count includes the calling thread, zero uses every core
+  explicit TaskPool(const std::size_t threads = 0);
+  ~TaskPool();
+
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+
+  // Waits until no work runs on the pool and holds back new work until the
+  // threads are replaced. Must not be called from a task.
+  void setThreadCount(const std::size_t threads);
+  std::size_t getThreadCount() const;
+
+  // Splits [0, count) into ranges of grain indices and calls f(begin, end)
+  // for each of them. A grain of zero gives every thread a few ranges.
+  // Returns once all ranges are done and rethrows the first exception.
+  void forRanges(const TaskStage stage, const std::size_t count,
+                 const std::size_t grain, const RangeFunction &f);
+
+  // Calls f(i) for every i in [0, count)
+  template <typename F>
+  void forEach(const TaskStage stage, const std::size_t count,
+               const std::size_t grain, F &&f) {
+    forRanges(stage, count, grain,
+              [&f](const std::size_t begin, const std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                  f(i);
+              });
+  }
+
+  // Sum of f(begin, end) over ranges covering [0, count). See
+  // setDeterministic for how the ranges are chosen.
+  template <typename T, typename F>
+  T sum(const TaskStage stage, const std::size_t count, F &&f);
+
+  // Runs the tasks of the graph in an order respecting the dependencies
+  void run(const TaskGraph &graph);
+
+  // Floating point sums depend on the order of the additions. By default
+  // every thread sums one range, so the ranges and the results change with
+  // the thread count. Deterministic sums split into ranges of a fixed size
+  // and add the partial sums up in a fixed pairwise order instead, which
+  // gives bitwise identical results for any thread count.
+  void setDeterministic(const bool deterministic);
+  bool isDeterministic() const;
+
+  TaskStageStatistics getStageStatistics(const TaskStage stage) const;
+  void resetStageStatistics();
+
+private:
+  struct Batch;
+  struct RangeBatch;
+  struct GraphBatch;
+
+  static constexpr std::size_t DeterministicGrain{1024};
+
+  struct Job {
+    Batch *batch;
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  class ActiveCall;
+
+  void start(const std::size_t threads);
+  void stop();
+  void workerLoop(const std::size_t index);
+
+  // Queue of the calling thread, threads outside of the pool share the
+  // first one
+  std::size_t queueIndex() const;
+  void push(const Job *jobs, const std::size_t count);
+  bool tryRunOne(const std::size_t index);
+  void execute(const Job &job);
+  void wait(Batch &batch);
+  void record(const TaskStage stage, const std::size_t tasks,
+              const Double wallSeconds, const Double busySeconds,
+              const std::size_t threads);
+
+  // Only grows, so that the queues stay where they are
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_workers;
+  std::atomic<std::size_t> m_threadCount{1};
+  std::atomic<std::size_t> m_queued{0};
+  bool m_stopping{false};
+  std::atomic<bool> m_deterministic{false};
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wake;
+
+  // Calls of forRanges and run from outside of any task, a resize waits for
+  // them to finish and new ones wait for the resize
+  std::mutex m_activeMutex;
+  std::condition_variable m_activeChanged;
+  std::size_t m_activeCalls{0};
+  bool m_resizing{false};
+
+  mutable std::mutex m_statisticsMutex;
+  std::array<TaskStageStatistics, TaskStageCount> m_statistics{};
+};
+
+template <typename T, typename F>
+T TaskPool::sum(const TaskStage stage, const std::size_t count, F &&f) {
+  if (count == 0)
+    return T(0);
+
+  // Read once, the mode may be switched from another thread meanwhile
+  const bool deterministic{m_deterministic.load()};
+  const auto threads{getThreadCount()};
+  const std::size_t grain{deterministic ? DeterministicGrain
+                                        : (count + threads - 1) / threads};
+  std::vector<T> partials((count + grain - 1) / grain, T(0));
+
+  forRanges(stage, count, grain,
+            [&](const std::size_t begin, const std::size_t end) {
+              partials[begin / grain] = f(begin, end);
+            });
+
+  // The tree only depends on the number of ranges
+  for (std::size_t width = 1; width < partials.size(); width *= 2) {
+    for (std::size_t i = 0; i + width < partials.size(); i += 2 * width)
+      partials[i] += partials[i + width];
+  }
+
+  return partials.front();
+}
+
+// TaskPool::forEach on the shared pool
+template <typename F>
+void parallelFor(const TaskStage stage, const std::size_t count,
+                 const std::size_t grain, F &&f) {
+  TaskPool::shared().forEach(stage, count, grain, std::forward<F>(f));
+}
+
+// TaskPool::sum on the shared pool
+template <typename T, typename F>
+T parallelSum(const TaskStage stage, const std::size_t count, F &&f) {
+  return TaskPool::shared().sum<T>(stage, count, std::forward<F>(f));
+}
+} // namespace clothsim
+
+#endif // CLOTHSIM_TASKPOOL_H
@@ -0,0 +1,109 @@
+#include "Telemetry.h"
+#include "Solver.h"
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+namespace clothsim {
+StepRecord measureStep(const Integrator &integrator, System &system,
+                       const Float dt) {
+  using namespace std::chrono;
+
+  const auto &statistics{system.getSolver().getStatistics()};
+  const SolverStatistics before{statistics};
+  const auto start{steady_clock::now()};
+
+  integrator(system, dt);
+
+  StepRecord record;
+  record.seconds = duration<Double>(steady_clock::now() - start).count();
+
+  // The solver only counts, its counters have to be compared to get the
+  // work of this step
+  const auto &after{system.getSolver().getStatistics()};
+  record.newtonIterations =
+      UnsignedInt(after.newtonIterations - before.newtonIterations);
+  record.backtracks = UnsignedInt(after.backtracks - before.backtracks);
+  record.jacobianUpdates =
+      UnsignedInt(after.jacobianUpdates - before.jacobianUpdates);
+  record.linearIterations = UnsignedInt(after.iterations - before.iterations);
+  record.factorSeconds = after.factorSeconds - before.factorSeconds;
+  record.solveSeconds = after.solveSeconds - before.solveSeconds;
+  record.factorNonZeros = after.factorNonZeros - before.factorNonZeros;
+
+  if (after.steps != before.steps) {
+    record.initialResidual = after.initialResidual;
+    record.finalResidual = after.finalResidual;
+  }
+
+  return record;
+}
+
+StepTelemetry::StepTelemetry(const std::size_t capacity)
+    : m_capacity{Math::max<std::size_t>(capacity, 1)} {
+  m_records.reserve(m_capacity);
+}
+
+const StepRecord &StepTelemetry::step(const Integrator &integrator,
+                                      System &system, const Float dt) {
+  record(measureStep(integrator, system, dt));
+  return getLatest();
+}
+
+void StepTelemetry::record(const StepRecord &record) {
+  if (m_records.size() < m_capacity) {
+    m_records.push_back(record);
+  } else {
+    m_records[m_next] = record;
+    m_next = (m_next + 1) % m_capacity;
+  }
+
+  ++m_stepCount;
+}
+
+void StepTelemetry::clear() {
+  m_records.clear();
+  m_next = 0;
+  m_stepCount = 0;
+}
+
+std::size_t StepTelemetry::getSize() const { return m_records.size(); }
+
+std::size_t StepTelemetry::getCapacity() const { return m_capacity; }
+
+std::size_t StepTelemetry::getStepCount() const { return m_stepCount; }
+
+const StepRecord &StepTelemetry::operator[](const std::size_t i) const {
+  return m_records[(m_next + i) % m_records.size()];
+}
+
+const StepRecord &StepTelemetry::getLatest() const {
+  return (*this)[m_records.size() - 1];
+}
+
+void writeTelemetry(const std::string &filename,
+                    const StepTelemetry &telemetry) {
+  std::ofstream file{filename, std::ios::trunc};
+  if (!file)
+    throw std::runtime_error("Cannot open " + filename + " for writing");
+
+  file << "step,seconds,newtonIterations,backtracks,jacobianUpdates,"
+          "linearIterations,initialResidual,finalResidual,factorSeconds,"
+          "solveSeconds,factorNonZeros\n";
+
+  // Numbered from the first step still in the history
+  const std::size_t first{telemetry.getStepCount() - telemetry.getSize()};
+  for (std::size_t i = 0; i < telemetry.getSize(); ++i) {
+    const auto &r{telemetry[i]};
+    file << first + i << ',' << r.seconds << ',' << r.newtonIterations << ','
+         << r.backtracks << ',' << r.jacobianUpdates << ','
+         << r.linearIterations << ',' << r.initialResidual << ','
+         << r.finalResidual << ',' << r.factorSeconds << ','
+         << r.solveSeconds << ',' << r.factorNonZeros << '\n';
+  }
+
+  if (!file)
+    throw std::runtime_error("Writing " + filename + " failed");
+}
+} // namespace clothsim
@@ -0,0 +1,80 @@
+#ifndef CLOTHSIM_TELEMETRY_H
+#define CLOTHSIM_TELEMETRY_H
+
+#include <Magnum/Magnum.h>
+
+#include <string>
+#include <vector>
+
+#include "Integrators.h"
+
+namespace clothsim {
+using namespace Magnum;
+
+// Work done by one step of an integrator. The Newton and solver fields stay
+// zero for the explicit integrators.
+struct StepRecord {
+  Double seconds{0.0};
+  UnsignedInt newtonIterations{0};
+  UnsignedInt backtracks{0};
+  UnsignedInt jacobianUpdates{0};
+  // Conjugate gradient iterations of the multigrid solver
+  UnsignedInt linearIterations{0};
+  // Residual norms before and after the Newton iterations
+  Float initialResidual{0.0f};
+  Float finalResidual{0.0f};
+  Double factorSeconds{0.0};
+  Double solveSeconds{0.0};
+  // Nonzeros of the factors made during the step
+  std::size_t factorNonZeros{0};
+};
+
+// Times one step of the integrator and collects its work from the solver
+// statistics of the system
+StepRecord measureStep(const Integrator &integrator, System &system,
+                       const Float dt);
+
+// The records of the last steps, the oldest ones are dropped once the
+// capacity is reached
+class StepTelemetry {
+public:
+  explicit StepTelemetry(const std::size_t capacity = 300);
+
+  // Steps the system and records the step
+  const StepRecord &step(const Integrator &integrator, System &system,
+                         const Float dt);
+  void record(const StepRecord &record);
+  void clear();
+
+  std::size_t getSize() const;
+  std::size_t getCapacity() const;
+  // Steps recorded since the creation or the last clear, including the
+  // dropped ones
+  std::size_t getStepCount() const;
+  // Oldest first
+  const StepRecord &operator[](const std::size_t i) const;
+  const StepRecord &getLatest() const;
+
+  // One value per record, oldest first, for example to plot
+  template <typename F> std::vector<Float> series(F &&value) const {
+    std::vector<Float> values(getSize());
+    for (std::size_t i = 0; i < values.size(); ++i)
+      values[i] = Float(value((*this)[i]));
+    return values;
+  }
+
+private:
+  std::vector<StepRecord> m_records;
+  std::size_t m_capacity;
+  // Where the next record goes once the capacity is reached
+  std::size_t m_next{0};
+  std::size_t m_stepCount{0};
+};
+
+// Writes the records as comma separated values with a header line, throws
+// std::runtime_error if that fails
+void writeTelemetry(const std::string &filename,
+                    const StepTelemetry &telemetry);
+} // namespace clothsim
+
+#endif // CLOTHSIM_TELEMETRY_H
@@ -0,0 +1,289 @@
+#include "Trajectory.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+constexpr std::size_t RiceBlockSize{64};
+constexpr UnsignedInt RiceEscape{24};
+
+inline UnsignedLong lowBits(const UnsignedInt bits) {
+  return bits >= 64 ? ~UnsignedLong{0} : (UnsignedLong{1} << bits) - 1;
+}
+
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<UnsignedByte> &out) : m_out{out} {}
+
+  // At most 32 bits at a time
+  void write(const UnsignedInt value, const UnsignedInt bits) {
+    m_buffer |= (UnsignedLong{value} & lowBits(bits)) << m_count;
+    m_count += bits;
+
+    while (m_count >= 8) {
+      m_out.push_back(static_cast<UnsignedByte>(m_buffer));
+      m_buffer >>= 8;
+      m_count -= 8;
+    }
+  }
+
+  void flush() {
+    if (m_count > 0)
+      m_out.push_back(static_cast<UnsignedByte>(m_buffer));
+
+    m_buffer = 0;
+    m_count = 0;
+  }
+
+private:
+  std::vector<UnsignedByte> &m_out;
+  UnsignedLong m_buffer{0};
+  UnsignedInt m_count{0};
+};
+
+class BitReader {
+public:
+  explicit BitReader(Corrade::Containers::ArrayView<const UnsignedByte> data)
+      : m_data{data} {}
+
+  UnsignedInt read(const UnsignedInt bits) {
+    if (bits == 0)
+      return 0;
+
+    refill();
+    const auto value{static_cast<UnsignedInt>(m_buffer & lowBits(bits))};
+    m_buffer >>= bits;
+    m_count -= bits;
+
+    return value;
+  }
+
+  // Number of set bits before the next zero, saturated at the limit. The
+  // terminating zero is only consumed when below the limit.
+  UnsignedInt readUnary(const UnsignedInt limit) {
+    refill();
+    const auto ones{static_cast<UnsignedInt>(std::countr_one(m_buffer))};
+
+    if (ones >= limit) {
+      m_buffer >>= limit;
+      m_count -= limit;
+      return limit;
+    }
+
+    m_buffer >>= ones + 1;
+    m_count -= ones + 1;
+    return ones;
+  }
+
+  bool overrun() const { return m_position > m_data.size() + 8; }
+
+private:
+  void refill() {
+    while (m_count <= 56) {
+      const UnsignedLong byte{
+          m_position < m_data.size() ? m_data[m_position] : UnsignedByte{0}};
+      m_buffer |= byte << m_count;
+      m_count += 8;
+      ++m_position;
+    }
+  }
+
+  Corrade::Containers::ArrayView<const UnsignedByte> m_data;
+  std::size_t m_position{0};
+  UnsignedLong m_buffer{0};
+  UnsignedInt m_count{0};
+};
+
+// Largest magnitude of a quantized coordinate
+constexpr Double MaxQuantized{Double(std::numeric_limits<Int>::max())};
+
+inline UnsignedInt zigzag(const UnsignedInt delta) {
+  return (delta << 1) ^ (0u - (delta >> 31));
+}
+
+inline UnsignedInt unzigzag(const UnsignedInt value) {
+  return (value >> 1) ^ (0u - (value & 1u));
+}
+
+void encodePlane(const Int *values, const Int *previous, const std::size_t n,
+                 std::vector<UnsignedByte> &out) {
+  BitWriter writer{out};
+  UnsignedInt residuals[RiceBlockSize];
+
+  // Deltas use wrapping unsigned arithmetic so that decoding is exact for
+  // any input
+  UnsignedInt last{0};
+  for (std::size_t begin = 0; begin < n; begin += RiceBlockSize) {
+    const auto count{std::min(RiceBlockSize, n - begin)};
+    UnsignedLong sum{0};
+
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto value{static_cast<UnsignedInt>(values[begin + i])};
+      const auto reference{previous
+                               ? static_cast<UnsignedInt>(previous[begin + i])
+                               : last};
+      residuals[i] = zigzag(value - reference);
+      sum += residuals[i];
+      last = value;
+    }
+
+    // Rice parameter close to log2 of the mean residual
+    const auto mean{sum / count};
+    const auto k{mean > 0 ? static_cast<UnsignedInt>(std::bit_width(mean)) - 1
+                          : 0u};
+    writer.write(k, 5);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto q{residuals[i] >> k};
+
+      if (q < RiceEscape) {
+        writer.write((1u << q) - 1, q + 1);
+        writer.write(residuals[i], k);
+      } else {
+        writer.write((1u << RiceEscape) - 1, RiceEscape);
+        writer.write(residuals[i], 32);
+      }
+    }
+  }
+
+  writer.flush();
+}
+
+void decodePlane(Corrade::Containers::ArrayView<const UnsignedByte> data,
+                 const Int *previous, const std::size_t n, Int *values) {
+  BitReader reader{data};
+
+  UnsignedInt last{0};
+  for (std::size_t begin = 0; begin < n; begin += RiceBlockSize) {
+    const auto count{std::min(RiceBlockSize, n - begin)};
+    const auto k{reader.read(5)};
+
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto q{reader.readUnary(RiceEscape)};
+      const auto residual{q < RiceEscape ? (q << k) | reader.read(k)
+                                         : reader.read(32)};
+      const auto reference{previous
+                               ? static_cast<UnsignedInt>(previous[begin + i])
+                               : last};
+      last = reference + unzigzag(residual);
+      values[begin + i] = static_cast<Int>(last);
+    }
+  }
+
+  if (reader.overrun())
+    throw std::runtime_error("Corrupted trajectory frame");
+}
+} // namespace
+
+void checkQuantizable(Corrade::Containers::ArrayView<const Vector3> positions,
+                      const Float step) {
+  const Double stepInv{1.0 / Double(step)};
+
+  for (const auto &p : positions) {
+    for (std::size_t c = 0; c < 3; ++c) {
+      // Also false for NaN
+      if (!(std::abs(Double(p[c]) * stepInv) <= MaxQuantized))
+        throw std::runtime_error(
+            "Particle positions are not finite or out of the trajectory "
+            "range");
+    }
+  }
+}
+
+void quantizeFrame(Corrade::Containers::ArrayView<const Vector3> positions,
+                   const Float step, QuantizedFrame &frame) {
+  const auto n{positions.size()};
+  const Double stepInv{1.0 / Double(step)};
+  frame.resize(n * 3);
+
+  parallelFor(TaskStage::Compression, n, 0, [&](const std::size_t i) {
+    for (std::size_t c = 0; c < 3; ++c) {
+      const Double q{std::round(Double(positions[i][c]) * stepInv)};
+      // NaN is stored as zero
+      frame[c * n + i] =
+          std::isnan(q)
+              ? 0
+              : static_cast<Int>(std::clamp(q, -MaxQuantized, MaxQuantized));
+    }
+  });
+}
+
+void dequantizeFrame(const QuantizedFrame &frame, const Float step,
+                     Corrade::Containers::ArrayView<Vector3> positions) {
+  const auto n{positions.size()};
+
+  for (std::size_t i = 0; i < n; ++i) {
+    for (std::size_t c = 0; c < 3; ++c) {
+      positions[i][c] = static_cast<Float>(frame[c * n + i]) * step;
+    }
+  }
+}
+
+void encodeFrame(const QuantizedFrame &frame, const QuantizedFrame *previous,
+                 std::vector<UnsignedByte> &out) {
+  const auto n{frame.size() / 3};
+
+  // The planes are coded independently of each other and appended in order
+  // once all of them are done
+  std::vector<UnsignedByte> planes[3];
+  TaskGraph graph;
+
+  for (std::size_t c = 0; c < 3; ++c) {
+    graph.add(
+        [&, c] {
+          encodePlane(frame.data() + c * n,
+                      previous ? previous->data() + c * n : nullptr, n,
+                      planes[c]);
+        },
+        TaskStage::Compression);
+  }
+
+  const auto append{graph.add(
+      [&] {
+        for (const auto &plane : planes) {
+          const auto planeSize{static_cast<UnsignedInt>(plane.size())};
+          const auto offset{out.size()};
+          out.resize(offset + sizeof(UnsignedInt));
+          std::memcpy(out.data() + offset, &planeSize, sizeof(UnsignedInt));
+        }
+
+        for (const auto &plane : planes)
+          out.insert(out.end(), plane.begin(), plane.end());
+      },
+      TaskStage::Compression)};
+
+  for (TaskGraph::TaskId c = 0; c < 3; ++c)
+    graph.precede(c, append);
+
+  TaskPool::shared().run(graph);
+}
+
+void decodeFrame(Corrade::Containers::ArrayView<const UnsignedByte> data,
+                 const QuantizedFrame *previous,
+                 const std::size_t particleCount, QuantizedFrame &frame) {
+  if (data.size() < 3 * sizeof(UnsignedInt))
+    throw std::runtime_error("Corrupted trajectory frame");
+
+  UnsignedInt planeSizes[3];
+  std::memcpy(planeSizes, data.data(), sizeof(planeSizes));
+
+  frame.resize(particleCount * 3);
+  std::size_t offset{sizeof(planeSizes)};
+
+  for (std::size_t c = 0; c < 3; ++c) {
+    if (offset + planeSizes[c] > data.size())
+      throw std::runtime_error("Corrupted trajectory frame");
+
+    decodePlane(data.slice(offset, offset + planeSizes[c]),
+                previous ? previous->data() + c * particleCount : nullptr,
+                particleCount, frame.data() + c * particleCount);
+    offset += planeSizes[c];
+  }
+}
+} // namespace clothsim
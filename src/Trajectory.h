@@ -0,0 +1,70 @@
+#ifndef CLOTHSIM_TRAJECTORY_H
+#define CLOTHSIM_TRAJECTORY_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// A trajectory file consists of the header, the mesh indices, the encoded
+// frames and a table with an entry for every frame. Every
+// keyframeInterval-th frame is a keyframe which can be decoded on its own,
+// the frames in between are stored as deltas to their predecessor.
+struct TrajectoryHeader {
+  char magic[8];
+  UnsignedInt version;
+  UnsignedInt particleCount;
+  UnsignedInt indexCount;
+  UnsignedInt keyframeInterval;
+  Float quantizationStep;
+  UnsignedInt reserved;
+  UnsignedLong indicesOffset;
+  UnsignedLong frameCount;
+  UnsignedLong frameTableOffset;
+};
+
+struct TrajectoryFrameEntry {
+  UnsignedLong offset;
+  UnsignedInt size;
+  UnsignedInt keyframe;
+  Double time;
+};
+
+static_assert(sizeof(TrajectoryHeader) == 56,
+              "Unexpected padding in the trajectory header");
+static_assert(sizeof(TrajectoryFrameEntry) == 24,
+              "Unexpected padding in the trajectory frame table");
+
+constexpr char TrajectoryMagic[8]{'C', 'L', 'O', 'T', 'H', 'T', 'R', 'J'};
+constexpr UnsignedInt TrajectoryVersion{1};
+
+// Positions rounded to multiples of the quantization step. The components
+// are stored as separate x, y and z planes.
+using QuantizedFrame = std::vector<Int>;
+
+// Throws std::runtime_error for positions that are not finite or too far
+// from the origin to be stored as multiples of the step
+void checkQuantizable(Corrade::Containers::ArrayView<const Vector3> positions,
+                      const Float step);
+// Positions out of range are clamped, see checkQuantizable()
+void quantizeFrame(Corrade::Containers::ArrayView<const Vector3> positions,
+                   const Float step, QuantizedFrame &frame);
+void dequantizeFrame(const QuantizedFrame &frame, const Float step,
+                     Corrade::Containers::ArrayView<Vector3> positions);
+
+// Keyframes (previous == nullptr) are delta coded along the particle order,
+// other frames against the previous frame. The deltas are entropy coded
+// with adaptive Rice codes.
+void encodeFrame(const QuantizedFrame &frame, const QuantizedFrame *previous,
+                 std::vector<UnsignedByte> &out);
+void decodeFrame(Corrade::Containers::ArrayView<const UnsignedByte> data,
+                 const QuantizedFrame *previous,
+                 const std::size_t particleCount, QuantizedFrame &frame);
+} // namespace clothsim
+
+#endif // CLOTHSIM_TRAJECTORY_H
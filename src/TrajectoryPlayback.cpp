@@ -0,0 +1,170 @@
+#include "TrajectoryPlayback.h"
+
+#include <Corrade/Containers/Array.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace clothsim {
+TrajectoryPlayback::TrajectoryPlayback(const std::string &filename)
+    : m_data{Corrade::Utility::Directory::mapRead(filename)} {
+  if (!m_data)
+    throw std::runtime_error("Cannot map " + filename);
+
+  if (m_data.size() < sizeof(TrajectoryHeader))
+    throw std::runtime_error(filename + " is not a trajectory");
+
+  std::memcpy(&m_header, m_data.data(), sizeof(m_header));
+
+  if (std::memcmp(m_header.magic, TrajectoryMagic, sizeof(TrajectoryMagic)) !=
+      0)
+    throw std::runtime_error(filename + " is not a trajectory");
+
+  if (m_header.version != TrajectoryVersion)
+    throw std::runtime_error("Unsupported trajectory version " +
+                             std::to_string(m_header.version));
+
+  // A recording that was not finished has no frame table. The sizes are
+  // compared without overflowing for any header.
+  const auto size{m_data.size()};
+  if (m_header.frameCount == 0 || m_header.frameTableOffset > size ||
+      m_header.frameCount > (size - m_header.frameTableOffset) /
+                                sizeof(TrajectoryFrameEntry) ||
+      m_header.indicesOffset > size ||
+      m_header.indexCount >
+          (size - m_header.indicesOffset) / sizeof(UnsignedInt) ||
+      m_header.indicesOffset % alignof(UnsignedInt) != 0)
+    throw std::runtime_error(filename + " is empty or truncated");
+
+  if (m_header.keyframeInterval == 0)
+    throw std::runtime_error(filename + " has no keyframes");
+
+  m_indices = {reinterpret_cast<const UnsignedInt *>(m_data.data() +
+                                                     m_header.indicesOffset),
+               m_header.indexCount};
+
+  reset();
+}
+
+TrajectoryPlayback::~TrajectoryPlayback() {}
+
+std::size_t TrajectoryPlayback::getParticleCount() const {
+  return m_header.particleCount;
+}
+
+Corrade::Containers::ArrayView<const UnsignedInt>
+TrajectoryPlayback::getMeshIndices() const {
+  return m_indices;
+}
+
+System::Vector
+TrajectoryPlayback::evalDerivative(const Vector &state) const {
+  return Vector::Zero(state.size());
+}
+
+System::SparseMatrix
+TrajectoryPlayback::evalJacobian(const Vector &state) const {
+  return SparseMatrix{state.size(), state.size()};
+}
+
+void TrajectoryPlayback::reset() {
+  m_decodedFrame = ~std::size_t{};
+  seek(0);
+}
+
+std::size_t TrajectoryPlayback::getFrameCount() const {
+  return m_header.frameCount;
+}
+
+std::size_t TrajectoryPlayback::getFrame() const { return m_decodedFrame; }
+
+TrajectoryFrameEntry
+TrajectoryPlayback::frameEntry(const std::size_t frame) const {
+  // The table is not necessarily aligned within the file
+  TrajectoryFrameEntry entry;
+  std::memcpy(&entry,
+              m_data.data() + m_header.frameTableOffset +
+                  frame * sizeof(TrajectoryFrameEntry),
+              sizeof(entry));
+
+  if (entry.offset > m_data.size() ||
+      entry.size > m_data.size() - entry.offset)
+    throw std::runtime_error("Corrupted trajectory frame table");
+
+  return entry;
+}
+
+Double TrajectoryPlayback::getFrameTime(const std::size_t frame) const {
+  return frameEntry(frame).time;
+}
+
+void TrajectoryPlayback::decode(const std::size_t frame) {
+  const auto entry{frameEntry(frame)};
+  const Corrade::Containers::ArrayView<const UnsignedByte> data{
+      reinterpret_cast<const UnsignedByte *>(m_data.data() + entry.offset),
+      entry.size};
+
+  // Not valid again until the frame is decoded completely
+  m_decodedFrame = ~std::size_t{};
+
+  if (entry.keyframe) {
+    decodeFrame(data, nullptr, m_header.particleCount, m_decoded);
+  } else {
+    // A delta frame needs the frame before it
+    if (m_decoded.size() != 3 * m_header.particleCount)
+      throw std::runtime_error("Corrupted trajectory frame table");
+
+    decodeFrame(data, &m_decoded, m_header.particleCount, m_scratch);
+    std::swap(m_decoded, m_scratch);
+  }
+
+  m_decodedFrame = frame;
+}
+
+void TrajectoryPlayback::seek(std::size_t frame) {
+  frame = std::min<std::size_t>(frame, m_header.frameCount - 1);
+
+  if (frame == m_decodedFrame)
+    return;
+
+  // Continue from the current frame when it lies between the keyframe and
+  // the target, otherwise start over from the keyframe
+  const auto keyframe{frame - frame % m_header.keyframeInterval};
+  auto next{m_decodedFrame < frame && m_decodedFrame >= keyframe
+                ? m_decodedFrame + 1
+                : keyframe};
+
+  if (next == keyframe && !frameEntry(keyframe).keyframe)
+    throw std::runtime_error("Corrupted trajectory frame table");
+
+  for (; next <= frame; ++next)
+    decode(next);
+
+  Vector state{static_cast<Eigen::Index>(m_header.particleCount) * 3};
+  dequantizeFrame(m_decoded, m_header.quantizationStep,
+                  Corrade::Containers::arrayCast<Magnum::Vector3>(
+                      Corrade::Containers::arrayView(
+                          state.data(), static_cast<std::size_t>(state.size()))));
+  setState(std::move(state));
+}
+
+void TrajectoryPlayback::seekTime(const Double time) {
+  // Frame times are increasing, binary search for the last one <= time
+  std::size_t first{0};
+  std::size_t count{m_header.frameCount};
+
+  while (count > 0) {
+    const auto half{count / 2};
+
+    if (getFrameTime(first + half) <= time) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+
+  seek(first > 0 ? first - 1 : 0);
+}
+} // namespace clothsim
@@ -0,0 +1,62 @@
+#ifndef CLOTHSIM_TRAJECTORYPLAYBACK_H
+#define CLOTHSIM_TRAJECTORYPLAYBACK_H
+
+#include <Corrade/Containers/Array.h>
+#include <Corrade/Containers/ArrayView.h>
+#include <Corrade/Utility/Directory.h>
+
+#include <Magnum/Magnum.h>
+
+#include "System.h"
+#include "Trajectory.h"
+
+#include <string>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Replays a recorded trajectory through the System interface. The file is
+// memory-mapped, seeking decodes at most one keyframe and the deltas up to
+// the requested frame.
+class TrajectoryPlayback : public System {
+public:
+  explicit TrajectoryPlayback(const std::string &filename);
+  ~TrajectoryPlayback() override;
+
+  std::size_t getParticleCount() const override;
+
+  Corrade::Containers::ArrayView<const UnsignedInt>
+  getMeshIndices() const override;
+
+  // The recorded state does not evolve on its own
+  Vector evalDerivative(const Vector &state) const override;
+  SparseMatrix evalJacobian(const Vector &state) const override;
+
+  void reset() override;
+
+  std::size_t getFrameCount() const;
+  std::size_t getFrame() const;
+  Double getFrameTime(const std::size_t frame) const;
+
+  // Both throw std::runtime_error for corrupted frames
+  void seek(const std::size_t frame);
+  // Seeks to the last frame recorded at or before the time
+  void seekTime(const Double time);
+
+private:
+  TrajectoryFrameEntry frameEntry(const std::size_t frame) const;
+  void decode(const std::size_t frame);
+
+  Corrade::Containers::Array<const char,
+                             Corrade::Utility::Directory::MapDeleter>
+      m_data;
+  TrajectoryHeader m_header{};
+  Corrade::Containers::ArrayView<const UnsignedInt> m_indices;
+
+  QuantizedFrame m_decoded;
+  QuantizedFrame m_scratch;
+  std::size_t m_decodedFrame{~std::size_t{}};
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_TRAJECTORYPLAYBACK_H
@@ -0,0 +1,157 @@
+#include "TrajectoryRecorder.h"
+
+#include <Corrade/Utility/Debug.h>
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace clothsim {
+TrajectoryRecorder::TrajectoryRecorder(
+    const std::string &filename,
+    Corrade::Containers::ArrayView<const UnsignedInt> meshIndices,
+    const std::size_t particleCount, const Float quantizationStep,
+    const UnsignedInt keyframeInterval, const std::size_t queueCapacity)
+    : m_file{filename, std::ios::binary | std::ios::trunc},
+      m_header{}, m_slots(queueCapacity) {
+  if (!m_file)
+    throw std::runtime_error("Cannot open " + filename + " for writing");
+
+  if (queueCapacity == 0 || keyframeInterval == 0)
+    throw std::runtime_error("Invalid recorder configuration");
+
+  std::memcpy(m_header.magic, TrajectoryMagic, sizeof(TrajectoryMagic));
+  m_header.version = TrajectoryVersion;
+  m_header.particleCount = static_cast<UnsignedInt>(particleCount);
+  m_header.indexCount = static_cast<UnsignedInt>(meshIndices.size());
+  m_header.keyframeInterval = keyframeInterval;
+  m_header.quantizationStep = quantizationStep;
+  m_header.indicesOffset = sizeof(TrajectoryHeader);
+
+  // The header is rewritten with the frame table location when finishing
+  m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+  m_file.write(reinterpret_cast<const char *>(meshIndices.data()),
+               static_cast<std::streamsize>(meshIndices.size() *
+                                            sizeof(UnsignedInt)));
+
+  for (auto &slot : m_slots)
+    slot.positions = Corrade::Containers::Array<Vector3>{
+        Corrade::Containers::NoInit, particleCount};
+
+  m_writer = std::thread{&TrajectoryRecorder::writerLoop, this};
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+  if (!m_finished)
+    finish();
+}
+
+std::size_t TrajectoryRecorder::getParticleCount() const {
+  return m_header.particleCount;
+}
+
+void TrajectoryRecorder::record(
+    const Double time,
+    Corrade::Containers::ArrayView<const Vector3> positions) {
+  if (positions.size() != m_header.particleCount)
+    throw std::runtime_error("Particle count changed during recording");
+
+  // The writer thread cannot report errors
+  checkQuantizable(positions, m_header.quantizationStep);
+
+  std::unique_lock<std::mutex> lock{m_mutex};
+
+  if (m_count == m_slots.size()) {
+    const auto pre{std::chrono::steady_clock::now()};
+    m_slotFreed.wait(lock, [this] { return m_count < m_slots.size(); });
+    m_statistics.stallSeconds += std::chrono::duration<Double>(
+                                     std::chrono::steady_clock::now() - pre)
+                                     .count();
+  }
+
+  // The writer never touches slots beyond the queued ones
+  auto &slot{m_slots[(m_head + m_count) % m_slots.size()]};
+  std::memcpy(slot.positions.data(), positions.data(),
+              positions.size() * sizeof(Vector3));
+  slot.time = time;
+  ++m_count;
+
+  lock.unlock();
+  m_frameQueued.notify_one();
+}
+
+void TrajectoryRecorder::writerLoop() {
+  QuantizedFrame previous, current;
+  std::vector<UnsignedByte> encoded;
+  UnsignedLong offset{m_header.indicesOffset +
+                      m_header.indexCount * sizeof(UnsignedInt)};
+
+  for (;;) {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    m_frameQueued.wait(lock, [this] { return m_count > 0 || m_stopping; });
+
+    if (m_count == 0)
+      return;
+
+    const Slot &slot{m_slots[m_head]};
+    lock.unlock();
+
+    using namespace std::chrono;
+    const auto pre{steady_clock::now()};
+
+    const bool keyframe{m_frameTable.size() % m_header.keyframeInterval == 0};
+    quantizeFrame(slot.positions, m_header.quantizationStep, current);
+    encoded.clear();
+    encodeFrame(current, keyframe ? nullptr : &previous, encoded);
+    const Double time{slot.time};
+
+    const auto encodedTime{steady_clock::now()};
+
+    m_file.write(reinterpret_cast<const char *>(encoded.data()),
+                 static_cast<std::streamsize>(encoded.size()));
+    m_frameTable.push_back(TrajectoryFrameEntry{
+        offset, static_cast<UnsignedInt>(encoded.size()), keyframe, time});
+    offset += encoded.size();
+    std::swap(previous, current);
+
+    lock.lock();
+    m_head = (m_head + 1) % m_slots.size();
+    --m_count;
+
+    m_statistics.frames += 1;
+    m_statistics.rawBytes += m_header.particleCount * sizeof(Vector3);
+    m_statistics.compressedBytes += encoded.size();
+    m_statistics.encodeSeconds +=
+        duration<Double>(encodedTime - pre).count();
+    m_statistics.writeSeconds +=
+        duration<Double>(steady_clock::now() - encodedTime).count();
+    lock.unlock();
+
+    m_slotFreed.notify_one();
+  }
+}
+
+TrajectoryRecorder::Statistics TrajectoryRecorder::finish() {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stopping = true;
+  }
+  m_frameQueued.notify_one();
+  m_writer.join();
+  m_finished = true;
+
+  m_header.frameCount = m_frameTable.size();
+  m_header.frameTableOffset = static_cast<UnsignedLong>(m_file.tellp());
+  m_file.write(reinterpret_cast<const char *>(m_frameTable.data()),
+               static_cast<std::streamsize>(m_frameTable.size() *
+                                            sizeof(TrajectoryFrameEntry)));
+  m_file.seekp(0);
+  m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+  m_file.close();
+
+  if (!m_file)
+    Corrade::Utility::Error{} << "Writing the trajectory failed";
+
+  return m_statistics;
+}
+} // namespace clothsim
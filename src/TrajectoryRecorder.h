@@ -0,0 +1,83 @@
+#ifndef CLOTHSIM_TRAJECTORYRECORDER_H
+#define CLOTHSIM_TRAJECTORYRECORDER_H
+
+#include <Corrade/Containers/Array.h>
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "Trajectory.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+// Records particle positions into a trajectory file. Frames are copied into
+// a bounded queue and compressed and written by a background thread, the
+// caller only blocks when the writer falls behind by a full queue.
+class TrajectoryRecorder {
+public:
+  struct Statistics {
+    std::size_t frames{0};
+    std::size_t rawBytes{0};
+    std::size_t compressedBytes{0};
+    Double encodeSeconds{0.0};
+    Double writeSeconds{0.0};
+    Double stallSeconds{0.0};
+  };
+
+  TrajectoryRecorder(
+      const std::string &filename,
+      Corrade::Containers::ArrayView<const UnsignedInt> meshIndices,
+      const std::size_t particleCount, const Float quantizationStep = 1e-4f,
+      const UnsignedInt keyframeInterval = 32,
+      const std::size_t queueCapacity = 8);
+  ~TrajectoryRecorder();
+
+  TrajectoryRecorder(const TrajectoryRecorder &) = delete;
+  TrajectoryRecorder &operator=(const TrajectoryRecorder &) = delete;
+
+  void record(const Double time,
+              Corrade::Containers::ArrayView<const Vector3> positions);
+
+  // Flushes the queue and completes the file. Called by the destructor if
+  // not called explicitly.
+  Statistics finish();
+
+  std::size_t getParticleCount() const;
+
+private:
+  struct Slot {
+    Corrade::Containers::Array<Vector3> positions;
+    Double time{0.0};
+  };
+
+  void writerLoop();
+
+  std::ofstream m_file;
+  TrajectoryHeader m_header;
+  std::vector<TrajectoryFrameEntry> m_frameTable;
+
+  std::vector<Slot> m_slots;
+  std::size_t m_head{0};
+  std::size_t m_count{0};
+  bool m_stopping{false};
+  bool m_finished{false};
+
+  std::mutex m_mutex;
+  std::condition_variable m_frameQueued;
+  std::condition_variable m_slotFreed;
+
+  Statistics m_statistics;
+  std::thread m_writer;
+};
+} // namespace clothsim
+
+#endif // CLOTHSIM_TRAJECTORYRECORDER_H
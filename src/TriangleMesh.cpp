@@ -0,0 +1,708 @@
+#include "TriangleMesh.h"
+#include "TaskPool.h"
+
+#include <Corrade/Containers/Array.h>
+#include <Corrade/Utility/Directory.h>
+#include <Corrade/Utility/String.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+namespace clothsim {
+namespace {
+using Corrade::Containers::ArrayView;
+
+// Parsing runs on independent chunks of whole lines
+std::vector<std::size_t> splitLines(ArrayView<const char> data,
+                                    const std::size_t begin) {
+  constexpr std::size_t minChunkSize{1 << 16};
+  const std::size_t size{data.size() - begin};
+  const std::size_t chunkCount{std::max<std::size_t>(
+      1, std::min<std::size_t>(4 * TaskPool::shared().getThreadCount(),
+                               size / minChunkSize))};
+
+  std::vector<std::size_t> boundaries{begin};
+  for (std::size_t i = 1; i < chunkCount; ++i) {
+    const auto target{std::max(boundaries.back(), begin + size * i / chunkCount)};
+    const auto newline{static_cast<const char *>(std::memchr(
+        data.data() + target, '\n', data.size() - target))};
+
+    if (!newline)
+      break;
+
+    boundaries.push_back(static_cast<std::size_t>(newline - data.data()) + 1);
+  }
+  boundaries.push_back(data.size());
+
+  return boundaries;
+}
+
+const char *skipSpace(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    ++p;
+
+  return p;
+}
+
+const char *skipToken(const char *p, const char *end) {
+  while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+    ++p;
+
+  return p;
+}
+
+template <typename T>
+const char *parseNumber(const char *p, const char *end, T &value) {
+  p = skipSpace(p, end);
+  const auto result{std::from_chars(p, end, value)};
+
+  if (result.ec != std::errc{})
+    throw std::runtime_error("Malformed number in mesh file");
+
+  return result.ptr;
+}
+
+const char *lineEnd(const char *p, const char *end) {
+  const auto newline{static_cast<const char *>(std::memchr(p, '\n', end - p))};
+  return newline ? newline : end;
+}
+
+// Appends the fan triangulation of a polygon
+template <typename T>
+void appendFan(const std::vector<T> &polygon, std::vector<T> &indices) {
+  for (std::size_t i = 2; i < polygon.size(); ++i) {
+    indices.push_back(polygon[0]);
+    indices.push_back(polygon[i - 1]);
+    indices.push_back(polygon[i]);
+  }
+}
+
+// Runs one task per chunk, rethrowing the first error afterwards
+template <typename F> void forEachChunk(const std::size_t count, F &&f) {
+  std::vector<std::string> errors(count);
+
+  parallelFor(TaskStage::Other, count, 1, [&](const std::size_t i) {
+    try {
+      f(i);
+    } catch (const std::exception &e) {
+      errors[i] = e.what();
+    }
+  });
+
+  for (const auto &error : errors) {
+    if (!error.empty())
+      throw std::runtime_error(error);
+  }
+}
+
+struct ObjIndex {
+  // Zero-based, relative indices count from the start of their chunk
+  Long index;
+  bool relative;
+};
+
+struct ObjChunk {
+  std::vector<Vector3> positions;
+  std::vector<ObjIndex> indices;
+};
+
+void parseObjChunk(const char *p, const char *end, ObjChunk &chunk) {
+  std::vector<ObjIndex> polygon;
+
+  while (p < end) {
+    const char *const eol{lineEnd(p, end)};
+    p = skipSpace(p, eol);
+
+    if (eol - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+      Vector3 position;
+      p = parseNumber(p + 1, eol, position.x());
+      p = parseNumber(p, eol, position.y());
+      p = parseNumber(p, eol, position.z());
+      chunk.positions.push_back(position);
+    } else if (eol - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+      polygon.clear();
+      p = skipSpace(p + 1, eol);
+
+      while (p < eol) {
+        Long index;
+        p = parseNumber(p, eol, index);
+
+        if (index > 0)
+          polygon.push_back({index - 1, false});
+        else if (index < 0)
+          polygon.push_back(
+              {static_cast<Long>(chunk.positions.size()) + index, true});
+        else
+          throw std::runtime_error("Invalid OBJ index 0");
+
+        // Texture coordinate and normal indices are ignored
+        p = skipSpace(skipToken(p, eol), eol);
+      }
+
+      appendFan(polygon, chunk.indices);
+    }
+
+    p = eol + 1;
+  }
+}
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float, Double };
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  bool isList{false};
+  PlyType countType{PlyType::UInt8};
+};
+
+struct PlyElement {
+  std::string name;
+  std::size_t count;
+  std::vector<PlyProperty> properties;
+};
+
+PlyType plyType(const std::string &name) {
+  if (name == "char" || name == "int8")
+    return PlyType::Int8;
+  if (name == "uchar" || name == "uint8")
+    return PlyType::UInt8;
+  if (name == "short" || name == "int16")
+    return PlyType::Int16;
+  if (name == "ushort" || name == "uint16")
+    return PlyType::UInt16;
+  if (name == "int" || name == "int32")
+    return PlyType::Int32;
+  if (name == "uint" || name == "uint32")
+    return PlyType::UInt32;
+  if (name == "float" || name == "float32")
+    return PlyType::Float;
+  if (name == "double" || name == "float64")
+    return PlyType::Double;
+
+  throw std::runtime_error("Unknown PLY type " + name);
+}
+
+std::size_t plyTypeSize(const PlyType type) {
+  switch (type) {
+  case PlyType::Int8:
+  case PlyType::UInt8:
+    return 1;
+  case PlyType::Int16:
+  case PlyType::UInt16:
+    return 2;
+  case PlyType::Int32:
+  case PlyType::UInt32:
+  case PlyType::Float:
+    return 4;
+  case PlyType::Double:
+    return 8;
+  }
+
+  return 0;
+}
+
+// Little endian only
+Double readPlyValue(const char *p, const PlyType type) {
+  const auto read = [p](auto value) {
+    std::memcpy(&value, p, sizeof(value));
+    return static_cast<Double>(value);
+  };
+
+  switch (type) {
+  case PlyType::Int8:
+    return read(std::int8_t{});
+  case PlyType::UInt8:
+    return read(std::uint8_t{});
+  case PlyType::Int16:
+    return read(std::int16_t{});
+  case PlyType::UInt16:
+    return read(std::uint16_t{});
+  case PlyType::Int32:
+    return read(std::int32_t{});
+  case PlyType::UInt32:
+    return read(std::uint32_t{});
+  case PlyType::Float:
+    return read(Float{});
+  case PlyType::Double:
+    return read(Double{});
+  }
+
+  return 0.0;
+}
+
+struct PlyVertexLayout {
+  std::size_t position[3];
+};
+
+PlyVertexLayout plyVertexLayout(const PlyElement &vertex) {
+  PlyVertexLayout layout{};
+  const char *const names[]{"x", "y", "z"};
+
+  for (std::size_t c = 0; c < 3; ++c) {
+    const auto found{std::find_if(
+        vertex.properties.begin(), vertex.properties.end(),
+        [&](const PlyProperty &p) { return p.name == names[c] && !p.isList; })};
+
+    if (found == vertex.properties.end())
+      throw std::runtime_error("PLY vertices have no position");
+
+    layout.position[c] =
+        static_cast<std::size_t>(found - vertex.properties.begin());
+  }
+
+  return layout;
+}
+
+void checkPlyFace(const PlyElement &face) {
+  if (face.properties.empty() || !face.properties.front().isList)
+    throw std::runtime_error("PLY faces must start with the index list");
+}
+
+// Starts of the given lines, numbered from the line at begin and sorted.
+// The lines are counted in parallel on the chunks of splitLines().
+std::vector<const char *> findLines(ArrayView<const char> data,
+                                    const std::size_t begin,
+                                    const std::vector<std::size_t> &lines,
+                                    const std::size_t lineCount) {
+  const auto boundaries{splitLines(data, begin)};
+  const auto chunkCount{boundaries.size() - 1};
+
+  // Number of the first line of each chunk
+  std::vector<std::size_t> firstLine(chunkCount + 1, 0);
+  forEachChunk(chunkCount, [&](const std::size_t i) {
+    const char *p{data.data() + boundaries[i]};
+    const char *const chunkEnd{data.data() + boundaries[i + 1]};
+
+    std::size_t count{0};
+    for (; p < chunkEnd; ++count)
+      p = lineEnd(p, chunkEnd) + 1;
+
+    firstLine[i + 1] = count;
+  });
+
+  std::partial_sum(firstLine.begin(), firstLine.end(), firstLine.begin());
+
+  if (firstLine.back() < lineCount)
+    throw std::runtime_error("PLY file is truncated");
+
+  std::vector<const char *> starts(lines.size());
+  forEachChunk(chunkCount, [&](const std::size_t i) {
+    auto line{std::lower_bound(lines.begin(), lines.end(), firstLine[i])};
+    const char *p{data.data() + boundaries[i]};
+    std::size_t current{firstLine[i]};
+
+    for (; line != lines.end() && *line < firstLine[i + 1]; ++line) {
+      for (; current < *line; ++current)
+        p = lineEnd(p, data.end()) + 1;
+
+      starts[static_cast<std::size_t>(line - lines.begin())] = p;
+    }
+  });
+
+  return starts;
+}
+
+void parsePlyAscii(ArrayView<const char> data, const std::size_t offset,
+                   const std::vector<PlyElement> &elements,
+                   TriangleMesh &mesh) {
+  const char *const end{data.end()};
+  constexpr std::size_t chunkSize{1 << 14};
+
+  // Every element is parsed in chunks of lines, only the first line of each
+  // chunk has to be found up front
+  std::vector<std::size_t> chunkLines;
+  std::size_t lineCount{0};
+  for (const auto &element : elements) {
+    for (std::size_t i = 0; i < element.count; i += chunkSize)
+      chunkLines.push_back(lineCount + i);
+
+    lineCount += element.count;
+  }
+
+  const auto chunkStarts{findLines(data, offset, chunkLines, lineCount)};
+
+  std::size_t firstChunk{0};
+  for (const auto &element : elements) {
+    const auto count{element.count};
+    const auto chunkCount{(count + chunkSize - 1) / chunkSize};
+    const auto *const starts{chunkStarts.data() + firstChunk};
+    firstChunk += chunkCount;
+
+    // Calls f(line, end of the line, index within the element) for the lines
+    // of chunk c
+    const auto forEachLine = [&](const std::size_t c, auto &&f) {
+      const char *p{starts[c]};
+
+      for (auto i = c * chunkSize; i < std::min(count, (c + 1) * chunkSize);
+           ++i) {
+        const char *const eol{lineEnd(p, end)};
+        f(p, eol, i);
+        p = eol + 1;
+      }
+    };
+
+    if (element.name == "vertex") {
+      const auto layout{plyVertexLayout(element)};
+      mesh.positions.resize(count);
+
+      forEachChunk(chunkCount, [&](const std::size_t c) {
+        forEachLine(c, [&](const char *p, const char *const eol,
+                           const std::size_t i) {
+          for (std::size_t prop = 0; prop < element.properties.size();
+               ++prop) {
+            Double value;
+            p = parseNumber(p, eol, value);
+
+            for (std::size_t k = 0; k < 3; ++k) {
+              if (layout.position[k] == prop)
+                mesh.positions[i][k] = static_cast<Float>(value);
+            }
+          }
+        });
+      });
+    } else if (element.name == "face") {
+      checkPlyFace(element);
+      std::vector<std::vector<UnsignedInt>> chunks(chunkCount);
+
+      forEachChunk(chunkCount, [&](const std::size_t c) {
+        std::vector<UnsignedInt> polygon;
+
+        forEachLine(c, [&](const char *p, const char *const eol,
+                           const std::size_t) {
+          std::size_t vertexCount;
+          p = parseNumber(p, eol, vertexCount);
+          polygon.resize(vertexCount);
+
+          for (auto &index : polygon)
+            p = parseNumber(p, eol, index);
+
+          appendFan(polygon, chunks[c]);
+        });
+      });
+
+      for (const auto &chunk : chunks)
+        mesh.indices.insert(mesh.indices.end(), chunk.begin(), chunk.end());
+    }
+  }
+}
+
+void parsePlyBinary(ArrayView<const char> data, std::size_t offset,
+                    const std::vector<PlyElement> &elements,
+                    TriangleMesh &mesh) {
+  const auto require = [&](const std::size_t size) {
+    if (offset + size > data.size())
+      throw std::runtime_error("PLY file is truncated");
+  };
+
+  for (const auto &element : elements) {
+    const bool hasLists{std::any_of(
+        element.properties.begin(), element.properties.end(),
+        [](const PlyProperty &p) { return p.isList; })};
+
+    if (element.name == "vertex" && !hasLists) {
+      const auto layout{plyVertexLayout(element)};
+
+      std::vector<std::size_t> offsets;
+      std::size_t stride{0};
+      for (const auto &property : element.properties) {
+        offsets.push_back(stride);
+        stride += plyTypeSize(property.type);
+      }
+
+      require(stride * element.count);
+      mesh.positions.resize(element.count);
+      const char *const base{data.data() + offset};
+
+      parallelFor(TaskStage::Other, element.count, 0, [&](const std::size_t i) {
+        for (std::size_t c = 0; c < 3; ++c) {
+          const auto &property{element.properties[layout.position[c]]};
+          mesh.positions[i][c] = static_cast<Float>(readPlyValue(
+              base + i * stride + offsets[layout.position[c]], property.type));
+        }
+      });
+
+      offset += stride * element.count;
+      continue;
+    }
+
+    if (element.name == "face")
+      checkPlyFace(element);
+
+    // Variable sized records have to be walked sequentially
+    std::vector<UnsignedInt> polygon;
+    for (std::size_t i = 0; i < element.count; ++i) {
+      for (std::size_t prop = 0; prop < element.properties.size(); ++prop) {
+        const auto &property{element.properties[prop]};
+        const auto typeSize{plyTypeSize(property.type)};
+
+        if (!property.isList) {
+          require(typeSize);
+          offset += typeSize;
+          continue;
+        }
+
+        const auto countSize{plyTypeSize(property.countType)};
+        require(countSize);
+        const auto count{static_cast<std::size_t>(
+            readPlyValue(data.data() + offset, property.countType))};
+        offset += countSize;
+        require(count * typeSize);
+
+        if (element.name == "face" && prop == 0) {
+          polygon.resize(count);
+          for (std::size_t j = 0; j < count; ++j) {
+            polygon[j] = static_cast<UnsignedInt>(
+                readPlyValue(data.data() + offset + j * typeSize, property.type));
+          }
+          appendFan(polygon, mesh.indices);
+        }
+
+        offset += count * typeSize;
+      }
+    }
+  }
+}
+} // namespace
+
+TriangleMesh parseObj(ArrayView<const char> data) {
+  const auto boundaries{splitLines(data, 0)};
+  std::vector<ObjChunk> chunks(boundaries.size() - 1);
+
+  forEachChunk(chunks.size(), [&](const std::size_t i) {
+    parseObjChunk(data.data() + boundaries[i], data.data() + boundaries[i + 1],
+                  chunks[i]);
+  });
+
+  std::vector<std::size_t> vertexBase(chunks.size() + 1, 0);
+  std::vector<std::size_t> indexBase(chunks.size() + 1, 0);
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    vertexBase[i + 1] = vertexBase[i] + chunks[i].positions.size();
+    indexBase[i + 1] = indexBase[i] + chunks[i].indices.size();
+  }
+
+  TriangleMesh mesh;
+  mesh.positions.resize(vertexBase.back());
+  mesh.indices.resize(indexBase.back());
+  const auto vertexCount{static_cast<Long>(vertexBase.back())};
+
+  forEachChunk(chunks.size(), [&](const std::size_t i) {
+    std::copy(chunks[i].positions.begin(), chunks[i].positions.end(),
+              mesh.positions.begin() +
+                  static_cast<std::ptrdiff_t>(vertexBase[i]));
+
+    for (std::size_t j = 0; j < chunks[i].indices.size(); ++j) {
+      const auto &index{chunks[i].indices[j]};
+      const Long resolved{
+          index.relative ? static_cast<Long>(vertexBase[i]) + index.index
+                         : index.index};
+
+      if (resolved < 0 || resolved >= vertexCount)
+        throw std::runtime_error("OBJ index out of range");
+
+      mesh.indices[indexBase[i] + j] = static_cast<UnsignedInt>(resolved);
+    }
+  });
+
+  return mesh;
+}
+
+TriangleMesh parsePly(ArrayView<const char> data) {
+  const char *const end{data.end()};
+  const char *p{data.data()};
+  std::vector<PlyElement> elements;
+  bool binary{false};
+  bool ply{false};
+
+  for (;;) {
+    if (p >= end)
+      throw std::runtime_error("PLY header is not terminated");
+
+    const char *const eol{lineEnd(p, end)};
+    const auto tokens{Corrade::Utility::String::splitWithoutEmptyParts(
+        std::string{p, eol}, ' ')};
+    p = eol + 1;
+
+    if (tokens.empty())
+      continue;
+
+    const auto keyword{Corrade::Utility::String::trim(tokens[0])};
+
+    if (keyword == "ply") {
+      ply = true;
+    } else if (keyword == "format" && tokens.size() > 1) {
+      const auto format{Corrade::Utility::String::trim(tokens[1])};
+
+      if (format == "binary_little_endian")
+        binary = true;
+      else if (format != "ascii")
+        throw std::runtime_error("Unsupported PLY format " + format);
+    } else if (keyword == "element" && tokens.size() > 2) {
+      elements.push_back(PlyElement{
+          tokens[1], std::stoull(Corrade::Utility::String::trim(tokens[2])),
+          {}});
+    } else if (keyword == "property" && tokens.size() > 2 &&
+               !elements.empty()) {
+      PlyProperty property;
+
+      if (tokens[1] == "list" && tokens.size() > 4) {
+        property.isList = true;
+        property.countType = plyType(tokens[2]);
+        property.type = plyType(tokens[3]);
+        property.name = Corrade::Utility::String::trim(tokens[4]);
+      } else {
+        property.type = plyType(tokens[1]);
+        property.name = Corrade::Utility::String::trim(tokens[2]);
+      }
+
+      elements.back().properties.push_back(property);
+    } else if (keyword == "end_header") {
+      break;
+    }
+  }
+
+  if (!ply)
+    throw std::runtime_error("Not a PLY file");
+
+  TriangleMesh mesh;
+  const auto offset{static_cast<std::size_t>(p - data.data())};
+
+  if (binary)
+    parsePlyBinary(data, offset, elements, mesh);
+  else
+    parsePlyAscii(data, offset, elements, mesh);
+
+  for (const auto index : mesh.indices) {
+    if (index >= mesh.positions.size())
+      throw std::runtime_error("PLY index out of range");
+  }
+
+  return mesh;
+}
+
+TriangleMesh loadTriangleMesh(const std::string &filename) {
+  const auto data{Corrade::Utility::Directory::mapRead(filename)};
+  if (!data)
+    throw std::runtime_error("Cannot map " + filename);
+
+  const auto lowercase{Corrade::Utility::String::lowercase(filename)};
+  TriangleMesh mesh;
+
+  if (Corrade::Utility::String::endsWith(lowercase, ".obj"))
+    mesh = parseObj(data);
+  else if (Corrade::Utility::String::endsWith(lowercase, ".ply"))
+    mesh = parsePly(data);
+  else
+    throw std::runtime_error("Unsupported mesh format " + filename);
+
+  if (mesh.indices.empty())
+    throw std::runtime_error(filename + " contains no triangles");
+
+  return mesh;
+}
+
+MeshEdges findMeshEdges(ArrayView<const UnsignedInt> indices,
+                        const std::size_t vertexCount) {
+  struct HalfEdge {
+    UnsignedInt other;
+    UnsignedInt opposite;
+
+    bool operator<(const HalfEdge &rhs) const {
+      return other < rhs.other ||
+             (other == rhs.other && opposite < rhs.opposite);
+    }
+  };
+
+  const auto triangleCount{indices.size() / 3};
+
+  // Bucket the triangle edges by their lower vertex
+  std::vector<std::atomic<UnsignedInt>> counts(vertexCount);
+
+  parallelFor(TaskStage::Other, triangleCount, 0, [&](const std::size_t t) {
+    for (std::size_t e = 0; e < 3; ++e) {
+      const auto a{indices[3 * t + e]};
+      const auto b{indices[3 * t + (e + 1) % 3]};
+
+      if (a != b)
+        counts[std::min(a, b)].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  std::vector<std::size_t> offsets(vertexCount + 1, 0);
+  for (std::size_t v = 0; v < vertexCount; ++v) {
+    offsets[v + 1] = offsets[v] + counts[v].load(std::memory_order_relaxed);
+    counts[v].store(0, std::memory_order_relaxed);
+  }
+
+  std::vector<HalfEdge> buckets(offsets.back());
+
+  parallelFor(TaskStage::Other, triangleCount, 0, [&](const std::size_t t) {
+    for (std::size_t e = 0; e < 3; ++e) {
+      const auto a{indices[3 * t + e]};
+      const auto b{indices[3 * t + (e + 1) % 3]};
+      const auto c{indices[3 * t + (e + 2) % 3]};
+
+      if (a == b)
+        continue;
+
+      const auto lower{std::min(a, b)};
+      const auto slot{counts[lower].fetch_add(1, std::memory_order_relaxed)};
+      buckets[offsets[lower] + slot] = HalfEdge{std::max(a, b), c};
+    }
+  });
+
+  // Sorting the small buckets makes the result independent of the order
+  // the buckets were filled in
+  std::vector<std::size_t> edgeCounts(vertexCount + 1, 0);
+  std::vector<std::size_t> bendCounts(vertexCount + 1, 0);
+
+  const auto forEachEdge = [&](const std::size_t v, auto &&f) {
+    const auto begin{buckets.begin() + static_cast<std::ptrdiff_t>(offsets[v])};
+    const auto end{buckets.begin() + static_cast<std::ptrdiff_t>(offsets[v + 1])};
+
+    for (auto it = begin; it != end;) {
+      auto next{it + 1};
+      while (next != end && next->other == it->other)
+        ++next;
+
+      f(*it, next - it == 2 ? &*(it + 1) : nullptr);
+      it = next;
+    }
+  };
+
+  parallelFor(TaskStage::Other, vertexCount, 1024, [&](const std::size_t v) {
+    std::sort(buckets.begin() + static_cast<std::ptrdiff_t>(offsets[v]),
+              buckets.begin() + static_cast<std::ptrdiff_t>(offsets[v + 1]));
+
+    forEachEdge(v, [&](const HalfEdge &, const HalfEdge *twin) {
+      ++edgeCounts[v + 1];
+      if (twin)
+        ++bendCounts[v + 1];
+    });
+  });
+
+  std::partial_sum(edgeCounts.begin(), edgeCounts.end(), edgeCounts.begin());
+  std::partial_sum(bendCounts.begin(), bendCounts.end(), bendCounts.begin());
+
+  MeshEdges result;
+  result.edges.resize(edgeCounts.back());
+  result.bendPairs.resize(bendCounts.back());
+
+  parallelFor(TaskStage::Other, vertexCount, 1024, [&](const std::size_t v) {
+    auto edge{edgeCounts[v]};
+    auto bend{bendCounts[v]};
+
+    forEachEdge(v, [&](const HalfEdge &halfEdge, const HalfEdge *twin) {
+      result.edges[edge++] = {static_cast<UnsignedInt>(v), halfEdge.other};
+
+      if (twin)
+        result.bendPairs[bend++] = {halfEdge.opposite, twin->opposite};
+    });
+  });
+
+  return result;
+}
+} // namespace clothsim
@@ -0,0 +1,42 @@
+#ifndef CLOTHSIM_TRIANGLEMESH_H
+#define CLOTHSIM_TRIANGLEMESH_H
+
+#include <Corrade/Containers/ArrayView.h>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clothsim {
+using namespace Magnum;
+
+struct TriangleMesh {
+  std::vector<Vector3> positions;
+  std::vector<UnsignedInt> indices;
+};
+
+// Loads a Wavefront OBJ or a PLY (ASCII or binary little endian) file,
+// chosen by the file extension. Polygons are triangulated as fans. Throws
+// std::runtime_error on malformed input.
+TriangleMesh loadTriangleMesh(const std::string &filename);
+
+TriangleMesh parseObj(Corrade::Containers::ArrayView<const char> data);
+TriangleMesh parsePly(Corrade::Containers::ArrayView<const char> data);
+
+struct MeshEdges {
+  // Unique edges, each pair ordered by index
+  std::vector<std::pair<UnsignedInt, UnsignedInt>> edges;
+  // Vertices opposite to an edge shared by exactly two triangles
+  std::vector<std::pair<UnsignedInt, UnsignedInt>> bendPairs;
+};
+
+// Finds the unique edges with a counting sort of the triangle edges by
+// their lower vertex index, linear in the triangle count
+MeshEdges findMeshEdges(Corrade::Containers::ArrayView<const UnsignedInt> indices,
+                        const std::size_t vertexCount);
+} // namespace clothsim
+
+#endif // CLOTHSIM_TRIANGLEMESH_H
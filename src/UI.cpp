@@ -11,13 +11,17 @@
 
 #include <Magnum/Shaders/Flat.h>
 
+#include <cfloat>
+#include <cmath>
 #include <cstdio>
+#include <thread>
 
 #include "App.h"
 #include "Cloth.h"
 #include "Integrators.h"
 #include "Oscillator.h"
 #include "Planet.h"
+#include "TaskPool.h"
 #include "Util.h"
 
 namespace clothsim {
@@ -75,6 +79,18 @@ bool UI::drawCombo(const std::string &text,
   return changed;
 }
 
+void UI::drawSparkline(const std::string &text,
+                       const std::vector<Float> &values, const char *format) {
+  // The latest value is printed over the plot
+  char latest[32];
+  std::snprintf(latest, sizeof(latest), format, Double(values.back()));
+
+  ImGui::PlotLines(("##" + text).c_str(), values.data(), Int(values.size()), 0,
+                   latest, FLT_MAX, FLT_MAX, ImVec2(0, 40));
+  ImGui::SameLine(0, ImGui::GetStyle().ItemInnerSpacing.x);
+  ImGui::Text("%s", text.c_str());
+}
+
 UI::UI(const Vector2i windowSize, const Vector2i framebufferSize,
        const Vector2 scaling, App &app)
     : m_app{app}, m_imgui{NoCreate}, m_currentWindowSize{windowSize},
@@ -90,12 +106,36 @@ UI::UI(const Vector2i windowSize, const Vector2i framebufferSize,
 
   GL::Context::current().resetState(GL::Context::State::ExitExternal);
 
-  m_app.setIntegrator(forwardEulerStep);
+  m_app.setIntegrator(m_currentIntegrator);
+  m_app.setClothSize(Vector2ui{m_currentSize});
   m_app.setSystem(m_currentSystem);
+  m_app.setStepLength(m_stepLength);
+  m_app.setStepsPerFrame(m_stepsPerFrame);
+  m_app.setRestThreshold(m_restThreshold);
+  m_app.setFrameBudget(m_frameBudget);
 
   draw();
 }
 
+void UI::syncSettings() {
+  m_currentSystem = m_app.getSystemType();
+  m_currentIntegrator = m_app.getIntegrator();
+  m_currentSolver = m_app.getLinearSolver();
+  m_newton = m_app.getNewtonPolicy();
+  m_currentSize = Vector2i{m_app.getClothSize()};
+  m_stepLength = m_app.getStepLength();
+  m_stepsPerFrame = m_app.getStepsPerFrame();
+  m_realTime = m_app.isRealTime();
+  m_frameBudget = m_app.getFrameBudget();
+  m_selfCollision = m_app.getSelfCollisionSettings();
+  m_sleep = m_app.getSleepSettings();
+  m_nbody = m_app.getNBodySettings();
+  m_currentGravityMethod = std::size_t(m_nbody.method);
+  m_threads = Int(m_app.getThreadCount());
+  m_deterministic = m_app.isDeterministic();
+  m_maxThreads = Math::max(Int(std::thread::hardware_concurrency()), m_threads);
+}
+
 void UI::resize(const Vector2i windowSize, const Vector2 scaling,
                 const Vector2i framebufferSize) {
   m_imgui.relayout(Vector2{windowSize} / scaling, windowSize, framebufferSize);
@@ -150,43 +190,214 @@ void UI::drawOptions() {
     m_app.resetSimulation();
   }
 
+  if (ImGui::Button(m_app.isPaused() ? "Play" : "Pause", ImVec2(110, 20))) {
+    m_app.setPaused(!m_app.isPaused());
+  }
+
+  ImGui::SameLine();
+
+  if (ImGui::Button("Step", ImVec2(50, 20))) {
+    m_app.stepSimulation(static_cast<UnsignedInt>(m_stepCount));
+  }
+
+  ImGui::SameLine();
+  ImGui::PushItemWidth(55);
+  if (ImGui::InputInt("##stepCount", &m_stepCount, 0)) {
+    m_stepCount = Math::max(m_stepCount, 1);
+  }
+  ImGui::PopItemWidth();
+
+  ImGui::Text("%s", m_app.isPaused()   ? "Paused"
+                    : m_app.isAtRest() ? "At rest"
+                                       : "Running");
+
+  if (ImGui::SliderFloat("Rest threshold", &m_restThreshold, 1e-9f, 1e-3f,
+                         "%.1e", 10.0f)) {
+    m_app.setRestThreshold(m_restThreshold);
+  }
+
   if (ImGui::SliderFloat("Step lenght", &m_stepLength, 0.00001f, 0.05f)) {
     m_app.setStepLength(m_stepLength);
   }
 
-  if (ImGui::SliderInt("Steps per draw",
-                       reinterpret_cast<int *>(&m_stepsPerFrame), 1, 1000)) {
+  if (ImGui::Checkbox("Real-time", &m_realTime)) {
+    m_app.setRealTime(m_realTime);
+  }
+
+  if (m_realTime) {
+    if (ImGui::SliderFloat("Frame budget (ms)", &m_frameBudget, 1.0f,
+                           100.0f)) {
+      m_app.setFrameBudget(m_frameBudget);
+    }
+
+    ImGui::Text("Sim/wall time %.2f, %.3f ms/step",
+                Double(m_app.getRealTimeRatio()),
+                1000.0 * Double(m_app.getStepCostEstimate()));
+  } else if (ImGui::SliderInt("Steps per draw",
+                              reinterpret_cast<int *>(&m_stepsPerFrame), 1,
+                              1000)) {
     m_app.setStepsPerFrame(m_stepsPerFrame);
   }
 
+  if (ImGui::SliderInt("Threads", &m_threads, 1, m_maxThreads)) {
+    m_app.setThreadCount(std::size_t(m_threads));
+  }
+
+  if (ImGui::Checkbox("Deterministic", &m_deterministic)) {
+    m_app.setDeterministic(m_deterministic);
+  }
+
+  for (std::size_t s = 0; s < TaskStageCount; ++s) {
+    const auto &stats{m_app.getStageStatistics(TaskStage(s))};
+    if (stats.calls > 0)
+      ImGui::Text("%s %.3f ms, %.0f%% efficiency", taskStageName(TaskStage(s)),
+                  1000.0 * stats.wallSeconds, 100.0 * stats.efficiency());
+  }
+
+  const auto &telemetry{m_app.getTelemetry()};
+  if (telemetry.getSize() > 0) {
+    const auto stepTime{[](const StepRecord &r) { return 1000.0 * r.seconds; }};
+    drawSparkline("Step time", telemetry.series(stepTime), "%.3f ms");
+  }
+
   bool updated{false};
 
-  if (ImGui::SliderInt("Cloth size x", &m_currentSize.x(), 1, 40)) {
+  if (ImGui::SliderInt("Cloth size x", &m_currentSize.x(), 2, 256)) {
     updated = true;
   }
 
-  if (ImGui::SliderInt("Cloth size y", &m_currentSize.y(), 1, 40)) {
+  if (ImGui::SliderInt("Cloth size y", &m_currentSize.y(), 2, 256)) {
     updated = true;
   }
 
   if (updated) {
-    Debug{} << "Set size does nothing";
+    m_app.setClothSize(Vector2ui{m_currentSize});
+  }
+
+  if (ImGui::Checkbox("Self collision", &m_selfCollision.enabled)) {
+    m_app.setSelfCollisionSettings(m_selfCollision);
+  }
+
+  if (m_selfCollision.enabled) {
+    if (ImGui::SliderFloat("Thickness", &m_selfCollision.thickness, 1e-3f,
+                           1e-1f, "%.4f", 10.0f)) {
+      m_app.setSelfCollisionSettings(m_selfCollision);
+    }
+
+    if (ImGui::SliderFloat("Cell size", &m_selfCollision.cellSize, 0.0f, 0.2f,
+                           m_selfCollision.cellSize > 0.0f ? "%.4f"
+                                                           : "automatic")) {
+      m_app.setSelfCollisionSettings(m_selfCollision);
+    }
+
+    if (ImGui::Checkbox("Continuous", &m_selfCollision.continuous)) {
+      m_app.setSelfCollisionSettings(m_selfCollision);
+    }
+
+    const auto &stats{m_app.getCollisionStatistics()};
+    const Double steps{Double(Math::max<std::size_t>(stats.steps, 1))};
+    ImGui::Text("Broad %.3f ms, narrow %.3f ms per step",
+                1000.0 * stats.broadPhaseSeconds / steps,
+                1000.0 * stats.narrowPhaseSeconds / steps);
+    ImGui::Text("%zu candidates, %zu contacts per step",
+                stats.candidates / std::size_t(steps),
+                stats.contacts / std::size_t(steps));
+
+    if (m_selfCollision.continuous)
+      ImGui::Text("Continuous %.3f ms, %zu impacts per step",
+                  1000.0 * stats.continuousSeconds / steps,
+                  stats.impacts / std::size_t(steps));
+  }
+
+  if (ImGui::Checkbox("Sleeping", &m_sleep.enabled)) {
+    m_app.setSleepSettings(m_sleep);
+  }
+
+  if (m_sleep.enabled) {
+    if (ImGui::SliderFloat("Sleep velocity", &m_sleep.velocity, 1e-4f, 1e-1f,
+                           "%.4f", 10.0f)) {
+      m_app.setSleepSettings(m_sleep);
+    }
+
+    if (ImGui::SliderFloat("Sleep acceleration", &m_sleep.acceleration, 1e-3f,
+                           1.0f, "%.3f", 10.0f)) {
+      m_app.setSleepSettings(m_sleep);
+    }
+
+    const auto &system{m_app.getSystem()};
+    ImGui::Text("%zu of %zu particles awake",
+                system->getParticleCount() -
+                    system->getSleepingParticleIds().size(),
+                system->getParticleCount());
+  }
+
+  ImGui::InputText("##mesh", m_meshPath.data(), m_meshPath.size());
+  ImGui::SameLine();
+
+  if (ImGui::Button("Load mesh", ImVec2(110, 20))) {
+    m_app.loadClothMesh(m_meshPath.data());
   }
 
   if (drawCombo("Integrator", m_integrators, m_currentIntegrator)) {
-    switch (m_currentIntegrator) {
-    case 0:
-      m_app.setIntegrator(forwardEulerStep);
-      break;
-    case 1:
-      m_app.setIntegrator(rk4Step);
-      break;
-    case 2:
-      m_app.setIntegrator(backwardEulerStep);
-      break;
-    case 3:
-      m_app.setIntegrator(backwardMidpointStep);
-      break;
+    m_app.setIntegrator(m_currentIntegrator);
+    m_newton = m_app.getNewtonPolicy();
+  }
+
+  if (isImplicitIntegrator(m_currentIntegrator)) {
+    if (drawCombo("Solver", m_solvers, m_currentSolver)) {
+      m_app.setLinearSolver(m_currentSolver);
+    }
+
+    bool newtonChanged{false};
+    newtonChanged |= ImGui::Checkbox("Reuse Jacobian", &m_newton.reuseJacobian);
+    ImGui::SameLine();
+    newtonChanged |= ImGui::Checkbox("Line search", &m_newton.lineSearch);
+    newtonChanged |=
+        ImGui::SliderFloat("Newton tolerance", &m_newton.relativeTolerance,
+                           1e-6f, 1e-1f, "%.1e", 10.0f);
+
+    Int maxIterations{Int(m_newton.maxIterations)};
+    if (ImGui::SliderInt("Newton iterations", &maxIterations, 1, 50)) {
+      m_newton.maxIterations = UnsignedInt(maxIterations);
+      newtonChanged = true;
+    }
+
+    std::size_t predictor{std::size_t(m_newton.predictor)};
+    if (drawCombo("Predictor", m_predictors, predictor)) {
+      m_newton.predictor = NewtonPredictor(predictor);
+      newtonChanged = true;
+    }
+
+    if (newtonChanged)
+      m_app.setNewtonPolicy(m_newton);
+
+    const auto &stats{m_app.getSystem()->getSolver().getStatistics()};
+    const Double solves{Double(Math::max<std::size_t>(stats.solves, 1))};
+    ImGui::Text("%.3f ms per solve, %.1f iterations",
+                1000.0 * stats.solveSeconds / solves,
+                Double(stats.iterations) / solves);
+
+    const Double factorizations{
+        Double(Math::max<std::size_t>(stats.factorizations, 1))};
+    ImGui::Text("%.3f ms, %.0f nonzeros per factorization",
+                1000.0 * stats.factorSeconds / factorizations,
+                Double(stats.factorNonZeros) / factorizations);
+
+    const Double steps{Double(Math::max<std::size_t>(stats.steps, 1))};
+    ImGui::Text("%.2f Newton iterations, %.2f Jacobians per step",
+                Double(stats.newtonIterations) / steps,
+                Double(stats.jacobianUpdates) / steps);
+
+    const auto &telemetry{m_app.getTelemetry()};
+    if (telemetry.getSize() > 0) {
+      const auto iterations{
+          [](const StepRecord &r) { return r.newtonIterations; }};
+      // Logarithmic, the residuals span orders of magnitude
+      const auto residual{[](const StepRecord &r) {
+        return std::log10(Math::max(r.finalResidual, 1e-12f));
+      }};
+      drawSparkline("Newton iterations", telemetry.series(iterations), "%.0f");
+      drawSparkline("Residual (log10)", telemetry.series(residual), "%.1f");
     }
   }
 
@@ -194,6 +405,46 @@ void UI::drawOptions() {
     m_app.setSystem(m_currentSystem);
   }
 
+  if (const auto nbody = dynamic_cast<NBody *>(m_app.getSystem().get())) {
+    Int bodies{Int(m_nbody.bodies)};
+    if (ImGui::InputInt("Bodies", &bodies, 100, 10000,
+                        ImGuiInputTextFlags_EnterReturnsTrue)) {
+      m_nbody.bodies = UnsignedInt(Math::clamp(bodies, 2, 1000000));
+      m_app.setNBodySettings(m_nbody);
+    }
+
+    if (drawCombo("Gravity", m_gravityMethods, m_currentGravityMethod)) {
+      m_nbody.method = GravityMethod(m_currentGravityMethod);
+      m_app.setNBodySettings(m_nbody);
+    }
+
+    if (m_nbody.method == GravityMethod::BarnesHut &&
+        ImGui::SliderFloat("Opening angle", &m_nbody.openingAngle, 0.0f,
+                           1.5f)) {
+      m_app.setNBodySettings(m_nbody);
+    }
+
+    if (ImGui::SliderFloat("Softening", &m_nbody.softening, 1e-4f, 1e-1f,
+                           "%.4f", 10.0f)) {
+      m_app.setNBodySettings(m_nbody);
+    }
+
+    const auto &stats{nbody->getStatistics()};
+    const Double evaluations{
+        Double(Math::max<std::size_t>(stats.evaluations, 1))};
+    ImGui::Text("Tree %.3f ms, forces %.3f ms, %zu nodes",
+                1000.0 * stats.buildSeconds / evaluations,
+                1000.0 * stats.forceSeconds / evaluations, stats.nodes);
+
+    if (ImGui::Button("Compare with direct sum", ImVec2(230, 20))) {
+      const auto comparison{nbody->compareWithDirectSum()};
+      Debug{} << "Barnes-Hut" << comparison.barnesHutSeconds * 1000.0
+              << "ms, direct" << comparison.directSeconds * 1000.0
+              << "ms, relative error rms" << comparison.rmsError << "max"
+              << comparison.maxError;
+    }
+  }
+
   if (ImGui::Button("Clear pinned", ImVec2(110, 20))) {
     Debug{} << "Clear pinned does nothing";
   }
@@ -204,6 +455,73 @@ void UI::drawOptions() {
     m_inPinnedVertexLassoMode = !m_inPinnedVertexLassoMode;
   }
 
+  ImGui::Checkbox("Lasso selects occluded", &m_lassoIncludesOccluded);
+
+  ImGui::InputText("##checkpoint", m_checkpointPath.data(),
+                   m_checkpointPath.size());
+
+  if (ImGui::Button("Save", ImVec2(110, 20))) {
+    m_app.saveCheckpoint(m_checkpointPath.data());
+  }
+
+  ImGui::SameLine();
+
+  if (ImGui::Button("Load", ImVec2(110, 20))) {
+    m_app.loadCheckpoint(m_checkpointPath.data());
+  }
+
+  ImGui::InputText("##trajectory", m_trajectoryPath.data(),
+                   m_trajectoryPath.size());
+
+  if (ImGui::Button(m_app.isRecording() ? "Stop recording" : "Record",
+                    ImVec2(110, 20))) {
+    if (m_app.isRecording())
+      m_app.stopRecording();
+    else
+      m_app.startRecording(m_trajectoryPath.data());
+  }
+
+  ImGui::SameLine();
+
+  if (auto playback = m_app.getPlayback()) {
+    if (ImGui::Button("Close playback", ImVec2(110, 20))) {
+      m_app.closePlayback();
+    } else {
+      int frame{static_cast<int>(playback->getFrame())};
+      if (ImGui::SliderInt("Frame", &frame, 0,
+                           static_cast<int>(playback->getFrameCount()) - 1)) {
+        m_app.seekPlayback(static_cast<std::size_t>(frame));
+      }
+
+      // A failed seek closes the playback
+      if (m_app.getPlayback())
+        ImGui::Text("t = %.4f s",
+                    playback->getFrameTime(playback->getFrame()));
+    }
+  } else if (ImGui::Button("Play back", ImVec2(110, 20))) {
+    m_app.openPlayback(m_trajectoryPath.data());
+  }
+
+  ImGui::InputText("##pointcache", m_pointCachePath.data(),
+                   m_pointCachePath.size());
+
+  if (ImGui::Button(m_app.isExportingPointCache() ? "Stop export"
+                                                  : "Export cache",
+                    ImVec2(110, 20))) {
+    if (m_app.isExportingPointCache())
+      m_app.stopPointCacheExport();
+    else
+      m_app.startPointCacheExport(m_pointCachePath.data(),
+                                  UnsignedInt(m_exportStride));
+  }
+
+  ImGui::SameLine();
+  ImGui::PushItemWidth(55);
+  if (ImGui::InputInt("Stride", &m_exportStride, 0)) {
+    m_exportStride = Math::max(m_exportStride, 1);
+  }
+  ImGui::PopItemWidth();
+
   if (ImGui::Button("About", ImVec2(110, 20)))
     m_showAbout = !m_showAbout;
 
@@ -273,7 +591,9 @@ bool UI::handleMouseReleaseEvent(Platform::Application::MouseEvent &event) {
   } else if (m_inPinnedVertexLassoMode && m_currentLasso.pixels.size() != 0) {
     m_inPinnedVertexLassoMode = false;
 
-    m_app.pinVertices(m_currentLasso);
+    // Without markers the id buffer holds no visibility information
+    m_app.pinVertices(m_currentLasso,
+                      m_lassoIncludesOccluded || !m_showVertexMarkers);
     m_currentLasso.clear();
     event.setAccepted();
 
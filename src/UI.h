@@ -10,10 +10,15 @@
 #include <Magnum/Platform/EmscriptenApplication.h>
 #endif
 
+#include <array>
 #include <functional>
 #include <memory>
 #include <vector>
 
+#include "Cloth.h"
+#include "Collision.h"
+#include "Integrators.h"
+#include "NBody.h"
 #include "System.h"
 
 namespace clothsim {
@@ -38,6 +43,9 @@ public:
   void resize(Vector2i windowSize, Vector2 scaling, Vector2i framebufferSize);
   void draw();
 
+  // Reads back settings changed by the app, e.g. after loading a checkpoint
+  void syncSettings();
+
   bool wantsTextInput();
 
   bool handleKeyPressEvent(Platform::Application::KeyEvent &event);
@@ -56,6 +64,9 @@ private:
 
   void drawOptions();
   void drawLasso();
+  // Plots the values of the last steps, the latest one is printed over them
+  void drawSparkline(const std::string &text, const std::vector<Float> &values,
+                     const char *format);
   std::vector<Vector2> toScreenCoordinates(const std::vector<Vector2i> &pixels);
 
   App &m_app;
@@ -68,23 +79,54 @@ private:
   bool m_showAbout;
 
   bool m_inPinnedVertexLassoMode;
+  bool m_lassoIncludesOccluded{false};
   Lasso m_currentLasso;
   Vector2i m_lassoPreviousPosition;
 
   Float m_stepLength{0.0001f};
   UnsignedInt m_stepsPerFrame{5};
+  Int m_stepCount{1};
+  bool m_realTime{false};
+  Float m_frameBudget{16.0f};
+  Float m_restThreshold{1e-6f};
+  Int m_threads{1};
+  Int m_maxThreads{1};
+  bool m_deterministic{false};
+  SelfCollisionSettings m_selfCollision{};
+  SleepSettings m_sleep{};
+  NBodySettings m_nbody{};
+  std::vector<std::string> m_gravityMethods{std::string{"Barnes-Hut"},
+                                            std::string{"Direct"}};
+  std::size_t m_currentGravityMethod{0};
 
   std::vector<std::string> m_integrators{
       std::string{"Forward Euler"}, std::string{"RK4"},
-      std::string{"Backward Euler"}, std::string{"Implicit midpoint"}};
+      std::string{"Backward Euler"}, std::string{"Implicit midpoint"},
+      std::string{"Velocity Verlet"}, std::string{"Leapfrog"},
+      std::string{"Yoshida"}};
   std::size_t m_currentIntegrator{0};
 
-  std::vector<std::string> m_systems{std::string{"First order oscillator"},
-                                     std::string{"Planet"},
-                                     std::string{"Cloth"}};
+  std::vector<std::string> m_solvers{std::string{"SparseLU"},
+                                     std::string{"Multigrid"},
+                                     std::string{"LDLT"}};
+  std::size_t m_currentSolver{0};
+  NewtonPolicy m_newton{};
+  std::vector<std::string> m_predictors{std::string{"Forward Euler"},
+                                        std::string{"Linear"},
+                                        std::string{"Quadratic"}};
+
+  std::vector<std::string> m_systems{
+      std::string{"First order oscillator"}, std::string{"Planet"},
+      std::string{"Cloth"}, std::string{"N-body"}};
   std::size_t m_currentSystem{2};
   Vector2i m_currentSize{3, 3};
 
+  std::array<char, 256> m_meshPath{"cloth.obj"};
+  std::array<char, 256> m_checkpointPath{"clothsim.checkpoint"};
+  std::array<char, 256> m_trajectoryPath{"clothsim.trajectory"};
+  std::array<char, 256> m_pointCachePath{"clothsim.pc2"};
+  Int m_exportStride{1};
+
   std::string m_licenceNotice;
 };
 
@@ -1,6 +1,8 @@
 #include "Util.h"
 
+#include <algorithm>
 #include <array>
+#include <numeric>
 #include <sstream>
 
 namespace clothsim {
@@ -64,4 +66,79 @@ std::vector<Vector2i> bresenham(const Vector2i a, const Vector2i b) {
   }
 }
 
-} // namespace clothsim
\ No newline at end of file
+Polygon::Polygon(const std::vector<Vector2> &vertices,
+                 const std::size_t slabCount)
+    : m_bounds{computeAABB(vertices)} {
+  if (vertices.size() < 3 || slabCount == 0)
+    return;
+
+  const Float height{m_bounds.max.y() - m_bounds.min.y()};
+  m_slabHeightInv = height > 0.0f ? static_cast<Float>(slabCount) / height
+                                  : 0.0f;
+
+  // Counting sort of the edges into the slabs they overlap
+  std::vector<std::size_t> counts(slabCount + 1, 0);
+  const auto forEachEdge = [&](auto &&f) {
+    for (std::size_t i = 0; i < vertices.size(); ++i) {
+      const Vector2 a{vertices[i]};
+      const Vector2 b{vertices[(i + 1) % vertices.size()]};
+
+      // Horizontal edges never contribute to a crossing
+      if (a.y() == b.y())
+        continue;
+
+      const auto first{slabIndex(Math::min(a.y(), b.y()))};
+      const auto last{slabIndex(Math::max(a.y(), b.y()))};
+
+      for (std::size_t s = first; s <= last; ++s)
+        f(s, Edge{a, b});
+    }
+  };
+
+  m_slabOffsets.assign(slabCount + 1, 0);
+  forEachEdge([&](const std::size_t s, const Edge &) { ++counts[s + 1]; });
+  std::partial_sum(counts.begin(), counts.end(), m_slabOffsets.begin());
+
+  m_slabEdges.resize(m_slabOffsets.back());
+  std::vector<std::size_t> cursor(m_slabOffsets.begin(),
+                                  m_slabOffsets.end() - 1);
+  forEachEdge([&](const std::size_t s, const Edge &e) {
+    m_slabEdges[cursor[s]++] = e;
+  });
+}
+
+std::size_t Polygon::slabIndex(const Float y) const {
+  const auto slabCount{m_slabOffsets.size() - 1};
+  const auto i{static_cast<std::size_t>(
+      Math::max(0.0f, (y - m_bounds.min.y()) * m_slabHeightInv))};
+
+  return std::min(i, slabCount - 1);
+}
+
+bool Polygon::contains(const Vector2 point) const {
+  if (m_slabOffsets.empty() || point.x() < m_bounds.min.x() ||
+      point.y() < m_bounds.min.y() || point.x() > m_bounds.max.x() ||
+      point.y() > m_bounds.max.y())
+    return false;
+
+  const auto s{slabIndex(point.y())};
+  bool inside{false};
+
+  for (auto i = m_slabOffsets[s]; i < m_slabOffsets[s + 1]; ++i) {
+    const Vector2 a{m_slabEdges[i].a};
+    const Vector2 b{m_slabEdges[i].b};
+
+    if ((a.y() > point.y()) != (b.y() > point.y())) {
+      const Float x{a.x() + (point.y() - a.y()) * (b.x() - a.x()) /
+                                (b.y() - a.y())};
+      if (point.x() < x)
+        inside = !inside;
+    }
+  }
+
+  return inside;
+}
+
+const AABB<Vector2> &Polygon::bounds() const { return m_bounds; }
+
+} // namespace clothsim
@@ -23,7 +23,7 @@ template <typename V> struct AABB {
 
 template <class V> AABB<V> computeAABB(const std::vector<V> &elements) {
   V min{std::numeric_limits<typename V::Type>::max()};
-  V max{std::numeric_limits<typename V::Type>::min()};
+  V max{std::numeric_limits<typename V::Type>::lowest()};
 
   for (auto element : elements) {
     min = Magnum::Math::min(min, element);
@@ -36,6 +36,31 @@ template <class V> AABB<V> computeAABB(const std::vector<V> &elements) {
 std::vector<Magnum::Vector2i> bresenham(const Magnum::Vector2i a,
                                         const Magnum::Vector2i b);
 
+// Closed polygon supporting fast even-odd point containment queries.
+// Edges are bucketed into horizontal slabs so that a query only tests the
+// edges crossing the slab of the point instead of the whole outline.
+class Polygon {
+public:
+  explicit Polygon(const std::vector<Magnum::Vector2> &vertices,
+                   const std::size_t slabCount = 64);
+
+  bool contains(const Magnum::Vector2 point) const;
+  const AABB<Magnum::Vector2> &bounds() const;
+
+private:
+  struct Edge {
+    Magnum::Vector2 a;
+    Magnum::Vector2 b;
+  };
+
+  std::size_t slabIndex(const Float y) const;
+
+  AABB<Magnum::Vector2> m_bounds;
+  Float m_slabHeightInv{0.0f};
+  std::vector<std::size_t> m_slabOffsets;
+  std::vector<Edge> m_slabEdges;
+};
+
 #define TO_STRING_DETAIL(x) #x
 #define TO_STRING(x) TO_STRING_DETAIL(x)
 
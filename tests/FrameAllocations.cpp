@@ -0,0 +1,76 @@
+// Checks that preparing a frame of an unchanged system does not allocate:
+// taking the snapshot the app publishes, with the mesh, the positions and
+// the marker colors of the system, and filling the triangle data the
+// drawable uploads.
+
+#include "Channel.h"
+#include "Cloth.h"
+#include "Snapshot.h"
+
+#include <Corrade/Containers/Array.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<std::size_t> allocations{0};
+
+void *allocate(const std::size_t size) {
+  ++allocations;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+} // namespace
+
+void *operator new(const std::size_t size) { return allocate(size); }
+void *operator new[](const std::size_t size) { return allocate(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+int main() {
+  using namespace clothsim;
+
+  Cloth cloth;
+  cloth.setSize(Vector2ui{32u, 32u});
+
+  SnapshotChannel<SimulationSnapshot> snapshots;
+  Corrade::Containers::Array<Vector3> triangleData;
+
+  // Both sides of App::publishSnapshot and Drawable::updateMesh
+  const auto prepareFrame = [&] {
+    takeSnapshot(cloth, 0.0, snapshots.writeBuffer());
+    snapshots.publish();
+
+    snapshots.update();
+    const auto &snapshot{snapshots.read()};
+    if (triangleData.size() != 2 * snapshot.indices.size())
+      triangleData = Corrade::Containers::Array<Vector3>{
+          Corrade::Containers::NoInit, 2 * snapshot.indices.size()};
+
+    interleaveFlatTriangles(snapshot.indices, snapshot.vertices,
+                            triangleData);
+  };
+
+  // The writer cycles through the three buffers of the channel, each of
+  // them allocates the first time it is filled
+  for (int frame = 0; frame < 3; ++frame)
+    prepareFrame();
+
+  for (int frame = 3; frame < 6; ++frame) {
+    const std::size_t before{allocations.load()};
+    prepareFrame();
+    const std::size_t count{allocations.load() - before};
+
+    if (count != 0) {
+      std::printf("Frame %d allocated %zu times\n", frame, count);
+      return 1;
+    }
+  }
+
+  return 0;
+}